@@ -0,0 +1,204 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+#include <mesos/state/in_memory.hpp>
+#include <mesos/state/state.hpp>
+
+#include "benchmarks.hpp"
+#include "cluster_api.hpp"
+#include "offer_simulator.hpp"
+#include "scheduler.hpp"
+
+DEFINE_int32(api_queries, 1000, "Repetitions of every API query");
+
+DECLARE_int32(rounds);
+DECLARE_double(task_failures_per_hour);
+DECLARE_string(target_version);
+
+static int64_t MicrosNow() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The matches of a /v1/nodes query, by walking all nodes.
+static size_t ScanNodes(const ClusterSnapshot& cluster,
+                        const NodeIndex::Query& query) {
+  size_t result = 0;
+  for (size_t index = 0; index < cluster.node_count; ++index) {
+    const quobyte::NodeState& node = cluster.node(index);
+    bool match = !query.probed_before_set ||
+        node.last_probe_s() < query.probed_before_s;
+    for (int s = 0; s < NodeIndex::SERVICE_COUNT; ++s) {
+      match = match && (query.states[s] == 0 || NodeIndex::service(
+          node, static_cast<NodeIndex::Service>(s)).state() ==
+          query.states[s]);
+    }
+    uint32_t devices = 0;
+    for (int device_type : node.device_type()) {
+      devices |= 1u << device_type;
+    }
+    match = match && (devices & query.devices) == query.devices;
+    result += match;
+  }
+  return result;
+}
+
+// Counts the entries of all pages, "nodes" or "services".
+static size_t CountPages(const std::function<int(
+                             const quobyte::HttpServer::Arguments&,
+                             std::string*)>& serve,
+                         quobyte::HttpServer::Arguments arguments,
+                         const std::string& entry_key) {
+  size_t result = 0;
+  arguments["limit"] = "1000";
+  while (true) {
+    std::string body;
+    CHECK_EQ(serve(arguments, &body), 200) << body;
+    size_t position = 0;
+    while ((position = body.find(entry_key, position)) != std::string::npos) {
+      ++result;
+      ++position;
+    }
+    const size_t next = body.find("\"next\":\"");
+    if (next == std::string::npos) {
+      return result;
+    }
+    arguments["start"] = std::to_string(atol(body.c_str() + next + 8));
+  }
+}
+
+// Times pages of /v1/nodes and /v1/services against a scan of all nodes,
+// and checks that paging through a query returns what the scan finds.
+int RunApiBenchmark() {
+  mesos::state::InMemoryStorage storage;
+  mesos::state::State state_storage(&storage);
+  SchedulerStateProxy state_proxy(&state_storage, "scheduler-bench");
+  state_proxy.set_target_version(FLAGS_target_version);
+  mesos::FrameworkInfo framework;
+  framework.set_user("");
+  framework.set_name("quobyte-bench");
+  framework.set_webui_url("http://localhost:7888");
+  SimulatedClock clock;
+  QuobyteScheduler scheduler(&state_proxy, NULL, &framework, &clock);
+  SimulatorConfig config;
+  config.hosts = FLAGS_hosts;
+  config.task_failures_per_hour = FLAGS_task_failures_per_hour;
+  OfferSimulator simulator(&scheduler, &clock, config);
+  simulator.registerFramework();
+  simulator.run(FLAGS_rounds);
+
+  const std::shared_ptr<const ClusterSnapshot> cluster = scheduler.snapshot();
+  const NodeIndex& index = scheduler.nodeIndex();
+  const int64_t now_s = clock.nowSeconds();
+
+  struct Case {
+    std::string name;
+    quobyte::HttpServer::Arguments arguments;
+    NodeIndex::Query query;
+  };
+  std::vector<Case> cases(5);
+  cases[0].name = "all";
+  cases[1].name = "data=RUNNING";
+  cases[1].arguments["data"] = "RUNNING";
+  cases[1].query.states[NodeIndex::DATA] = quobyte::ServiceState::RUNNING;
+  cases[2].name = "registry=RUNNING";
+  cases[2].arguments["registry"] = "RUNNING";
+  cases[2].query.states[NodeIndex::REGISTRY] = quobyte::ServiceState::RUNNING;
+  cases[3].name = "device=METADATA&metadata=RUNNING";
+  cases[3].arguments["device"] = "METADATA";
+  cases[3].arguments["metadata"] = "RUNNING";
+  cases[3].query.devices = 1u << quobyte::METADATA;
+  cases[3].query.states[NodeIndex::METADATA] = quobyte::ServiceState::RUNNING;
+  cases[4].name = "stale_probe_s=20";
+  cases[4].arguments["stale_probe_s"] = "20";
+  cases[4].query.probed_before_set = true;
+  cases[4].query.probed_before_s = now_s - 20 + 1;
+
+  int errors = 0;
+  printf("%-36s %8s %12s %12s %10s\n", "/v1/nodes?", "matches",
+         "page p50 us", "scan p50 us", "page bytes");
+  for (Case& c : cases) {
+    auto serve = [&](const quobyte::HttpServer::Arguments& arguments,
+                     std::string* body) {
+      return ServeNodesApi(*cluster, index, now_s, "/v1/nodes", arguments,
+                           body);
+    };
+    c.arguments["fields"] = "hostname";
+    const size_t paged = CountPages(serve, c.arguments, "\"hostname\"");
+    c.arguments.erase("fields");
+    const size_t scanned = ScanNodes(*cluster, c.query);
+    if (paged != scanned) {
+      printf("%s: %zu nodes through the API, %zu by scan\n", c.name.c_str(),
+             paged, scanned);
+      ++errors;
+    }
+
+    LatencySamples page;
+    LatencySamples scan;
+    std::string body;
+    for (int i = 0; i < FLAGS_api_queries; ++i) {
+      int64_t start = MicrosNow();
+      serve(c.arguments, &body);
+      page.add(MicrosNow() - start);
+      start = MicrosNow();
+      ScanNodes(*cluster, c.query);
+      scan.add(MicrosNow() - start);
+    }
+    printf("%-36s %8zu %12ld %12ld %10zu\n", c.name.c_str(), scanned,
+           static_cast<long>(page.percentile(0.5)),
+           static_cast<long>(scan.percentile(0.5)), body.size());
+  }
+
+  auto services = [&](const quobyte::HttpServer::Arguments& arguments,
+                      std::string* body) {
+    return ServeServicesApi(*cluster, index, arguments, body);
+  };
+  for (const char* state : {"", "RUNNING", "STARTING"}) {
+    quobyte::HttpServer::Arguments arguments;
+    if (*state != '\0') {
+      arguments["state"] = state;
+    }
+    size_t expected = 0;
+    for (const quobyte::ServiceState* singleton :
+         {&cluster->api, &cluster->s3, &cluster->console}) {
+      expected += arguments.empty() ||
+          ServiceState_TaskState_Name(singleton->state()) == state;
+    }
+    for (size_t node = 0; node < cluster->node_count; ++node) {
+      for (int s = 0; s < NodeIndex::SERVICE_COUNT; ++s) {
+        expected += arguments.empty() ||
+            ServiceState_TaskState_Name(NodeIndex::service(
+                cluster->node(node), static_cast<NodeIndex::Service>(s))
+                .state()) == state;
+      }
+    }
+    const size_t paged = CountPages(services, arguments, "\"service\"");
+    LatencySamples page;
+    std::string body;
+    for (int i = 0; i < FLAGS_api_queries; ++i) {
+      const int64_t start = MicrosNow();
+      services(arguments, &body);
+      page.add(MicrosNow() - start);
+    }
+    printf("/v1/services?state=%-17s %8zu %12ld %12s %10zu\n", state, paged,
+           static_cast<long>(page.percentile(0.5)), "", body.size());
+    if (paged != expected) {
+      printf("state %s: %zu services through the API, %zu expected\n", state,
+             paged, expected);
+      ++errors;
+    }
+  }
+  return errors == 0 ? 0 : 1;
+}
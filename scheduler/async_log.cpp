@@ -0,0 +1,215 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "async_log.hpp"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <chrono>
+
+// Slots keep their buffer for the next message, up to this size.
+static const size_t kMaxKeptMessageBytes = 4096;
+
+class AsyncLogWriter::SeverityLogger : public google::base::Logger {
+ public:
+  SeverityLogger(AsyncLogWriter* writer,
+                 google::LogSeverity severity,
+                 google::base::Logger* file)
+      : writer_(writer), severity_(severity), file_(file) {}
+
+  virtual void Write(bool force_flush,
+                     time_t timestamp,
+                     const char* message,
+                     int length) override {
+    if (length == 0) {
+      // How glog flushes all log files before it aborts on FATAL.
+      writer_->flush();
+      return;
+    }
+    writer_->push(severity_, force_flush, timestamp, message, length);
+  }
+
+  virtual void Flush() override {
+    writer_->flush();
+  }
+
+  virtual uint32_t LogSize() override {
+    return file_->LogSize();
+  }
+
+ private:
+  AsyncLogWriter* writer_;
+  const google::LogSeverity severity_;
+  google::base::Logger* file_;
+};
+
+static uint64_t RoundUpToPowerOf2(size_t value) {
+  uint64_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+AsyncLogWriter::AsyncLogWriter(size_t capacity)
+    : mask_(RoundUpToPowerOf2(capacity) - 1),
+      slots_(new Slot[mask_ + 1]),
+      dropped_(MetricsRegistry::instance()->counter(
+          "quobyte_log_messages_dropped_total",
+          "Log messages dropped because the log writer fell behind")),
+      started_dropped_(dropped_->value()),
+      reported_dropped_(started_dropped_) {
+  for (uint64_t i = 0; i <= mask_; ++i) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  for (int severity = 0; severity < google::NUM_SEVERITIES; ++severity) {
+    files_[severity] = google::base::GetLogger(severity);
+    loggers_[severity].reset(
+        new SeverityLogger(this, severity, files_[severity]));
+  }
+  thread_ = std::thread(&AsyncLogWriter::run, this);
+  for (int severity = 0; severity < google::NUM_SEVERITIES; ++severity) {
+    google::base::SetLogger(severity, loggers_[severity].get());
+  }
+}
+
+AsyncLogWriter::~AsyncLogWriter() {
+  // glog calls the loggers under its lock, none is in use after this.
+  for (int severity = 0; severity < google::NUM_SEVERITIES; ++severity) {
+    google::base::SetLogger(severity, files_[severity]);
+  }
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  drained_.notify_all();
+  thread_.join();
+  drain();
+  reportDropped();
+  for (google::base::Logger* file : files_) {
+    file->Flush();
+  }
+}
+
+bool AsyncLogWriter::push(google::LogSeverity severity,
+                          bool force_flush,
+                          time_t timestamp,
+                          const char* message,
+                          int length) {
+  uint64_t position = enqueue_.load(std::memory_order_relaxed);
+  Slot* slot;
+  while (true) {
+    slot = &slots_[position & mask_];
+    const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      if (enqueue_.compare_exchange_weak(position, position + 1,
+                                         std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < position) {
+      // Not written since the last round through the queue.
+      dropped_->increment();
+      return false;
+    } else {
+      position = enqueue_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->severity = severity;
+  slot->force_flush = force_flush;
+  slot->timestamp = timestamp;
+  slot->message.assign(message, length);
+  slot->sequence.store(position + 1, std::memory_order_release);
+
+  if (sleeping_.load(std::memory_order_relaxed) &&
+      sleeping_.exchange(false)) {
+    wake_.notify_one();
+  }
+  return true;
+}
+
+bool AsyncLogWriter::drain() {
+  bool wrote = false;
+  uint64_t position = dequeue_.load(std::memory_order_relaxed);
+  while (true) {
+    Slot& slot = slots_[position & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+      break;
+    }
+    files_[slot.severity]->Write(slot.force_flush, slot.timestamp,
+                                 slot.message.data(), slot.message.size());
+    if (slot.message.capacity() > kMaxKeptMessageBytes) {
+      std::string().swap(slot.message);
+    }
+    slot.sequence.store(position + mask_ + 1, std::memory_order_release);
+    dequeue_.store(++position, std::memory_order_release);
+    wrote = true;
+  }
+  return wrote;
+}
+
+void AsyncLogWriter::reportDropped() {
+  const uint64_t dropped = dropped_->value();
+  if (dropped == reported_dropped_) {
+    return;
+  }
+  // Formatted like glog's warnings, the writer must not log itself: a
+  // thread that logs FATAL waits for it while holding glog's lock.
+  const time_t now = time(NULL);
+  struct tm local;
+  localtime_r(&now, &local);
+  char line[160];
+  const int length = snprintf(
+      line, sizeof(line),
+      "W%02d%02d %02d:%02d:%02d.000000 async_log.cpp] Dropped %llu log "
+      "messages, the log writer fell behind\n",
+      local.tm_mon + 1, local.tm_mday, local.tm_hour, local.tm_min,
+      local.tm_sec,
+      static_cast<unsigned long long>(dropped - reported_dropped_));
+  reported_dropped_ = dropped;
+  files_[google::GLOG_INFO]->Write(false, now, line, length);
+  files_[google::GLOG_WARNING]->Write(false, now, line, length);
+}
+
+void AsyncLogWriter::run() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (!stopping_) {
+    lock.unlock();
+    const bool wrote = drain();
+    if (wrote) {
+      reportDropped();
+    }
+    lock.lock();
+    drained_.notify_all();
+    if (wrote || stopping_) {
+      continue;
+    }
+    sleeping_.store(true);
+    // A message queued just before is not followed by a wake-up, the
+    // timeout makes up for the rare miss.
+    const uint64_t position = dequeue_.load(std::memory_order_relaxed);
+    if (slots_[position & mask_].sequence.load(std::memory_order_acquire) !=
+        position + 1) {
+      wake_.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    sleeping_.store(false);
+  }
+}
+
+void AsyncLogWriter::flush() {
+  const uint64_t queued = enqueue_.load(std::memory_order_acquire);
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    wake_.notify_one();
+    drained_.wait(lock, [this, queued]() {
+      return dequeue_.load(std::memory_order_acquire) >= queued || stopping_;
+    });
+  }
+  for (google::base::Logger* file : files_) {
+    file->Flush();
+  }
+}
@@ -0,0 +1,92 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include "metrics.hpp"
+
+// Writes glog's log files from a background thread. A thread that logs, the
+// driver thread above all, only copies the formatted message into a bounded
+// lock-free queue. When the writer falls behind and the queue is full,
+// messages are dropped and counted instead of holding up the caller, and
+// the log says how many went missing.
+//
+// glog still formats messages on the logging thread and writes those that
+// go to stderr right away, --logtostderr logs stay synchronous.
+class AsyncLogWriter {
+ public:
+  // Takes over the log files of all severities from glog. capacity is
+  // rounded up to a power of 2.
+  explicit AsyncLogWriter(size_t capacity);
+  // Gives the log files back to glog and writes what is still queued.
+  ~AsyncLogWriter();
+
+  // Blocks until the messages queued so far are written, then flushes the
+  // log files.
+  void flush();
+
+  // Since the writer started.
+  uint64_t dropped() const {
+    return dropped_->value() - started_dropped_;
+  }
+
+ private:
+  class SeverityLogger;
+
+  struct Slot {
+    // The queue position the slot is ready for: to be filled at position,
+    // to be written at position + 1.
+    std::atomic<uint64_t> sequence;
+    google::LogSeverity severity;
+    bool force_flush;
+    time_t timestamp;
+    std::string message;
+  };
+
+  // From any thread, false if the queue is full.
+  bool push(google::LogSeverity severity,
+            bool force_flush,
+            time_t timestamp,
+            const char* message,
+            int length);
+  void run();
+  // Writes the queued messages, returns false if there were none.
+  bool drain();
+  void reportDropped();
+
+  const uint64_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  // Producers and the writer each on their own cache line.
+  std::atomic<uint64_t> enqueue_{0};
+  char padding_[metrics_internal::kPadding];
+  std::atomic<uint64_t> dequeue_{0};
+  std::atomic<bool> sleeping_{false};
+  bool stopping_ = false;
+  std::mutex lock_;
+  // The writer waits for messages, flush() for the writer.
+  std::condition_variable wake_;
+  std::condition_variable drained_;
+  Counter* dropped_;
+  uint64_t started_dropped_;
+  // Written to the log so far.
+  uint64_t reported_dropped_;
+  // glog's loggers of the log files, by severity.
+  google::base::Logger* files_[google::NUM_SEVERITIES];
+  std::unique_ptr<SeverityLogger> loggers_[google::NUM_SEVERITIES];
+  std::thread thread_;
+};
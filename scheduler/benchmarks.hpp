@@ -0,0 +1,23 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <gflags/gflags.h>
+
+// Entry points of quobyte-mesos-bench, selected with --benchmark.
+// Each returns the process exit status.
+
+DECLARE_int32(hosts);
+
+int RunRegistryBenchmark();
+int RunResourceBenchmark();
+int RunStateBenchmark();
+int RunStorageBenchmark();
+int RunHttpBenchmark();
+int RunArchiveBenchmark();
+int RunStatusPageBenchmark();
+int RunApiBenchmark();
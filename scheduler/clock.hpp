@@ -0,0 +1,59 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Time source for all scheduler timing decisions. The scheduler never reads
+// the system clock directly, so a simulation can replace it.
+class Clock {
+ public:
+  virtual ~Clock() {}
+
+  // Monotonic time, not related to wall clock time.
+  virtual int64_t nowMicros() const = 0;
+
+  int64_t nowSeconds() const {
+    return nowMicros() / 1000000;
+  }
+};
+
+class SystemClock : public Clock {
+ public:
+  virtual int64_t nowMicros() const override {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+};
+
+// Deterministic clock that only moves when advanced. Starts well after 0 so
+// that "never happened" timestamps (0) are always considered overdue, like
+// they are with the steady clock of a running system.
+class SimulatedClock : public Clock {
+ public:
+  static const int64_t kDefaultStartMicros = 1000000LL * 1000000;
+
+  explicit SimulatedClock(int64_t start_micros = kDefaultStartMicros)
+      : now_micros_(start_micros) {}
+
+  virtual int64_t nowMicros() const override {
+    return now_micros_.load(std::memory_order_relaxed);
+  }
+
+  void advanceMicros(int64_t micros) {
+    now_micros_.fetch_add(micros, std::memory_order_relaxed);
+  }
+
+  void advanceSeconds(int64_t seconds) {
+    advanceMicros(seconds * 1000000);
+  }
+
+ private:
+  std::atomic<int64_t> now_micros_;
+};
@@ -0,0 +1,674 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "cluster_api.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <google/protobuf/descriptor.h>
+#include <gflags/gflags.h>
+
+DEFINE_double(task_latency_outlier_factor, 3,
+              "Hosts whose mean task startup time is this many times the "
+              "median of a service are outliers on /v1/task_latency");
+DEFINE_int32(task_latency_outlier_min_s, 30,
+             "Outlier hosts start tasks at least this much slower than the "
+             "median");
+
+static const char* kNodesUrl = "/v1/nodes";
+static const char* kTaskLatencyUrl = "/v1/task_latency";
+static const char* kDecisionsUrl = "/v1/decisions";
+static const size_t kDefaultLimit = 100;
+static const size_t kMaxLimit = 1000;
+// Cursors of /v1/services below this are the singleton services.
+static const uint32_t kSingletonCount = 3;
+
+void AppendJsonString(const std::string& value, std::string* out) {
+  out->push_back('"');
+  for (char c : value) {
+    switch (c) {
+      case '"':
+        *out += "\\\"";
+        break;
+      case '\\':
+        *out += "\\\\";
+        break;
+      case '\n':
+        *out += "\\n";
+        break;
+      case '\t':
+        *out += "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          *out += escaped;
+        } else {
+          out->push_back(c);
+        }
+    }
+  }
+  out->push_back('"');
+}
+
+static void AppendJsonMessage(const google::protobuf::Message& message,
+                              const std::set<std::string>* fields,
+                              std::string* out);
+
+static void AppendJsonValue(const google::protobuf::Message& message,
+                            const google::protobuf::FieldDescriptor* field,
+                            int index,
+                            std::string* out) {
+  typedef google::protobuf::FieldDescriptor FieldDescriptor;
+  const google::protobuf::Reflection* reflection = message.GetReflection();
+  const bool repeated = field->is_repeated();
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+      *out += std::to_string(repeated ?
+          reflection->GetRepeatedInt32(message, field, index) :
+          reflection->GetInt32(message, field));
+      break;
+    case FieldDescriptor::CPPTYPE_INT64:
+      *out += std::to_string(repeated ?
+          reflection->GetRepeatedInt64(message, field, index) :
+          reflection->GetInt64(message, field));
+      break;
+    case FieldDescriptor::CPPTYPE_UINT32:
+      *out += std::to_string(repeated ?
+          reflection->GetRepeatedUInt32(message, field, index) :
+          reflection->GetUInt32(message, field));
+      break;
+    case FieldDescriptor::CPPTYPE_UINT64:
+      *out += std::to_string(repeated ?
+          reflection->GetRepeatedUInt64(message, field, index) :
+          reflection->GetUInt64(message, field));
+      break;
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      *out += std::to_string(repeated ?
+          reflection->GetRepeatedDouble(message, field, index) :
+          reflection->GetDouble(message, field));
+      break;
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      *out += std::to_string(repeated ?
+          reflection->GetRepeatedFloat(message, field, index) :
+          reflection->GetFloat(message, field));
+      break;
+    case FieldDescriptor::CPPTYPE_BOOL:
+      *out += (repeated ?
+          reflection->GetRepeatedBool(message, field, index) :
+          reflection->GetBool(message, field)) ? "true" : "false";
+      break;
+    case FieldDescriptor::CPPTYPE_ENUM:
+      AppendJsonString((repeated ?
+          reflection->GetRepeatedEnum(message, field, index) :
+          reflection->GetEnum(message, field))->name(), out);
+      break;
+    case FieldDescriptor::CPPTYPE_STRING:
+      AppendJsonString(repeated ?
+          reflection->GetRepeatedString(message, field, index) :
+          reflection->GetString(message, field), out);
+      break;
+    case FieldDescriptor::CPPTYPE_MESSAGE:
+      AppendJsonMessage(repeated ?
+          reflection->GetRepeatedMessage(message, field, index) :
+          reflection->GetMessage(message, field), NULL, out);
+      break;
+  }
+}
+
+// The set fields of message, only those in fields if given.
+static void AppendJsonMessage(const google::protobuf::Message& message,
+                              const std::set<std::string>* fields,
+                              std::string* out) {
+  std::vector<const google::protobuf::FieldDescriptor*> set_fields;
+  message.GetReflection()->ListFields(message, &set_fields);
+  out->push_back('{');
+  bool first = true;
+  for (const google::protobuf::FieldDescriptor* field : set_fields) {
+    if (fields != NULL && fields->count(field->name()) == 0) {
+      continue;
+    }
+    if (!first) {
+      out->push_back(',');
+    }
+    first = false;
+    AppendJsonString(field->name(), out);
+    out->push_back(':');
+    if (field->is_repeated()) {
+      out->push_back('[');
+      const int size = message.GetReflection()->FieldSize(message, field);
+      for (int i = 0; i < size; ++i) {
+        if (i > 0) {
+          out->push_back(',');
+        }
+        AppendJsonValue(message, field, i, out);
+      }
+      out->push_back(']');
+    } else {
+      AppendJsonValue(message, field, 0, out);
+    }
+  }
+  out->push_back('}');
+}
+
+static int JsonError(int status, const std::string& message,
+                     std::string* body) {
+  *body = "{\"error\":";
+  AppendJsonString(message, body);
+  *body += "}";
+  return status;
+}
+
+static std::vector<std::string> SplitList(const std::string& value) {
+  std::vector<std::string> result;
+  size_t start = 0;
+  while (start <= value.size()) {
+    size_t end = value.find(',', start);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+    if (end > start) {
+      result.push_back(value.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return result;
+}
+
+bool ParseNumber(const std::string& value, uint64_t* number) {
+  if (value.empty()) {
+    return false;
+  }
+  char* end;
+  *number = strtoull(value.c_str(), &end, 10);
+  return *end == '\0' && value[0] != '-';
+}
+
+// Reads limit, returns false with an error body if invalid.
+static bool ParseLimit(const quobyte::HttpServer::Arguments& arguments,
+                       size_t* limit,
+                       std::string* body) {
+  *limit = kDefaultLimit;
+  uint64_t number;
+  auto argument = arguments.find("limit");
+  if (argument != arguments.end()) {
+    if (!ParseNumber(argument->second, &number) || number == 0 ||
+        number > kMaxLimit) {
+      JsonError(400, "limit must be 1 to " + std::to_string(kMaxLimit),
+                body);
+      return false;
+    }
+    *limit = number;
+  }
+  return true;
+}
+
+// Reads limit and start, returns false with an error body if invalid.
+static bool ParsePage(const quobyte::HttpServer::Arguments& arguments,
+                      size_t* limit,
+                      uint32_t* start,
+                      std::string* body) {
+  *start = 0;
+  if (!ParseLimit(arguments, limit, body)) {
+    return false;
+  }
+  uint64_t number;
+  auto argument = arguments.find("start");
+  if (argument != arguments.end()) {
+    if (!ParseNumber(argument->second, &number) ||
+        number >= NodeIndex::kNotFound) {
+      JsonError(400, "Invalid start " + argument->second, body);
+      return false;
+    }
+    *start = number;
+  }
+  return true;
+}
+
+static bool ParseState(const std::string& name, int* state) {
+  quobyte::ServiceState::TaskState value;
+  if (!quobyte::ServiceState::TaskState_Parse(name, &value)) {
+    return false;
+  }
+  *state = value;
+  return true;
+}
+
+static void AppendNext(uint64_t next, std::string* body) {
+  if (next != NodeIndex::kNotFound) {
+    *body += ",\"next\":\"" + std::to_string(next) + "\"";
+  }
+}
+
+int ServeNodesApi(const ClusterSnapshot& cluster,
+                  const NodeIndex& index,
+                  int64_t now_s,
+                  const std::string& path,
+                  const quobyte::HttpServer::Arguments& arguments,
+                  std::string* body) {
+  std::set<std::string> fields;
+  auto argument = arguments.find("fields");
+  if (argument != arguments.end()) {
+    const google::protobuf::Descriptor* descriptor =
+        quobyte::NodeState::descriptor();
+    for (const std::string& field : SplitList(argument->second)) {
+      if (descriptor->FindFieldByName(field) == NULL) {
+        return JsonError(400, "Unknown field " + field, body);
+      }
+      fields.insert(field);
+    }
+  }
+  const std::set<std::string>* selected = fields.empty() ? NULL : &fields;
+
+  const std::string node_prefix = std::string(kNodesUrl) + "/";
+  if (path.compare(0, node_prefix.size(), node_prefix) == 0) {
+    const std::string hostname = path.substr(node_prefix.size());
+    const uint32_t node = index.findByHostname(hostname);
+    if (node == NodeIndex::kNotFound || node >= cluster.node_count) {
+      return JsonError(404, "Unknown node " + hostname, body);
+    }
+    body->clear();
+    AppendJsonMessage(cluster.node(node), selected, body);
+    return 200;
+  }
+
+  NodeIndex::Query query;
+  for (int s = 0; s < NodeIndex::SERVICE_COUNT; ++s) {
+    argument = arguments.find(
+        NodeIndex::serviceName(static_cast<NodeIndex::Service>(s)));
+    if (argument != arguments.end() &&
+        !ParseState(argument->second, &query.states[s])) {
+      return JsonError(400, "Unknown state " + argument->second, body);
+    }
+  }
+  argument = arguments.find("device");
+  if (argument != arguments.end()) {
+    for (const std::string& name : SplitList(argument->second)) {
+      quobyte::DeviceType device_type;
+      if (!quobyte::DeviceType_Parse(name, &device_type)) {
+        return JsonError(400, "Unknown device type " + name, body);
+      }
+      query.devices |= 1u << device_type;
+    }
+  }
+  argument = arguments.find("stale_probe_s");
+  if (argument != arguments.end()) {
+    uint64_t seconds;
+    if (!ParseNumber(argument->second, &seconds)) {
+      return JsonError(400, "Invalid stale_probe_s", body);
+    }
+    query.probed_before_set = true;
+    query.probed_before_s = now_s - static_cast<int64_t>(seconds) + 1;
+  }
+  size_t limit;
+  uint32_t start;
+  if (!ParsePage(arguments, &limit, &start, body)) {
+    return 400;
+  }
+
+  uint32_t next;
+  const std::vector<uint32_t> nodes = index.query(query, start, limit, &next);
+  *body = "{\"nodes\":[";
+  bool first = true;
+  for (uint32_t node : nodes) {
+    // The index can be ahead of the snapshot taken before it.
+    if (node >= cluster.node_count) {
+      continue;
+    }
+    if (!first) {
+      body->push_back(',');
+    }
+    first = false;
+    AppendJsonMessage(cluster.node(node), selected, body);
+  }
+  *body += "]";
+  AppendNext(next, body);
+  *body += "}";
+  return 200;
+}
+
+static void AppendService(const std::string& hostname,
+                          const char* service,
+                          const quobyte::ServiceState& state,
+                          std::string* body) {
+  std::string json;
+  AppendJsonMessage(state, NULL, &json);
+  *body += "{";
+  if (!hostname.empty()) {
+    *body += "\"hostname\":";
+    AppendJsonString(hostname, body);
+    *body += ",";
+  }
+  *body += "\"service\":\"" + std::string(service) + "\"";
+  if (json.size() > 2) {
+    body->push_back(',');
+    body->append(json, 1, json.size() - 1);
+  } else {
+    body->push_back('}');
+  }
+}
+
+int ServeServicesApi(const ClusterSnapshot& cluster,
+                     const NodeIndex& index,
+                     const quobyte::HttpServer::Arguments& arguments,
+                     std::string* body) {
+  static const char* kSingletons[kSingletonCount] = {"api", "s3", "console"};
+  const quobyte::ServiceState* singletons[kSingletonCount] = {
+    &cluster.api, &cluster.s3, &cluster.console
+  };
+
+  // Bit per singleton, then per node service.
+  uint32_t services = ~0u;
+  auto argument = arguments.find("service");
+  if (argument != arguments.end()) {
+    services = 0;
+    for (uint32_t s = 0; s < kSingletonCount; ++s) {
+      if (argument->second == kSingletons[s]) {
+        services = 1u << s;
+      }
+    }
+    for (int s = 0; s < NodeIndex::SERVICE_COUNT; ++s) {
+      if (argument->second ==
+          NodeIndex::serviceName(static_cast<NodeIndex::Service>(s))) {
+        services = 1u << (kSingletonCount + s);
+      }
+    }
+    if (services == 0) {
+      return JsonError(400, "Unknown service " + argument->second, body);
+    }
+  }
+  int state = 0;
+  argument = arguments.find("state");
+  if (argument != arguments.end() && !ParseState(argument->second, &state)) {
+    return JsonError(400, "Unknown state " + argument->second, body);
+  }
+  size_t limit;
+  uint32_t start;
+  if (!ParsePage(arguments, &limit, &start, body)) {
+    return 400;
+  }
+
+  // Entries as cursors: the singletons, then kSingletonCount + node *
+  // SERVICE_COUNT + service.
+  std::vector<uint64_t> entries;
+  for (uint32_t s = start; s < kSingletonCount; ++s) {
+    if ((services & (1u << s)) &&
+        (state == 0 || singletons[s]->state() == state)) {
+      entries.push_back(s);
+    }
+  }
+  const uint32_t first_node = start < kSingletonCount ?
+      0 : (start - kSingletonCount) / NodeIndex::SERVICE_COUNT;
+  for (int s = 0; s < NodeIndex::SERVICE_COUNT; ++s) {
+    if (!(services & (1u << (kSingletonCount + s)))) {
+      continue;
+    }
+    // limit + 2 candidates of every service cover the page and the start of
+    // the next one, even if the first node is partly before start.
+    std::vector<uint32_t> nodes;
+    if (state != 0) {
+      nodes = index.withState(static_cast<NodeIndex::Service>(s), state,
+                              first_node, limit + 2);
+    } else {
+      for (uint32_t node = first_node;
+           node < cluster.node_count && nodes.size() < limit + 2; ++node) {
+        nodes.push_back(node);
+      }
+    }
+    for (uint32_t node : nodes) {
+      const uint64_t cursor = kSingletonCount +
+          static_cast<uint64_t>(node) * NodeIndex::SERVICE_COUNT + s;
+      if (cursor >= start && node < cluster.node_count) {
+        entries.push_back(cursor);
+      }
+    }
+  }
+  std::sort(entries.begin(), entries.end());
+
+  *body = "{\"services\":[";
+  for (size_t i = 0; i < entries.size() && i < limit; ++i) {
+    if (i > 0) {
+      body->push_back(',');
+    }
+    if (entries[i] < kSingletonCount) {
+      AppendService("", kSingletons[entries[i]], *singletons[entries[i]],
+                    body);
+    } else {
+      const uint64_t node =
+          (entries[i] - kSingletonCount) / NodeIndex::SERVICE_COUNT;
+      const NodeIndex::Service service = static_cast<NodeIndex::Service>(
+          (entries[i] - kSingletonCount) % NodeIndex::SERVICE_COUNT);
+      const quobyte::NodeState& node_state = cluster.node(node);
+      AppendService(node_state.hostname(), NodeIndex::serviceName(service),
+                    NodeIndex::service(node_state, service), body);
+    }
+  }
+  *body += "]";
+  AppendNext(entries.size() > limit ? entries[limit] : NodeIndex::kNotFound,
+             body);
+  *body += "}";
+  return 200;
+}
+
+// Appends ,"name":seconds.
+static void AppendSeconds(const char* name, int64_t micros,
+                          std::string* body) {
+  char value[32];
+  snprintf(value, sizeof(value), "%.6f", micros / 1e6);
+  *body += ",\"" + std::string(name) + "\":" + value;
+}
+
+static void AppendStartups(const TaskLatencies::Startups& startups,
+                           std::string* body) {
+  *body += ",\"starts\":" + std::to_string(startups.count) +
+      ",\"failed\":" + std::to_string(startups.failed);
+  if (startups.count > 0) {
+    AppendSeconds("mean_s", startups.sum_us / startups.count, body);
+    AppendSeconds("max_s", startups.max_us, body);
+    AppendSeconds("last_s", startups.last_us, body);
+  }
+}
+
+static const std::string& HostnameOf(const ClusterSnapshot& cluster,
+                                     uint32_t node) {
+  static const std::string kUnknown;
+  // The scheduler can know nodes the snapshot does not have yet.
+  return node < cluster.node_count ? cluster.node(node).hostname() :
+      kUnknown;
+}
+
+static int ServeHostLatency(const TaskLatencies& latencies,
+                            const std::string& hostname,
+                            uint32_t node,
+                            std::string* body) {
+  *body = "{\"hostname\":";
+  AppendJsonString(hostname, body);
+  *body += ",\"services\":[";
+  bool first = true;
+  for (int s = 0; s < SERVICE_TYPE_COUNT; ++s) {
+    const ServiceType service = static_cast<ServiceType>(s);
+    TaskLatencies::Host host;
+    if (!latencies.host(node, service, &host)) {
+      continue;
+    }
+    if (!first) {
+      body->push_back(',');
+    }
+    first = false;
+    // The states of the latest task, in seconds after its launch.
+    const TaskLatencies::Timeline& timeline = host.timeline;
+    *body += "{\"service\":\"" + ServiceName(service) +
+        "\",\"incarnation\":" + std::to_string(timeline.incarnation);
+    const std::pair<const char*, int64_t> states[] = {
+      {"staging_s", timeline.staging_us},
+      {"starting_s", timeline.starting_us},
+      {"running_s", timeline.running_us},
+      {"ended_s", timeline.ended_us},
+    };
+    for (const auto& state : states) {
+      if (state.second != 0) {
+        AppendSeconds(state.first, state.second - timeline.launched_us,
+                      body);
+      }
+    }
+    if (timeline.ended_us != 0) {
+      *body += ",\"end_state\":";
+      AppendJsonString(mesos::TaskState_Name(timeline.end_state), body);
+    }
+    AppendStartups(host.startups, body);
+    // Startup times by histogram bucket, empty buckets left out.
+    *body += ",\"buckets\":[";
+    bool first_bucket = true;
+    for (int i = 0; i < Histogram::kBuckets; ++i) {
+      if (host.startups.buckets[i] == 0) {
+        continue;
+      }
+      if (!first_bucket) {
+        body->push_back(',');
+      }
+      first_bucket = false;
+      char le[32];
+      if (i < Histogram::kBuckets - 1) {
+        snprintf(le, sizeof(le), "%g", Histogram::kBoundsMicros[i] / 1e6);
+      } else {
+        snprintf(le, sizeof(le), "+Inf");
+      }
+      *body += "{\"le\":\"" + std::string(le) + "\",\"count\":" +
+          std::to_string(host.startups.buckets[i]) + "}";
+    }
+    *body += "]}";
+  }
+  *body += "]}";
+  return 200;
+}
+
+int ServeTaskLatencyApi(const ClusterSnapshot& cluster,
+                        const NodeIndex& index,
+                        const TaskLatencies& latencies,
+                        const std::string& path,
+                        std::string* body) {
+  const std::string host_prefix = std::string(kTaskLatencyUrl) + "/";
+  if (path.compare(0, host_prefix.size(), host_prefix) == 0) {
+    const std::string hostname = path.substr(host_prefix.size());
+    const uint32_t node = index.findByHostname(hostname);
+    if (node == NodeIndex::kNotFound || node >= cluster.node_count) {
+      return JsonError(404, "Unknown node " + hostname, body);
+    }
+    return ServeHostLatency(latencies, hostname, node, body);
+  }
+
+  *body = "{\"services\":[";
+  bool first = true;
+  for (int s = 0; s < SERVICE_TYPE_COUNT; ++s) {
+    const ServiceType service = static_cast<ServiceType>(s);
+    std::string phases;
+    for (int p = 0; p < TaskLatencies::PHASE_COUNT; ++p) {
+      const TaskLatencies::Phase phase = static_cast<TaskLatencies::Phase>(p);
+      const Histogram& histogram = latencies.histogram(service, phase);
+      uint64_t buckets[Histogram::kBuckets];
+      int64_t sum_micros;
+      uint64_t count;
+      histogram.collect(buckets, &sum_micros, &count);
+      if (count == 0) {
+        continue;
+      }
+      // Percentiles are the upper bound of their histogram bucket.
+      phases += phases.empty() ? "" : ",";
+      phases += "\"" + std::string(TaskLatencies::phaseName(phase)) +
+          "\":{\"count\":" + std::to_string(count);
+      AppendSeconds("mean_s", sum_micros / static_cast<int64_t>(count),
+                    &phases);
+      AppendSeconds("p50_s", histogram.percentileMicros(0.5), &phases);
+      AppendSeconds("p90_s", histogram.percentileMicros(0.9), &phases);
+      AppendSeconds("p99_s", histogram.percentileMicros(0.99), &phases);
+      phases += "}";
+    }
+    if (phases.empty()) {
+      continue;
+    }
+    if (!first) {
+      body->push_back(',');
+    }
+    first = false;
+    *body += "{\"service\":\"" + ServiceName(service) +
+        "\",\"phases\":{" + phases + "}}";
+  }
+  *body += "],\"outliers\":[";
+  first = true;
+  for (const TaskLatencies::Outlier& outlier : latencies.outliers(
+           FLAGS_task_latency_outlier_factor,
+           FLAGS_task_latency_outlier_min_s * 1000000LL)) {
+    if (!first) {
+      body->push_back(',');
+    }
+    first = false;
+    *body += "{\"hostname\":";
+    AppendJsonString(HostnameOf(cluster, outlier.node), body);
+    *body += ",\"service\":\"" + ServiceName(outlier.service) + "\"";
+    AppendStartups(outlier.startups, body);
+    AppendSeconds("median_s", outlier.median_us, body);
+    *body += "}";
+  }
+  *body += "]}";
+  return 200;
+}
+
+int ServeDecisionsApi(const ClusterSnapshot& cluster,
+                      const NodeIndex& index,
+                      const DecisionTrace& trace,
+                      int64_t now_us,
+                      const std::string& path,
+                      const quobyte::HttpServer::Arguments& arguments,
+                      std::string* body) {
+  size_t limit;
+  if (!ParseLimit(arguments, &limit, body)) {
+    return 400;
+  }
+  std::vector<DecisionTrace::Record> records;
+  const std::string host_prefix = std::string(kDecisionsUrl) + "/";
+  if (path.compare(0, host_prefix.size(), host_prefix) == 0) {
+    const std::string hostname = path.substr(host_prefix.size());
+    const uint32_t node = index.findByHostname(hostname);
+    if (node == NodeIndex::kNotFound || node >= cluster.node_count) {
+      return JsonError(404, "Unknown node " + hostname, body);
+    }
+    records = trace.latest(node, limit);
+  } else {
+    records = trace.latest(limit);
+  }
+
+  *body = "{\"decisions\":[";
+  for (size_t i = 0; i < records.size(); ++i) {
+    const DecisionTrace::Record& record = records[i];
+    if (i > 0) {
+      body->push_back(',');
+    }
+    *body += "{\"decision\":\"" + std::string(DecisionTrace::decisionName(
+        static_cast<DecisionTrace::Decision>(record.decision))) + "\"";
+    AppendSeconds("age_s", now_us - record.time_us, body);
+    if (record.node != DecisionTrace::kNoNode) {
+      *body += ",\"hostname\":";
+      AppendJsonString(HostnameOf(cluster, record.node), body);
+    }
+    if (record.service < SERVICE_TYPE_COUNT) {
+      *body += ",\"service\":\"" +
+          ServiceName(static_cast<ServiceType>(record.service)) + "\"";
+    }
+    if (record.offers > 0) {
+      *body += ",\"offers\":" + std::to_string(record.offers);
+    }
+    *body += "}";
+  }
+  *body += "]}";
+  return 200;
+}
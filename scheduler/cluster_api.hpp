@@ -0,0 +1,72 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "cluster_snapshot.hpp"
+#include "decision_trace.hpp"
+#include "http_server.hpp"
+#include "node_index.hpp"
+#include "task_latency.hpp"
+
+// JSON views of the cluster for tooling, answered from the node index and
+// the latest snapshot.
+//
+//   GET /v1/nodes[/<hostname>]
+//       ?<service>=<STATE>    prober, registry, metadata, data or client in
+//                             state UNKNOWN, NOT_RUNNING, STARTING, RUNNING
+//       &device=<TYPE>[,...]  has all device types, e.g. DATA,METADATA
+//       &stale_probe_s=<s>    last probe at least s seconds ago
+//       &fields=<name>[,...]  NodeState fields to return
+//   GET /v1/services
+//       ?service=<name>       one of the node services, api, s3 or console
+//       &state=<STATE>
+//
+// Both take limit (default 100, at most 1000) and start. A page that is
+// not the last one has "next", the start of the next page.
+//
+//   GET /v1/task_latency[/<hostname>]
+//       Time from task launch to STAGING, STARTING, RUNNING or failure and
+//       from RUNNING to the end, per service, and the hosts that start
+//       tasks much slower than the others. With a hostname, the states of
+//       the latest task and the startup times of every service on the host.
+//   GET /v1/decisions[/<hostname>]?limit=<n>
+//       The latest scheduling decisions, of all nodes or of one, newest
+//       first: why offers were declined and which services were launched.
+
+// Appends value as a quoted JSON string.
+void AppendJsonString(const std::string& value, std::string* out);
+// Parses a decimal number as given in a query argument.
+bool ParseNumber(const std::string& value, uint64_t* number);
+
+int ServeNodesApi(const ClusterSnapshot& cluster,
+                  const NodeIndex& index,
+                  int64_t now_s,
+                  const std::string& path,
+                  const quobyte::HttpServer::Arguments& arguments,
+                  std::string* body);
+
+int ServeServicesApi(const ClusterSnapshot& cluster,
+                     const NodeIndex& index,
+                     const quobyte::HttpServer::Arguments& arguments,
+                     std::string* body);
+
+int ServeTaskLatencyApi(const ClusterSnapshot& cluster,
+                        const NodeIndex& index,
+                        const TaskLatencies& latencies,
+                        const std::string& path,
+                        std::string* body);
+
+int ServeDecisionsApi(const ClusterSnapshot& cluster,
+                      const NodeIndex& index,
+                      const DecisionTrace& trace,
+                      int64_t now_us,
+                      const std::string& path,
+                      const quobyte::HttpServer::Arguments& arguments,
+                      std::string* body);
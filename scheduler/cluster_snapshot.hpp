@@ -0,0 +1,54 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "quobyte.pb.h"
+
+// Immutable view of the cluster for readers outside the driver thread, like
+// the HTTP handlers. The scheduler publishes a new one after each batch of
+// changes; readers hold on to the one they got for as long as they need it.
+struct ClusterSnapshot {
+  static const size_t kChunkSize = 64;
+  struct NodeEntry {
+    std::shared_ptr<const quobyte::NodeState> state;
+    // Snapshot generation that last changed the node.
+    uint64_t generation;
+  };
+  typedef std::vector<NodeEntry> NodeChunk;
+
+  // By NodeRegistry index.
+  const quobyte::NodeState& node(size_t index) const {
+    return *entry(index).state;
+  }
+
+  uint64_t node_generation(size_t index) const {
+    return entry(index).generation;
+  }
+
+  const NodeEntry& entry(size_t index) const {
+    return (*chunks[index / kChunkSize])[index % kChunkSize];
+  }
+
+  // Nodes in chunks of kChunkSize, so that publishing a change copies one
+  // chunk and the chunk list. Unchanged chunks and nodes are shared with
+  // the previous snapshot.
+  std::vector<std::shared_ptr<const NodeChunk>> chunks;
+  // Nodes in the chunks.
+  size_t node_count = 0;
+  quobyte::ServiceState api;
+  quobyte::ServiceState s3;
+  quobyte::ServiceState console;
+  // As countRunningServices().
+  int running_services = 0;
+  // Counts publications.
+  uint64_t generation = 0;
+};
@@ -0,0 +1,84 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "decision_trace.hpp"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+DecisionTrace::DecisionTrace(size_t capacity) : records_(capacity) {
+  CHECK_GT(capacity, 0);
+}
+
+const char* DecisionTrace::decisionName(Decision decision) {
+  static const char* kNames[DECISION_COUNT] = {
+    "host_not_allowed",
+    "new_node",
+    "probing",
+    "no_target_version",
+    "declined",
+    "accepted",
+    "waiting_for_devices",
+    "insufficient_resources",
+    "launched",
+  };
+  return kNames[decision];
+}
+
+void DecisionTrace::record(int64_t time_us,
+                           uint32_t node,
+                           Decision decision,
+                           ServiceType service,
+                           size_t offers) {
+  Record record;
+  record.time_us = time_us;
+  record.node = node;
+  record.decision = decision;
+  record.service = service;
+  record.offers = std::min<size_t>(offers, UINT16_MAX);
+  std::lock_guard<std::mutex> lock(lock_);
+  records_[next_++ % records_.size()] = record;
+}
+
+std::vector<DecisionTrace::Record> DecisionTrace::latest(size_t limit) const {
+  return scan(false, 0, limit);
+}
+
+std::vector<DecisionTrace::Record> DecisionTrace::latest(uint32_t node,
+                                                         size_t limit) const {
+  return scan(true, node, limit);
+}
+
+std::vector<DecisionTrace::Record> DecisionTrace::scan(bool by_node,
+                                                       uint32_t node,
+                                                       size_t limit) const {
+  // Looking for a node goes through the whole ring, a slice at a time so
+  // that the driver thread does not wait for long.
+  static const uint64_t kSlice = 4096;
+  std::vector<Record> result;
+  std::unique_lock<std::mutex> lock(lock_);
+  uint64_t sequence = next_;
+  while (result.size() < limit) {
+    // Records older than this were overwritten while unlocked.
+    const uint64_t oldest =
+        next_ > records_.size() ? next_ - records_.size() : 0;
+    if (sequence <= oldest) {
+      break;
+    }
+    const uint64_t end =
+        std::max(oldest, sequence > kSlice ? sequence - kSlice : 0);
+    for (; sequence > end && result.size() < limit; --sequence) {
+      const Record& record = records_[(sequence - 1) % records_.size()];
+      if (!by_node || record.node == node) {
+        result.push_back(record);
+      }
+    }
+    lock.unlock();
+    lock.lock();
+  }
+  return result;
+}
@@ -0,0 +1,82 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "task_id.hpp"
+
+// Why the scheduler declined the offers of a node, or which services it
+// launched on them, for /v1/decisions. Records are small and fixed-size in
+// a ring of the latest ones, so tracing an offer costs a few stores where a
+// log line costs formatting and a write. Thread-safe.
+class DecisionTrace {
+ public:
+  enum Decision {
+    // Every batch of offers of a node ends with one of these, with the
+    // number of offers.
+    //
+    // Not in --restrict_hosts.
+    HOST_NOT_ALLOWED = 0,
+    // First offer of the node, its tasks are reconciled.
+    NEW_NODE,
+    // Devices are probed.
+    PROBING,
+    // No target version, services are shut down.
+    NO_TARGET_VERSION,
+    // Nothing to start.
+    DECLINED,
+    ACCEPTED,
+
+    // Details before the outcome.
+    //
+    // The devices of the node are not known yet.
+    WAITING_FOR_DEVICES,
+    // A service should start but does not fit the offers.
+    INSUFFICIENT_RESOURCES,
+    LAUNCHED,
+    DECISION_COUNT
+  };
+
+  struct Record {
+    int64_t time_us;
+    // By NodeRegistry index, kNoNode for hosts not registered.
+    uint32_t node;
+    uint8_t decision;
+    // SERVICE_TYPE_COUNT for decisions about the node.
+    uint8_t service;
+    uint16_t offers;
+  };
+
+  static const uint32_t kNoNode = UINT32_MAX;
+
+  explicit DecisionTrace(size_t capacity);
+
+  static const char* decisionName(Decision decision);
+
+  void record(int64_t time_us,
+              uint32_t node,
+              Decision decision,
+              ServiceType service,
+              size_t offers);
+
+  // Up to limit of the latest records, newest first.
+  std::vector<Record> latest(size_t limit) const;
+  // The same for one node.
+  std::vector<Record> latest(uint32_t node, size_t limit) const;
+
+ private:
+  std::vector<Record> scan(bool by_node, uint32_t node, size_t limit) const;
+
+  mutable std::mutex lock_;
+  // By sequence number modulo the capacity.
+  std::vector<Record> records_;
+  uint64_t next_ = 0;
+};
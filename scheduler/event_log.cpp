@@ -0,0 +1,63 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "event_log.hpp"
+
+#include <glog/logging.h>
+
+EventLog::EventLog(size_t capacity) : events_(capacity) {
+  CHECK_GT(capacity, 0);
+}
+
+uint64_t EventLog::append(const std::string& type, const std::string& data) {
+  std::lock_guard<std::mutex> lock(lock_);
+  const uint64_t sequence = next_++;
+  std::shared_ptr<std::string> event = std::make_shared<std::string>();
+  event->reserve(data.size() + type.size() + 40);
+  *event += "id: " + std::to_string(sequence) + "\nevent: " + type +
+      "\ndata: " + data + "\n\n";
+  events_[sequence % events_.size()] = std::move(event);
+  return sequence;
+}
+
+void EventLog::read(uint64_t* next, std::string* out) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  const uint64_t oldest = next_ > events_.size() ? next_ - events_.size() : 1;
+  if (*next < oldest || *next > next_) {
+    // Without an id, Last-Event-ID keeps naming the last real event.
+    *out += "event: reset\ndata: {\"next\":" + std::to_string(oldest) +
+        "}\n\n";
+    *next = oldest;
+  }
+  for (; *next < next_; ++*next) {
+    *out += *events_[*next % events_.size()];
+  }
+}
+
+uint64_t EventLog::next() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return next_;
+}
+
+void EventLog::setListener(std::function<void()> listener) {
+  std::lock_guard<std::mutex> lock(lock_);
+  listener_ = listener;
+}
+
+void EventLog::notify() {
+  std::function<void()> listener;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (notified_ == next_) {
+      return;
+    }
+    notified_ = next_;
+    listener = listener_;
+  }
+  if (listener) {
+    listener();
+  }
+}
@@ -0,0 +1,50 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// The most recent state changes of the cluster for /v1/events, numbered
+// from 1 in the order they happened. Events are kept formatted for the
+// text/event-stream format, so a watcher costs a copy of the events it has
+// not seen yet. Thread-safe.
+class EventLog {
+ public:
+  explicit EventLog(size_t capacity);
+
+  // Adds an event of type with data, a JSON object. Returns its sequence
+  // number.
+  uint64_t append(const std::string& type, const std::string& data);
+
+  // Appends the events from sequence *next on to *out and advances *next.
+  // Readers that fell behind the kept events, or ask for events the log
+  // has not seen, get a "reset" event first and continue with the oldest
+  // event kept. They need to read the cluster state again.
+  void read(uint64_t* next, std::string* out) const;
+
+  // Sequence number of the next event.
+  uint64_t next() const;
+
+  // Called by notify() when events were added since the last call.
+  void setListener(std::function<void()> listener);
+  // Wakes up the watchers once after a batch of events.
+  void notify();
+
+ private:
+  mutable std::mutex lock_;
+  // By sequence number modulo the capacity.
+  std::vector<std::shared_ptr<const std::string>> events_;
+  uint64_t next_ = 1;
+  uint64_t notified_ = 1;
+  std::function<void()> listener_;
+};
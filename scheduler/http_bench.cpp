@@ -0,0 +1,411 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+#include <mesos/state/in_memory.hpp>
+#include <mesos/state/state.hpp>
+
+#include "benchmarks.hpp"
+#include "http_server.hpp"
+#include "offer_simulator.hpp"
+#include "scheduler.hpp"
+#include "status_page.hpp"
+
+DEFINE_int32(http_bench_port, 17888, "Port of the HTTP benchmark server");
+DEFINE_int32(http_clients, 16, "Concurrent keep-alive clients");
+DEFINE_int32(http_requests, 2000, "Requests per client");
+DEFINE_int32(archive_fetches, 500, "Concurrent executor archive fetches");
+DEFINE_int32(archive_mb, 32, "Size of the generated executor archive");
+DEFINE_int32(status_page_views, 30,
+             "Status page views, one allocation round apart");
+
+DECLARE_int32(http_connection_limit);
+DECLARE_int32(rounds);
+DECLARE_double(task_failures_per_hour);
+DECLARE_string(target_version);
+
+using std::placeholders::_1;
+using std::placeholders::_2;
+using std::placeholders::_3;
+
+static int64_t MicrosNow() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Minimal HTTP/1.1 client on one keep-alive connection.
+class HttpClient {
+ public:
+  struct Response {
+    int status = 0;
+    std::string headers;
+    uint64_t body_bytes = 0;
+
+    // Value of a response header, empty if missing.
+    std::string header(const std::string& name) const {
+      const size_t field = headers.find("\r\n" + name + ": ");
+      if (field == std::string::npos) {
+        return "";
+      }
+      const size_t start = field + name.size() + 4;
+      return headers.substr(start, headers.find("\r\n", start) - start);
+    }
+  };
+
+  explicit HttpClient(int port) {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(fd_, 0);
+    int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd_, reinterpret_cast<struct sockaddr*>(&address),
+                sizeof(address)) != 0) {
+      LOG(FATAL) << "Could not connect to port " << port;
+    }
+  }
+
+  ~HttpClient() {
+    close(fd_);
+  }
+
+  // Returns the status code, 0 if the connection broke. The body is
+  // counted and dropped as it arrives, extra_headers end with CRLF.
+  int get(const std::string& path,
+          const std::string& extra_headers = "",
+          Response* response = NULL) {
+    const std::string request = "GET " + path +
+        " HTTP/1.1\r\nHost: localhost\r\n" + extra_headers + "\r\n";
+    if (write(fd_, request.data(), request.size()) !=
+        static_cast<ssize_t>(request.size())) {
+      return 0;
+    }
+    size_t header_end;
+    while ((header_end = buffer_.find("\r\n\r\n")) == std::string::npos) {
+      if (!fill()) {
+        return 0;
+      }
+    }
+    const int status = atoi(buffer_.c_str() + buffer_.find(' ') + 1);
+    uint64_t length = 0;
+    const size_t field = buffer_.find("Content-Length: ");
+    if (field != std::string::npos && field < header_end) {
+      length = strtoull(buffer_.c_str() + field + 16, NULL, 10);
+    }
+    if (response != NULL) {
+      response->status = status;
+      response->headers = buffer_.substr(0, header_end + 2);
+      response->body_bytes = length;
+    }
+    buffer_.erase(0, header_end + 4);
+    while (buffer_.size() < length) {
+      length -= buffer_.size();
+      buffer_.clear();
+      if (!fill()) {
+        return 0;
+      }
+    }
+    buffer_.erase(0, length);
+    return status;
+  }
+
+ private:
+  bool fill() {
+    char chunk[16384];
+    const ssize_t bytes = read(fd_, chunk, sizeof(chunk));
+    if (bytes <= 0) {
+      return false;
+    }
+    buffer_.append(chunk, bytes);
+    return true;
+  }
+
+  int fd_;
+  std::string buffer_;
+};
+
+// Peak resident set size of this process in kB, 0 where unknown.
+static long PeakRssKb() {
+  FILE* status = fopen("/proc/self/status", "r");
+  if (status == NULL) {
+    return 0;
+  }
+  long result = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), status) != NULL) {
+    if (strncmp(line, "VmHWM:", 6) == 0) {
+      result = atol(line + 6);
+    }
+  }
+  fclose(status);
+  return result;
+}
+
+// Concurrent clients polling the health check and the status page of a
+// scheduler with --hosts simulated agents.
+int RunHttpBenchmark() {
+  mesos::state::InMemoryStorage storage;
+  mesos::state::State state_storage(&storage);
+  SchedulerStateProxy state_proxy(&state_storage, "scheduler-bench");
+  mesos::FrameworkInfo framework;
+  framework.set_user("");
+  framework.set_name("quobyte-bench");
+  framework.set_webui_url("http://localhost:7888");
+  SimulatedClock clock;
+  QuobyteScheduler scheduler(&state_proxy, NULL, &framework, &clock);
+  SimulatorConfig config;
+  config.hosts = FLAGS_hosts;
+  OfferSimulator simulator(&scheduler, &clock, config);
+  simulator.registerFramework();
+  simulator.run(FLAGS_rounds);
+
+  quobyte::HttpServer http(FLAGS_http_bench_port);
+  http.Start(std::bind(&QuobyteScheduler::handleHTTP, &scheduler, _1, _2, _3));
+
+  const std::vector<std::string> paths = {"/v1/health", "/"};
+  std::vector<LatencySamples> latencies(paths.size());
+  std::mutex latencies_lock;
+  int errors = 0;
+  const int64_t start = MicrosNow();
+  std::vector<std::thread> clients;
+  for (int c = 0; c < FLAGS_http_clients; ++c) {
+    clients.emplace_back([&]() {
+      HttpClient client(FLAGS_http_bench_port);
+      std::vector<LatencySamples> samples(paths.size());
+      int failed = 0;
+      for (int i = 0; i < FLAGS_http_requests; ++i) {
+        // Nine health checks per status page, like monitoring and a
+        // dashboard would.
+        const size_t path = i % 10 == 9 ? 1 : 0;
+        const int64_t request_start = MicrosNow();
+        if (client.get(paths[path]) != 200) {
+          ++failed;
+          break;
+        }
+        samples[path].add(MicrosNow() - request_start);
+      }
+      std::lock_guard<std::mutex> lock(latencies_lock);
+      errors += failed;
+      for (size_t path = 0; path < paths.size(); ++path) {
+        latencies[path].merge(samples[path]);
+      }
+    });
+  }
+  for (std::thread& client : clients) {
+    client.join();
+  }
+  const int64_t elapsed = MicrosNow() - start;
+  http.Stop();
+
+  size_t requests = 0;
+  for (size_t path = 0; path < paths.size(); ++path) {
+    requests += latencies[path].count();
+    printf("%-12s %8zu requests, p50 %6ldus, p99 %6ldus\n",
+           paths[path].c_str(), latencies[path].count(),
+           static_cast<long>(latencies[path].percentile(0.5)),
+           static_cast<long>(latencies[path].percentile(0.99)));
+  }
+  printf("%d clients: %.0f requests/s, %d errors\n", FLAGS_http_clients,
+         requests * 1e6 / elapsed, errors);
+  return errors == 0 ? 0 : 1;
+}
+
+// --archive_fetches agents fetching the executor archive at the same time,
+// each on its own connection.
+int RunArchiveBenchmark() {
+  char path[] = "/tmp/quobyte-bench-archive-XXXXXX";
+  const int fd = mkstemp(path);
+  CHECK_GE(fd, 0);
+  std::string block(1 << 20, '\0');
+  for (size_t i = 0; i < block.size(); ++i) {
+    block[i] = static_cast<char>(rand());
+  }
+  for (int i = 0; i < FLAGS_archive_mb; ++i) {
+    CHECK_EQ(write(fd, block.data(), block.size()),
+             static_cast<ssize_t>(block.size()));
+  }
+  close(fd);
+  std::string().swap(block);
+  const uint64_t archive_bytes = static_cast<uint64_t>(FLAGS_archive_mb) << 20;
+
+  if (FLAGS_http_connection_limit < FLAGS_archive_fetches) {
+    FLAGS_http_connection_limit = FLAGS_archive_fetches;
+  }
+  quobyte::HttpServer http(FLAGS_http_bench_port);
+  http.ServeFile("/executor.tar.gz", path);
+  http.Start([](const std::string&, const std::string&, const std::string&) {
+    return std::string();
+  });
+
+  int errors = 0;
+  {
+    HttpClient client(FLAGS_http_bench_port);
+    HttpClient::Response full;
+    HttpClient::Response range;
+    HttpClient::Response cached;
+    client.get("/executor.tar.gz", "", &full);
+    client.get("/executor.tar.gz", "Range: bytes=1000-1999\r\n", &range);
+    client.get("/executor.tar.gz",
+               "If-None-Match: " + full.header("ETag") + "\r\n", &cached);
+    printf("GET %d, %lu bytes, ETag %s\n", full.status,
+           static_cast<unsigned long>(full.body_bytes),
+           full.header("ETag").c_str());
+    printf("Range GET %d, %lu bytes, Content-Range %s\n", range.status,
+           static_cast<unsigned long>(range.body_bytes),
+           range.header("Content-Range").c_str());
+    printf("Conditional GET %d\n", cached.status);
+    if (full.status != 200 || full.body_bytes != archive_bytes ||
+        range.status != 206 || range.body_bytes != 1000 ||
+        cached.status != 304) {
+      ++errors;
+    }
+  }
+
+  const long rss_before_kb = PeakRssKb();
+  LatencySamples latencies;
+  std::mutex latencies_lock;
+  uint64_t bytes = 0;
+  const int64_t start = MicrosNow();
+  std::vector<std::thread> fetches;
+  for (int f = 0; f < FLAGS_archive_fetches; ++f) {
+    fetches.emplace_back([&]() {
+      HttpClient client(FLAGS_http_bench_port);
+      HttpClient::Response response;
+      const int64_t fetch_start = MicrosNow();
+      const int status = client.get("/executor.tar.gz", "", &response);
+      const int64_t latency = MicrosNow() - fetch_start;
+      std::lock_guard<std::mutex> lock(latencies_lock);
+      if (status != 200 || response.body_bytes != archive_bytes) {
+        ++errors;
+      } else {
+        bytes += response.body_bytes;
+        latencies.add(latency);
+      }
+    });
+  }
+  for (std::thread& fetch : fetches) {
+    fetch.join();
+  }
+  const int64_t elapsed = MicrosNow() - start;
+  http.Stop();
+  unlink(path);
+
+  printf("%d fetches of %d MB: %.0f MB/s, %.1f fetches/s, "
+         "p50 %ldms, p99 %ldms, %d errors\n",
+         FLAGS_archive_fetches, FLAGS_archive_mb,
+         bytes * 1e6 / elapsed / (1 << 20),
+         latencies.count() * 1e6 / elapsed,
+         static_cast<long>(latencies.percentile(0.5) / 1000),
+         static_cast<long>(latencies.percentile(0.99) / 1000), errors);
+  printf("peak RSS: %ld MB before the fetches, %ld MB after\n",
+         rss_before_kb / 1024, PeakRssKb() / 1024);
+  return errors == 0 ? 0 : 1;
+}
+
+static uint64_t StreamPage(const quobyte::PageFragments& page, bool gzip) {
+  quobyte::PageStream stream(page, gzip);
+  char buffer[32 * 1024];
+  uint64_t bytes = 0;
+  size_t read;
+  while ((read = stream.read(buffer, sizeof(buffer))) > 0) {
+    bytes += read;
+  }
+  return bytes;
+}
+
+// Renders the status page of --hosts agents once per allocation round,
+// with the node cache and without it, as every view did before, and
+// streams it as is and gzip-compressed. Use --task_failures_per_hour for
+// changes between the views.
+int RunStatusPageBenchmark() {
+  mesos::state::InMemoryStorage storage;
+  mesos::state::State state_storage(&storage);
+  SchedulerStateProxy state_proxy(&state_storage, "scheduler-bench");
+  state_proxy.set_target_version(FLAGS_target_version);
+  mesos::FrameworkInfo framework;
+  framework.set_user("");
+  framework.set_name("quobyte-bench");
+  framework.set_webui_url("http://localhost:7888");
+  SimulatedClock clock;
+  QuobyteScheduler scheduler(&state_proxy, NULL, &framework, &clock);
+  SimulatorConfig config;
+  config.hosts = FLAGS_hosts;
+  config.task_failures_per_hour = FLAGS_task_failures_per_hour;
+  OfferSimulator simulator(&scheduler, &clock, config);
+  simulator.registerFramework();
+  simulator.run(FLAGS_rounds);
+
+  int64_t start = MicrosNow();
+  quobyte::PageFragments page = scheduler.renderStatusPage();
+  printf("first view: %ld us, %zu fragments\n",
+         static_cast<long>(MicrosNow() - start), page.size());
+
+  LatencySamples cached;
+  LatencySamples uncached;
+  LatencySamples plain_stream;
+  LatencySamples gzip_stream;
+  uint64_t plain_bytes = 0;
+  uint64_t gzip_bytes = 0;
+  const uint64_t rendered_before = scheduler.statusPage().stats().nodes_rendered;
+  for (int view = 0; view < FLAGS_status_page_views; ++view) {
+    simulator.run(1);
+    start = MicrosNow();
+    page = scheduler.renderStatusPage();
+    cached.add(MicrosNow() - start);
+
+    StatusPage fresh;
+    quobyte::PageFragments nodes;
+    start = MicrosNow();
+    fresh.renderNodes(*scheduler.snapshot(), &nodes);
+    uncached.add(MicrosNow() - start);
+
+    start = MicrosNow();
+    plain_bytes = StreamPage(page, false);
+    plain_stream.add(MicrosNow() - start);
+    start = MicrosNow();
+    gzip_bytes = StreamPage(page, true);
+    gzip_stream.add(MicrosNow() - start);
+  }
+  const uint64_t rendered =
+      scheduler.statusPage().stats().nodes_rendered - rendered_before;
+
+  printf("%d views of %d nodes, %.1f nodes rendered per view\n",
+         FLAGS_status_page_views, FLAGS_hosts,
+         static_cast<double>(rendered) / FLAGS_status_page_views);
+  printf("render cached   p50 %6ldus, p99 %6ldus\n",
+         static_cast<long>(cached.percentile(0.5)),
+         static_cast<long>(cached.percentile(0.99)));
+  printf("render uncached p50 %6ldus, p99 %6ldus (nodes only)\n",
+         static_cast<long>(uncached.percentile(0.5)),
+         static_cast<long>(uncached.percentile(0.99)));
+  printf("send plain      p50 %6ldus, %lu bytes\n",
+         static_cast<long>(plain_stream.percentile(0.5)),
+         static_cast<unsigned long>(plain_bytes));
+  printf("send gzip       p50 %6ldus, %lu bytes\n",
+         static_cast<long>(gzip_stream.percentile(0.5)),
+         static_cast<unsigned long>(gzip_bytes));
+  return 0;
+}
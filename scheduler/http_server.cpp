@@ -6,37 +6,574 @@
 
 #include "http_server.hpp"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
+#include <mutex>
 
 #include <sys/socket.h>  // Defines 'socklen_t' for microhttpd.h (Ubuntu 12.04).
 #include <microhttpd.h>
+#include <zlib.h>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "metrics.hpp"
+
+DEFINE_int32(http_threads, 4, "HTTP server worker threads");
+DEFINE_int32(http_connection_limit, 256,
+             "Concurrent HTTP connections, more are refused");
+DEFINE_int32(http_connection_timeout_s, 30,
+             "Idle keep-alive HTTP connections are closed after this");
+DEFINE_int32(http_max_post_bytes, 64 * 1024,
+             "Larger POST bodies are refused with 413");
+DEFINE_bool(http_thread_per_connection, false,
+            "Serve every HTTP connection from its own thread, as before");
+DEFINE_int32(http_gzip_level, 1,
+             "zlib level for pages sent gzip-compressed, 0 sends them as is");
+DEFINE_int32(http_event_keepalive_s, 15,
+             "Idle event streams get a comment this often, so that clients "
+             "and proxies keep them open");
+DEFINE_int32(http_event_batch_ms, 100,
+             "Waiting event streams are woken up at most this often, then "
+             "read all events since");
+
+static const size_t kPageChunkBytes = 32 * 1024;
+static const size_t kEventChunkBytes = 4 * 1024;
+
 namespace quobyte {
 
-HttpServer::HttpServer(int port) : port_(port) {}
+// The event streams waiting for news, shared by the workers that read them
+// and the threads that notify them.
+struct EventWaiters {
+  std::mutex lock;
+  // Wakes up the streams waiting in their connection's thread.
+  std::condition_variable changed;
+  // Wakes up the notifier thread.
+  std::condition_variable wake;
+  // Counts NotifyEvents() calls. A stream notified while it was reading
+  // reads again instead of waiting.
+  uint64_t generation = 0;
+  bool pending = false;
+  // With a worker pool, waiting streams suspend their connection.
+  // Otherwise they wait on changed in their connection's thread.
+  bool suspend = false;
+  std::vector<struct MHD_Connection*> suspended;
+  bool stopping = false;
+};
+
+namespace {
+
+// Per request, kept by microhttpd between the calls for one request.
+struct RequestContext {
+  std::string body;
+  bool too_large = false;
+};
+
+int QueueResponse(struct MHD_Connection* connection,
+                  unsigned int status,
+                  const std::string& page,
+                  const char* content_type = NULL) {
+  struct MHD_Response* response = MHD_create_response_from_data(
+      page.length(),
+      (void*) page.c_str(),
+      MHD_NO,
+      MHD_YES);
+  if (content_type != NULL) {
+    MHD_add_response_header(response, "Content-Type", content_type);
+  }
+  int ret = MHD_queue_response(connection, status, response);
+  MHD_destroy_response(response);
+  return ret;
+}
+
+std::string HttpDate(time_t time) {
+  struct tm tm;
+  gmtime_r(&time, &tm);
+  char buffer[64];
+  strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return buffer;
+}
+
+// Returns -1 for anything but an RFC 1123 date.
+time_t ParseHttpDate(const char* value) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  const char* end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  if (end == NULL || *end != '\0') {
+    return -1;
+  }
+  return timegm(&tm);
+}
+
+// Parses a single "bytes=first-last", "bytes=first-" or "bytes=-suffix"
+// range of a file with size bytes, into [*first, *last]. Returns 0 if
+// there is no usable range, in which case the whole file is served, and -1
+// if the range lies beyond the end of the file.
+int ParseRange(const char* value, uint64_t size,
+               uint64_t* first, uint64_t* last) {
+  if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ',') != NULL) {
+    // Multiple ranges are allowed to be answered with the whole file.
+    return 0;
+  }
+  const char* spec = value + 6;
+  const char* dash = strchr(spec, '-');
+  if (dash == NULL) {
+    return 0;
+  }
+  char* end;
+  if (dash == spec) {
+    const uint64_t suffix = strtoull(dash + 1, &end, 10);
+    if (*end != '\0' || end == dash + 1) {
+      return 0;
+    }
+    if (suffix == 0 || size == 0) {
+      return -1;
+    }
+    *first = suffix >= size ? 0 : size - suffix;
+    *last = size - 1;
+    return 1;
+  }
+  *first = strtoull(spec, &end, 10);
+  if (end != dash) {
+    return 0;
+  }
+  if (dash[1] == '\0') {
+    *last = size - 1;
+  } else {
+    *last = strtoull(dash + 1, &end, 10);
+    if (*end != '\0' || *last < *first) {
+      return 0;
+    }
+    if (*last >= size) {
+      *last = size - 1;
+    }
+  }
+  return *first < size ? 1 : -1;
+}
+
+// Responds from the file descriptor, which microhttpd reads from and closes
+// with the response.
+int QueueFile(struct MHD_Connection* connection,
+              const char* url,
+              const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  struct stat stat;
+  if (fd == -1 || fstat(fd, &stat) != 0 || !S_ISREG(stat.st_mode)) {
+    LOG(ERROR) << "Could not open " << path << ": " << strerror(errno);
+    if (fd != -1) {
+      close(fd);
+    }
+    return QueueResponse(connection, MHD_HTTP_NOT_FOUND,
+                         std::string("Not found: ") + url);
+  }
+  const uint64_t size = stat.st_size;
+  char tag[64];
+  snprintf(tag, sizeof(tag), "\"%llx-%llx\"",
+           static_cast<unsigned long long>(size),
+           static_cast<unsigned long long>(stat.st_mtime));
+  const std::string etag = tag;
+  const std::string last_modified = HttpDate(stat.st_mtime);
+
+  // If-None-Match takes precedence, and matches weakly.
+  bool not_modified = false;
+  const char* if_none_match = MHD_lookup_connection_value(
+      connection, MHD_HEADER_KIND, "If-None-Match");
+  if (if_none_match != NULL) {
+    not_modified = strcmp(if_none_match, "*") == 0 ||
+        strstr(if_none_match, etag.c_str()) != NULL;
+  } else {
+    const char* if_modified_since = MHD_lookup_connection_value(
+        connection, MHD_HEADER_KIND, "If-Modified-Since");
+    if (if_modified_since != NULL) {
+      const time_t since = ParseHttpDate(if_modified_since);
+      not_modified = since != -1 && stat.st_mtime <= since;
+    }
+  }
+
+  uint64_t first = 0;
+  uint64_t last = size - 1;
+  int range = 0;
+  const char* range_header = MHD_lookup_connection_value(
+      connection, MHD_HEADER_KIND, "Range");
+  const char* if_range = MHD_lookup_connection_value(
+      connection, MHD_HEADER_KIND, "If-Range");
+  if (!not_modified && range_header != NULL &&
+      (if_range == NULL || etag == if_range || last_modified == if_range)) {
+    range = ParseRange(range_header, size, &first, &last);
+  }
+
+  unsigned int status = MHD_HTTP_OK;
+  struct MHD_Response* response;
+  if (not_modified || range < 0) {
+    close(fd);
+    status = not_modified ?
+        MHD_HTTP_NOT_MODIFIED : MHD_HTTP_REQUESTED_RANGE_NOT_SATISFIABLE;
+    response = MHD_create_response_from_buffer(0, NULL,
+                                                MHD_RESPMEM_PERSISTENT);
+    if (range < 0) {
+      MHD_add_response_header(response, "Content-Range",
+                              ("bytes */" + std::to_string(size)).c_str());
+    }
+  } else {
+    const uint64_t length = size == 0 ? 0 : last - first + 1;
+#if MHD_VERSION >= 0x00094400
+    response = MHD_create_response_from_fd_at_offset64(length, fd, first);
+#else
+    response = MHD_create_response_from_fd_at_offset(length, fd, first);
+#endif
+    if (response == NULL) {
+      close(fd);
+      return MHD_NO;
+    }
+    if (range > 0) {
+      status = MHD_HTTP_PARTIAL_CONTENT;
+      MHD_add_response_header(
+          response, "Content-Range",
+          ("bytes " + std::to_string(first) + "-" + std::to_string(last) +
+           "/" + std::to_string(size)).c_str());
+    }
+  }
+  MHD_add_response_header(response, "ETag", etag.c_str());
+  MHD_add_response_header(response, "Last-Modified", last_modified.c_str());
+  MHD_add_response_header(response, "Accept-Ranges", "bytes");
+  int ret = MHD_queue_response(connection, status, response);
+  MHD_destroy_response(response);
+  return ret;
+}
+
+bool AcceptsGzip(struct MHD_Connection* connection) {
+  const char* accept = MHD_lookup_connection_value(
+      connection, MHD_HEADER_KIND, "Accept-Encoding");
+  return accept != NULL && FLAGS_http_gzip_level > 0 &&
+      strstr(accept, "gzip") != NULL && strstr(accept, "gzip;q=0") == NULL;
+}
+
+ssize_t ReadPage(void* cls, uint64_t position, char* buffer, size_t size) {
+  const size_t bytes = static_cast<PageStream*>(cls)->read(buffer, size);
+  return bytes > 0 ? bytes : MHD_CONTENT_READER_END_OF_STREAM;
+}
+
+void FreePage(void* cls) {
+  delete static_cast<PageStream*>(cls);
+}
+
+int QueuePage(struct MHD_Connection* connection,
+              const HttpServer::PageRenderer& renderer) {
+  const bool gzip = AcceptsGzip(connection);
+  PageStream* page = new PageStream(renderer(), gzip);
+  struct MHD_Response* response = MHD_create_response_from_callback(
+      MHD_SIZE_UNKNOWN, kPageChunkBytes, &ReadPage, page, &FreePage);
+  if (response == NULL) {
+    delete page;
+    return MHD_NO;
+  }
+  if (gzip) {
+    MHD_add_response_header(response, "Content-Encoding", "gzip");
+  }
+  MHD_add_response_header(response, "Vary", "Accept-Encoding");
+  int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+  MHD_destroy_response(response);
+  return ret;
+}
+
+int AddArgument(void* cls,
+                enum MHD_ValueKind kind,
+                const char* key,
+                const char* value) {
+  (*static_cast<HttpServer::Arguments*>(cls))[key] =
+      value != NULL ? value : "";
+  return MHD_YES;
+}
+
+int QueueApi(struct MHD_Connection* connection,
+             const char* url,
+             const HttpServer::ApiHandler& handler) {
+  HttpServer::Arguments arguments;
+  MHD_get_connection_values(connection, MHD_GET_ARGUMENT_KIND,
+                            &AddArgument, &arguments);
+  std::string body;
+  const int status = handler(url, arguments, &body);
+  return QueueResponse(connection, status, body, "application/json");
+}
+
+struct EventStream {
+  HttpServer::EventReader reader;
+  EventWaiters* waiters;
+  struct MHD_Connection* connection;
+  std::string buffer;
+  size_t offset = 0;
+  bool ended = false;
+  std::chrono::steady_clock::time_point last_write;
+};
+
+ssize_t ReadEvents(void* cls, uint64_t position, char* buffer, size_t size) {
+  EventStream* stream = static_cast<EventStream*>(cls);
+  EventWaiters* waiters = stream->waiters;
+  const std::chrono::seconds keepalive(FLAGS_http_event_keepalive_s);
+  while (stream->offset == stream->buffer.size()) {
+    stream->buffer.clear();
+    stream->offset = 0;
+    if (stream->ended) {
+      return MHD_CONTENT_READER_END_OF_STREAM;
+    }
+    uint64_t generation;
+    {
+      std::lock_guard<std::mutex> lock(waiters->lock);
+      if (waiters->stopping) {
+        return MHD_CONTENT_READER_END_OF_STREAM;
+      }
+      generation = waiters->generation;
+    }
+    stream->ended = !stream->reader(&stream->buffer);
+    const std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    if (!stream->buffer.empty()) {
+      stream->last_write = now;
+      continue;
+    }
+    if (stream->ended) {
+      continue;
+    }
+    if (now - stream->last_write >= keepalive) {
+      stream->buffer = ":\n\n";
+      stream->last_write = now;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(waiters->lock);
+    if (waiters->generation != generation || waiters->stopping) {
+      continue;
+    }
+    if (!waiters->suspend) {
+      waiters->changed.wait_for(lock, keepalive - (now - stream->last_write));
+      continue;
+    }
+    // Resumed by NotifyEvents(), MHD calls us again then.
+    waiters->suspended.push_back(stream->connection);
+    MHD_suspend_connection(stream->connection);
+    return 0;
+  }
+  const size_t bytes = std::min(size, stream->buffer.size() - stream->offset);
+  memcpy(buffer, stream->buffer.data() + stream->offset, bytes);
+  stream->offset += bytes;
+  return bytes;
+}
+
+void FreeEvents(void* cls) {
+  EventStream* stream = static_cast<EventStream*>(cls);
+  {
+    std::lock_guard<std::mutex> lock(stream->waiters->lock);
+    std::vector<struct MHD_Connection*>& suspended =
+        stream->waiters->suspended;
+    suspended.erase(
+        std::remove(suspended.begin(), suspended.end(), stream->connection),
+        suspended.end());
+  }
+  delete stream;
+}
+
+int QueueEvents(struct MHD_Connection* connection,
+                const HttpServer::EventStreamFactory& factory,
+                EventWaiters* waiters) {
+  HttpServer::Arguments arguments;
+  MHD_get_connection_values(connection, MHD_GET_ARGUMENT_KIND,
+                            &AddArgument, &arguments);
+  const char* last_event_id = MHD_lookup_connection_value(
+      connection, MHD_HEADER_KIND, "Last-Event-ID");
+  HttpServer::EventReader reader =
+      factory(arguments, last_event_id != NULL ? last_event_id : "");
+  if (!reader) {
+    return QueueResponse(connection, MHD_HTTP_BAD_REQUEST,
+                         "Bad event stream request");
+  }
+  EventStream* stream = new EventStream();
+  stream->reader = std::move(reader);
+  stream->waiters = waiters;
+  stream->connection = connection;
+  // Gets the response headers out before the first event.
+  stream->buffer = ":\n\n";
+  stream->last_write = std::chrono::steady_clock::now();
+  struct MHD_Response* response = MHD_create_response_from_callback(
+      MHD_SIZE_UNKNOWN, kEventChunkBytes, &ReadEvents, stream, &FreeEvents);
+  if (response == NULL) {
+    delete stream;
+    return MHD_NO;
+  }
+  MHD_add_response_header(response, "Content-Type", "text/event-stream");
+  MHD_add_response_header(response, "Cache-Control", "no-cache");
+  int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+  MHD_destroy_response(response);
+  return ret;
+}
+
+// Time from dispatching a request to queueing its response. Streamed
+// pages and files are rendered or read while they are sent, after that.
+Histogram* RequestLatency(const char* handler) {
+  return MetricsRegistry::instance()->histogram(
+      "quobyte_http_request_seconds", "HTTP request handling time by handler",
+      std::string("handler=\"") + handler + "\"");
+}
+
+Histogram* const file_latency = RequestLatency("file");
+Histogram* const page_latency = RequestLatency("page");
+Histogram* const api_latency = RequestLatency("api");
+Histogram* const dispatch_latency = RequestLatency("dispatch");
+Histogram* const events_latency = RequestLatency("events");
+
+void RequestCompleted(void* cls,
+                      struct MHD_Connection* connection,
+                      void** ptr,
+                      enum MHD_RequestTerminationCode termination_code) {
+  delete static_cast<RequestContext*>(*ptr);
+  *ptr = NULL;
+}
+
+}  // namespace
+
+HttpServer::HttpServer(int port)
+    : waiters_(new EventWaiters()), port_(port) {
+  handlers_.waiters = waiters_.get();
+}
+
+HttpServer::~HttpServer() {
+  Stop();
+}
+
+void HttpServer::ServeFile(const std::string& url, const std::string& path) {
+  CHECK(daemon_ == NULL);
+  handlers_.files[url] = path;
+}
+
+void HttpServer::ServePage(const std::string& url, PageRenderer renderer) {
+  CHECK(daemon_ == NULL);
+  handlers_.pages[url] = renderer;
+}
+
+void HttpServer::ServeApi(const std::string& url, ApiHandler handler) {
+  CHECK(daemon_ == NULL);
+  handlers_.apis[url] = handler;
+}
+
+void HttpServer::ServeEvents(const std::string& url,
+                             EventStreamFactory factory) {
+  CHECK(daemon_ == NULL);
+  handlers_.events[url] = factory;
+}
+
+void HttpServer::NotifyEvents() {
+  {
+    std::lock_guard<std::mutex> lock(waiters_->lock);
+    ++waiters_->generation;
+    waiters_->pending = true;
+  }
+  waiters_->wake.notify_one();
+}
+
+void HttpServer::WakeEventStreams() {
+  const std::chrono::milliseconds keepalive(
+      std::max(1, FLAGS_http_event_keepalive_s) * 1000);
+  const std::chrono::milliseconds batch(FLAGS_http_event_batch_ms);
+  std::unique_lock<std::mutex> lock(waiters_->lock);
+  while (true) {
+    // Every half keep-alive interval at least, so that no stream stays
+    // quiet much longer than that.
+    waiters_->wake.wait_for(lock, keepalive / 2, [this]() {
+      return waiters_->pending || waiters_->stopping;
+    });
+    waiters_->pending = false;
+    std::vector<struct MHD_Connection*> suspended;
+    suspended.swap(waiters_->suspended);
+    waiters_->changed.notify_all();
+    const bool stopping = waiters_->stopping;
+    lock.unlock();
+    // Suspended until resumed, they cannot go away meanwhile.
+    for (struct MHD_Connection* connection : suspended) {
+      MHD_resume_connection(connection);
+    }
+    lock.lock();
+    if (stopping) {
+      return;
+    }
+    waiters_->wake.wait_for(lock, batch, [this]() {
+      return waiters_->stopping;
+    });
+  }
+}
 
 void HttpServer::Start(Dispatcher request_dispatcher) {
-  request_dispatcher_ = request_dispatcher;
-  daemon_ = MHD_start_daemon(MHD_USE_THREAD_PER_CONNECTION,
+  handlers_.dispatcher = request_dispatcher;
+  waiters_->stopping = false;
+  if (FLAGS_http_thread_per_connection) {
+    daemon_ = MHD_start_daemon(MHD_USE_THREAD_PER_CONNECTION,
                                port_,
                                NULL,
                                NULL,
                                &HttpServer::HandleRequest,
-                               &request_dispatcher_,
+                               &handlers_,
                                MHD_OPTION_CONNECTION_TIMEOUT, 1,
+                               MHD_OPTION_NOTIFY_COMPLETED,
+                               &RequestCompleted, NULL,
+                               MHD_OPTION_LISTENING_ADDRESS_REUSE, 1u,
                                MHD_OPTION_END);
+  } else {
+#ifdef __linux__
+    unsigned int mode = MHD_USE_EPOLL_INTERNALLY;
+#else
+    unsigned int mode = MHD_USE_SELECT_INTERNALLY;
+#endif
+    if (!handlers_.events.empty()) {
+      mode |= MHD_USE_SUSPEND_RESUME;
+      waiters_->suspend = true;
+    }
+    daemon_ = MHD_start_daemon(
+        mode,
+        port_,
+        NULL,
+        NULL,
+        &HttpServer::HandleRequest,
+        &handlers_,
+        MHD_OPTION_THREAD_POOL_SIZE,
+        static_cast<unsigned int>(FLAGS_http_threads),
+        MHD_OPTION_CONNECTION_LIMIT,
+        static_cast<unsigned int>(FLAGS_http_connection_limit),
+        MHD_OPTION_CONNECTION_TIMEOUT,
+        static_cast<unsigned int>(FLAGS_http_connection_timeout_s),
+        MHD_OPTION_NOTIFY_COMPLETED, &RequestCompleted, NULL,
+        // A standby's health check server has just closed the port.
+        MHD_OPTION_LISTENING_ADDRESS_REUSE, 1u,
+        MHD_OPTION_END);
+  }
   if (daemon_ == NULL) {
     LOG(FATAL) << "Could not start HTTP server.";
   }
+  if (!handlers_.events.empty()) {
+    notify_thread_ = std::thread(&HttpServer::WakeEventStreams, this);
+  }
 }
 
 void HttpServer::Stop() {
+  if (notify_thread_.joinable()) {
+    // The thread resumes the suspended streams, which end then.
+    // microhttpd does not stop with suspended connections.
+    {
+      std::lock_guard<std::mutex> lock(waiters_->lock);
+      waiters_->stopping = true;
+    }
+    waiters_->wake.notify_one();
+    notify_thread_.join();
+  }
   if (daemon_ != NULL) {
     MHD_stop_daemon(daemon_);
     daemon_ = NULL;
@@ -55,47 +592,151 @@ int HttpServer::HandleRequest(void *cls,
                               const char* upload_data,
                               size_t* upload_data_size,
                               void** ptr) {
-  Dispatcher& dispatch = *static_cast<Dispatcher*>(cls);
-  std::string* post_data = static_cast<std::string*>(*ptr);
+  Handlers& handlers = *static_cast<Handlers*>(cls);
+  RequestContext* request = static_cast<RequestContext*>(*ptr);
+
+  if (strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0) {
+    auto file = handlers.files.find(url);
+    if (file != handlers.files.end()) {
+      LatencyTimer timer(file_latency);
+      return QueueFile(connection, url, file->second);
+    }
+    auto page = handlers.pages.find(url);
+    if (page != handlers.pages.end()) {
+      LatencyTimer timer(page_latency);
+      return QueuePage(connection, page->second);
+    }
+  }
+  if (strcmp(method, "GET") == 0) {
+    const size_t url_length = strlen(url);
+    for (const auto& api : handlers.apis) {
+      const std::string& prefix = api.first;
+      if (url_length >= prefix.size() &&
+          prefix.compare(0, prefix.size(), url, prefix.size()) == 0 &&
+          (url[prefix.size()] == '\0' || url[prefix.size()] == '/')) {
+        LatencyTimer timer(api_latency);
+        return QueueApi(connection, url, api.second);
+      }
+    }
+    auto events = handlers.events.find(url);
+    if (events != handlers.events.end()) {
+      LatencyTimer timer(events_latency);
+      return QueueEvents(connection, events->second, handlers.waiters);
+    }
+  }
 
   if (std::string(method) == "POST") {
-    if (post_data == NULL) {
+    if (request == NULL) {
       /* The first time only the headers are valid,
          do not respond in the first round... */
-      *ptr = new std::string();
+      request = new RequestContext();
+      *ptr = request;
+      const char* length = MHD_lookup_connection_value(
+          connection, MHD_HEADER_KIND, "Content-Length");
+      if (length != NULL) {
+        const long long bytes = atoll(length);
+        if (bytes > FLAGS_http_max_post_bytes) {
+          request->too_large = true;
+        } else if (bytes > 0) {
+          request->body.reserve(bytes);
+        }
+      }
       return MHD_YES;
     }
     if (*upload_data_size > 0) {
-      post_data->append(std::string(upload_data, *upload_data_size));
+      if (!request->too_large && request->body.size() + *upload_data_size >
+          static_cast<size_t>(FLAGS_http_max_post_bytes)) {
+        request->too_large = true;
+        std::string().swap(request->body);
+      }
+      if (!request->too_large) {
+        request->body.append(upload_data, *upload_data_size);
+      }
       *upload_data_size = 0;  // acknowledge
       return MHD_YES;
     }
   }
 
   // Invariant: *upload_data_size == 0
+  LatencyTimer timer(dispatch_latency);
+
+  if (request != NULL && request->too_large) {
+    LOG(WARNING) << "Refusing POST to " << url << " above "
+        << FLAGS_http_max_post_bytes << " bytes";
+    return QueueResponse(connection, MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
+                         "Request body too large");
+  }
 
-  std::string page = dispatch(method, url, post_data != NULL ? *post_data : "");
+  std::string page = handlers.dispatcher(method, url,
+                              request != NULL ? request->body : "");
 
   if (!page.empty()) {
-    struct MHD_Response* response = MHD_create_response_from_data(
-        page.length(),
-        (void*) page.c_str(),
-        MHD_NO,
-        MHD_YES);
-    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-    MHD_destroy_response(response);
-    return ret;
+    return QueueResponse(connection, MHD_HTTP_OK, page);
   } else {
-    std::string response_404 = std::string("Not found: ") + url;
-    struct MHD_Response* response = MHD_create_response_from_data(
-        response_404.size(),
-        (void*) response_404.c_str(),
-        MHD_NO,
-        MHD_YES);
-    int ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-    MHD_destroy_response(response);
-    return ret;
+    return QueueResponse(connection, MHD_HTTP_NOT_FOUND,
+                         std::string("Not found: ") + url);
   }
 }
-}  // namespace quobyte
 
+PageStream::PageStream(PageFragments fragments, bool gzip)
+    : fragments_(std::move(fragments)) {
+  if (gzip) {
+    zstream_.reset(new z_stream());
+    // 16 + window bits asks for a gzip header and trailer.
+    if (deflateInit2(zstream_.get(), FLAGS_http_gzip_level, Z_DEFLATED,
+                     16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      LOG(FATAL) << "Could not initialize zlib";
+    }
+  }
+}
+
+PageStream::~PageStream() {
+  if (zstream_) {
+    deflateEnd(zstream_.get());
+  }
+}
+
+size_t PageStream::read(char* buffer, size_t size) {
+  if (!zstream_) {
+    return copy(buffer, size);
+  }
+  z_stream* zstream = zstream_.get();
+  zstream->next_out = reinterpret_cast<Bytef*>(buffer);
+  zstream->avail_out = size;
+  while (zstream->avail_out > 0 && !finished_) {
+    if (zstream->avail_in == 0 && fragment_ < fragments_.size()) {
+      const std::string& fragment = *fragments_[fragment_++];
+      zstream->next_in = reinterpret_cast<Bytef*>(
+          const_cast<char*>(fragment.data()));
+      zstream->avail_in = fragment.size();
+    }
+    const bool last = zstream->avail_in == 0 &&
+        fragment_ == fragments_.size();
+    const int result = deflate(zstream, last ? Z_FINISH : Z_NO_FLUSH);
+    if (result == Z_STREAM_END) {
+      finished_ = true;
+    } else if (result != Z_OK && result != Z_BUF_ERROR) {
+      LOG(ERROR) << "Could not compress page: " << result;
+      finished_ = true;
+    }
+  }
+  return size - zstream->avail_out;
+}
+
+size_t PageStream::copy(char* buffer, size_t size) {
+  size_t copied = 0;
+  while (copied < size && fragment_ < fragments_.size()) {
+    const std::string& fragment = *fragments_[fragment_];
+    const size_t bytes = std::min(size - copied, fragment.size() - offset_);
+    memcpy(buffer + copied, fragment.data() + offset_, bytes);
+    copied += bytes;
+    offset_ += bytes;
+    if (offset_ == fragment.size()) {
+      ++fragment_;
+      offset_ = 0;
+    }
+  }
+  return copied;
+}
+
+}  // namespace quobyte
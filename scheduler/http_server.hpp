@@ -7,23 +7,70 @@
 #pragma once
 
 #include <cstdint>
+#include <map>
+#include <memory>
 #include <string>
 #include <functional>
+#include <thread>
+#include <vector>
 
 struct MHD_Daemon;
 struct MHD_Connection;
+struct z_stream_s;
 
 namespace quobyte {
 
-// status server displaying error log and metrics
+// A page as the concatenation of shared pieces, so that renderers can keep
+// unchanged parts between requests.
+typedef std::vector<std::shared_ptr<const std::string>> PageFragments;
+
+struct EventWaiters;
+
+// status server displaying error log and metrics. Serves from a pool of
+// --http_threads event loops (epoll on Linux) with keep-alive, unless
+// --http_thread_per_connection.
 class HttpServer {
  public:
   typedef
       std::function<
           std::string(const std::string&, const std::string&, const std::string&)>
       Dispatcher;
+  typedef std::function<PageFragments()> PageRenderer;
+  typedef std::map<std::string, std::string> Arguments;
+  // Returns the HTTP status and sets the JSON body.
+  typedef std::function<int(const std::string& path,
+                            const Arguments& arguments,
+                            std::string* body)> ApiHandler;
+  // Appends what is new in an event stream to out, in the
+  // text/event-stream format. Returns false to end the stream.
+  typedef std::function<bool(std::string* out)> EventReader;
+  // Opens an event stream for the query arguments and the Last-Event-ID
+  // header, empty if missing. An empty reader refuses it with 400.
+  typedef std::function<EventReader(const Arguments& arguments,
+                                    const std::string& last_event_id)>
+      EventStreamFactory;
 
   HttpServer(int port);
+  ~HttpServer();
+  // Serves GET and HEAD of url from the file at path, without passing them
+  // to the dispatcher. The file is sent from its descriptor as it is at the
+  // time of the request, with ETag, Last-Modified, conditional GET and
+  // single byte ranges. Call before Start().
+  void ServeFile(const std::string& url, const std::string& path);
+  // Serves GET and HEAD of url from the fragments the renderer returns.
+  // They are streamed with chunked encoding, gzip-compressed if the client
+  // accepts it. Call before Start().
+  void ServePage(const std::string& url, PageRenderer renderer);
+  // Serves GET of url and the paths below it as JSON, with the decoded
+  // query arguments. Call before Start().
+  void ServeApi(const std::string& url, ApiHandler handler);
+  // Serves GET of url as server-sent events. A stream with nothing to send
+  // waits without holding a worker until NotifyEvents(), idle streams get
+  // a comment every --http_event_keepalive_s. Call before Start().
+  void ServeEvents(const std::string& url, EventStreamFactory factory);
+  // Lets the waiting event streams read again, from any thread. Returns
+  // right away, they are woken up by a thread of the server in batches.
+  void NotifyEvents();
   void Start(Dispatcher request_dispatcher);
   void Stop();
 
@@ -38,9 +85,44 @@ class HttpServer {
                            const char* upload_data,
                            size_t* update_data_size,
                            void** ptr);
+  // Body of notify_thread_.
+  void WakeEventStreams();
+  struct Handlers {
+    Dispatcher dispatcher;
+    std::map<std::string, std::string> files;
+    std::map<std::string, PageRenderer> pages;
+    std::map<std::string, ApiHandler> apis;
+    std::map<std::string, EventStreamFactory> events;
+    EventWaiters* waiters;
+  };
+
   struct MHD_Daemon* daemon_ = NULL;
-  Dispatcher request_dispatcher_;
+  Handlers handlers_;
+  std::unique_ptr<EventWaiters> waiters_;
+  // Wakes up waiting event streams on news, and idle ones for their
+  // keep-alive comment.
+  std::thread notify_thread_;
   int port_;
 };
 
+// Reads the fragments of a page in pieces, gzip-compressed at
+// --http_gzip_level if asked to.
+class PageStream {
+ public:
+  PageStream(PageFragments fragments, bool gzip);
+  ~PageStream();
+
+  // Fills up to size bytes, returns 0 at the end of the page.
+  size_t read(char* buffer, size_t size);
+
+ private:
+  size_t copy(char* buffer, size_t size);
+
+  const PageFragments fragments_;
+  size_t fragment_ = 0;
+  size_t offset_ = 0;
+  std::unique_ptr<z_stream_s> zstream_;
+  bool finished_ = false;
+};
+
 }  // namespace quobyte
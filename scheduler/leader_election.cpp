@@ -0,0 +1,133 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "leader_election.hpp"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+#include <stout/duration.hpp>
+
+#include "state_encoding.hpp"
+
+LeaderElection::LeaderElection(mesos::state::State* state,
+                               const std::string& path,
+                               const std::string& identity,
+                               const Clock* clock,
+                               int64_t lease_micros)
+    : state_(state), path_(path), identity_(identity), clock_(clock),
+      lease_micros_(lease_micros), variable_(state->fetch(path).get()),
+      lease_seen_micros_(clock->nowMicros()) {
+  bool legacy;
+  if (!DecodeState(variable_.value(), &lease_, &legacy)) {
+    LOG(FATAL) << "Could not parse leader lease " << path_;
+  }
+}
+
+bool LeaderElection::poll() {
+  const int64_t now = clock_->nowMicros();
+  if (leading_) {
+    quobyte::LeaderLease renewed = lease_;
+    renewed.set_renewals(lease_.renewals() + 1);
+    if (store(renewed, lease_seen_micros_ + lease_micros_ - now)) {
+      lease_seen_micros_ = now;
+    } else if (lease_.owner() != identity_) {
+      LOG(WARNING) << "Lost the lease to " << lease_.owner();
+      leading_ = false;
+    } else if (clock_->nowMicros() - lease_seen_micros_ >= lease_micros_) {
+      LOG(ERROR) << "Could not renew the lease in time, stepping down";
+      leading_ = false;
+    }
+    return leading_;
+  }
+
+  if (!fetch(lease_micros_)) {
+    return false;
+  }
+  const bool vacant = variable_.value().empty() || lease_.released() ||
+      lease_.owner() == identity_;
+  if (!vacant && now - lease_seen_micros_ < lease_micros_) {
+    return false;
+  }
+  quobyte::LeaderLease acquired;
+  acquired.set_owner(identity_);
+  acquired.set_term(lease_.term() + 1);
+  if (store(acquired, lease_micros_)) {
+    LOG(INFO) << "Leading as " << identity_ << " in term " << lease_.term()
+        << (vacant ? "" : ", the lease had expired");
+    leading_ = true;
+    lease_seen_micros_ = now;
+  }
+  return leading_;
+}
+
+void LeaderElection::release() {
+  if (!leading_) {
+    return;
+  }
+  quobyte::LeaderLease released = lease_;
+  released.set_released(true);
+  if (!store(released, lease_seen_micros_ + lease_micros_ -
+                           clock_->nowMicros())) {
+    LOG(WARNING) << "Could not release the lease";
+  }
+  leading_ = false;
+}
+
+bool LeaderElection::fetch(int64_t timeout_micros) {
+  process::Future<mesos::state::Variable> fetched = state_->fetch(path_);
+  if (!fetched.await(Microseconds(std::max<int64_t>(timeout_micros, 0)))) {
+    LOG(ERROR) << "Timed out fetching " << path_;
+    fetched.discard();
+    return false;
+  }
+  if (!fetched.isReady()) {
+    LOG(ERROR) << "Could not fetch " << path_ << ": "
+        << (fetched.isFailed() ? fetched.failure() : "discarded");
+    return false;
+  }
+  const bool changed = fetched.get().value() != variable_.value();
+  variable_ = fetched.get();
+  if (changed) {
+    bool legacy;
+    if (!DecodeState(variable_.value(), &lease_, &legacy)) {
+      LOG(ERROR) << "Could not parse leader lease " << path_;
+      return false;
+    }
+    lease_seen_micros_ = clock_->nowMicros();
+  }
+  return true;
+}
+
+// Returns false if the store failed, or lost against another one. In the
+// latter case lease_ is the one stored by the other scheduler.
+bool LeaderElection::store(const quobyte::LeaderLease& lease,
+                           int64_t timeout_micros) {
+  if (timeout_micros <= 0) {
+    return false;
+  }
+  const int64_t deadline = clock_->nowMicros() + timeout_micros;
+  process::Future<Option<mesos::state::Variable>> stored =
+      state_->store(variable_.mutate(EncodeState(lease)));
+  if (!stored.await(Microseconds(timeout_micros))) {
+    // It may still happen later, the next store then conflicts with it.
+    LOG(ERROR) << "Timed out storing " << path_;
+    stored.discard();
+    return false;
+  }
+  if (!stored.isReady()) {
+    LOG(ERROR) << "Could not store " << path_ << ": "
+        << (stored.isFailed() ? stored.failure() : "discarded");
+    return false;
+  }
+  if (stored.get().isNone()) {
+    fetch(deadline - clock_->nowMicros());
+    return false;
+  }
+  variable_ = stored.get().get();
+  lease_.CopyFrom(lease);
+  return true;
+}
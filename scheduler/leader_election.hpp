@@ -0,0 +1,70 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <mesos/state/state.hpp>
+
+#include "clock.hpp"
+#include "quobyte.pb.h"
+
+// Elects one of several schedulers through a lease variable in the state
+// store, updated with versioned stores only. The leader renews the lease on
+// every poll. A follower takes it over when it has not seen it change for
+// lease_micros of its own clock, so clocks of different hosts need not
+// agree. A leader that could not renew for lease_micros gives up before
+// any follower takes over, a store that hangs is only waited for as long
+// as the lease lasts.
+//
+// Not thread-safe, poll() from one thread.
+class LeaderElection {
+ public:
+  LeaderElection(mesos::state::State* state,
+                 const std::string& path,
+                 const std::string& identity,
+                 const Clock* clock,
+                 int64_t lease_micros);
+
+  // Renews or acquires the lease. Returns whether this scheduler leads.
+  bool poll();
+
+  // Marks the lease released, a follower takes over on its next poll.
+  void release();
+
+  bool leading() const {
+    return leading_;
+  }
+
+  // Holder of the lease, as of the last poll.
+  const std::string& leader() const {
+    return lease_.owner();
+  }
+
+  // Counts takeovers, stamped on what the leader writes.
+  uint64_t term() const {
+    return lease_.term();
+  }
+
+ private:
+  // Both give up after timeout_micros.
+  bool fetch(int64_t timeout_micros);
+  bool store(const quobyte::LeaderLease& lease, int64_t timeout_micros);
+
+  mesos::state::State* state_;
+  const std::string path_;
+  const std::string identity_;
+  const Clock* clock_;
+  const int64_t lease_micros_;
+
+  mesos::state::Variable variable_;
+  quobyte::LeaderLease lease_;
+  bool leading_ = false;
+  // When the lease last changed, or was last renewed by us.
+  int64_t lease_seen_micros_ = 0;
+};
@@ -0,0 +1,197 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+#include <glog/logging.h>
+
+namespace metrics_internal {
+
+size_t ThreadSlot() {
+  static std::atomic<size_t> next_slot(0);
+  static thread_local size_t slot =
+      next_slot.fetch_add(1, std::memory_order_relaxed) % kSlots;
+  return slot;
+}
+
+}  // namespace metrics_internal
+
+uint64_t Counter::value() const {
+  uint64_t value = 0;
+  for (const Slot& slot : slots_) {
+    value += slot.value.load(std::memory_order_relaxed);
+  }
+  return value;
+}
+
+const int64_t Histogram::kBoundsMicros[Histogram::kBuckets - 1] = {
+  10, 25, 50, 100, 250, 500,
+  1000, 2500, 5000, 10000, 25000, 50000,
+  100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+  // Task launches, image pulls included.
+  30000000, 60000000, 120000000, 300000000, 600000000, 1800000000
+};
+
+int Histogram::bucket(int64_t micros) {
+  return std::lower_bound(kBoundsMicros, kBoundsMicros + kBuckets - 1,
+                          micros) - kBoundsMicros;
+}
+
+void Histogram::observe(int64_t micros) {
+  Slot& slot = slots_[metrics_internal::ThreadSlot()];
+  slot.buckets[bucket(micros)].fetch_add(1, std::memory_order_relaxed);
+  slot.sum_micros.fetch_add(micros, std::memory_order_relaxed);
+}
+
+void Histogram::collect(uint64_t buckets[kBuckets],
+                        int64_t* sum_micros,
+                        uint64_t* count) const {
+  std::fill(buckets, buckets + kBuckets, 0);
+  *sum_micros = 0;
+  for (const Slot& slot : slots_) {
+    for (int i = 0; i < kBuckets; ++i) {
+      buckets[i] += slot.buckets[i].load(std::memory_order_relaxed);
+    }
+    *sum_micros += slot.sum_micros.load(std::memory_order_relaxed);
+  }
+  for (int i = 1; i < kBuckets; ++i) {
+    buckets[i] += buckets[i - 1];
+  }
+  *count = buckets[kBuckets - 1];
+}
+
+int64_t Histogram::percentileMicros(double quantile) const {
+  uint64_t buckets[kBuckets];
+  int64_t sum_micros;
+  uint64_t count;
+  collect(buckets, &sum_micros, &count);
+  if (count == 0) {
+    return 0;
+  }
+  const uint64_t rank = std::max<uint64_t>(1, quantile * count + 0.5);
+  const int bucket =
+      std::lower_bound(buckets, buckets + kBuckets, rank) - buckets;
+  return kBoundsMicros[std::min(bucket, kBuckets - 2)];
+}
+
+MetricsRegistry* MetricsRegistry::instance() {
+  static MetricsRegistry* registry = new MetricsRegistry();
+  return registry;
+}
+
+Counter* MetricsRegistry::counter(const std::string& name,
+                                  const std::string& help,
+                                  const std::string& labels) {
+  std::lock_guard<std::mutex> lock(lock_);
+  Family& family = families_[name];
+  CHECK(!family.histogram) << name << " is a histogram";
+  family.help = help;
+  std::unique_ptr<Counter>& counter = family.counters[labels];
+  if (!counter) {
+    counter.reset(new Counter());
+  }
+  return counter.get();
+}
+
+Histogram* MetricsRegistry::histogram(const std::string& name,
+                                      const std::string& help,
+                                      const std::string& labels) {
+  std::lock_guard<std::mutex> lock(lock_);
+  Family& family = families_[name];
+  CHECK(family.counters.empty()) << name << " is a counter";
+  family.histogram = true;
+  family.help = help;
+  std::unique_ptr<Histogram>& histogram = family.histograms[labels];
+  if (!histogram) {
+    histogram.reset(new Histogram());
+  }
+  return histogram.get();
+}
+
+static std::string WithLabel(const std::string& labels,
+                             const std::string& label) {
+  if (labels.empty()) {
+    return label;
+  }
+  return labels + "," + label;
+}
+
+static void AppendSample(const std::string& name,
+                         const std::string& labels,
+                         const char* value,
+                         std::string* out) {
+  out->append(name);
+  if (!labels.empty()) {
+    out->append("{").append(labels).append("}");
+  }
+  out->append(" ").append(value).append("\n");
+}
+
+static void AppendHeader(const std::string& name,
+                         const std::string& help,
+                         const char* type,
+                         std::string* out) {
+  out->append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out->append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+std::string MetricsRegistry::render() const {
+  std::string out;
+  char value[32];
+  std::lock_guard<std::mutex> lock(lock_);
+  for (const auto& family : families_) {
+    const std::string& name = family.first;
+    if (!family.second.histogram) {
+      AppendHeader(name, family.second.help, "counter", &out);
+      for (const auto& counter : family.second.counters) {
+        snprintf(value, sizeof(value), "%" PRIu64, counter.second->value());
+        AppendSample(name, counter.first, value, &out);
+      }
+      continue;
+    }
+    AppendHeader(name, family.second.help, "histogram", &out);
+    for (const auto& histogram : family.second.histograms) {
+      uint64_t buckets[Histogram::kBuckets];
+      int64_t sum_micros;
+      uint64_t count;
+      histogram.second->collect(buckets, &sum_micros, &count);
+      for (int i = 0; i < Histogram::kBuckets; ++i) {
+        char le[32];
+        if (i < Histogram::kBuckets - 1) {
+          snprintf(le, sizeof(le), "le=\"%g\"",
+                   Histogram::kBoundsMicros[i] / 1e6);
+        } else {
+          snprintf(le, sizeof(le), "le=\"+Inf\"");
+        }
+        snprintf(value, sizeof(value), "%" PRIu64, buckets[i]);
+        AppendSample(name + "_bucket", WithLabel(histogram.first, le),
+                     value, &out);
+      }
+      snprintf(value, sizeof(value), "%.6f", sum_micros / 1e6);
+      AppendSample(name + "_sum", histogram.first, value, &out);
+      snprintf(value, sizeof(value), "%" PRIu64, count);
+      AppendSample(name + "_count", histogram.first, value, &out);
+    }
+  }
+  return out;
+}
+
+void AppendGauge(const std::string& name,
+                 const std::string& help,
+                 const std::string& labels,
+                 int64_t value,
+                 std::string* out) {
+  if (!help.empty()) {
+    AppendHeader(name, help, "gauge", out);
+  }
+  char text[32];
+  snprintf(text, sizeof(text), "%" PRId64, value);
+  AppendSample(name, labels, text, out);
+}
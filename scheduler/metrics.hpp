@@ -0,0 +1,139 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Counters and latency histograms for /metrics, cheap enough to update
+// inline in the scheduler callbacks and the HTTP workers. Every metric has
+// kSlots slots a cache line apart, each thread updates its own one with
+// relaxed atomics and a scrape adds them up.
+
+namespace metrics_internal {
+
+static const size_t kSlots = 16;
+// Between the slots, so that no two of them share a cache line however the
+// metric is allocated.
+static const size_t kPadding = 64;
+
+// Slot of the calling thread.
+size_t ThreadSlot();
+
+}  // namespace metrics_internal
+
+class Counter {
+ public:
+  void increment(uint64_t count = 1) {
+    slots_[metrics_internal::ThreadSlot()].value.fetch_add(
+        count, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const;
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> value{0};
+    char padding[metrics_internal::kPadding - sizeof(uint64_t)];
+  };
+  Slot slots_[metrics_internal::kSlots];
+};
+
+// Durations in microseconds, exported in seconds.
+class Histogram {
+ public:
+  // Upper bounds of the buckets, followed by +Inf.
+  static const int kBuckets = 26;
+  static const int64_t kBoundsMicros[kBuckets - 1];
+
+  // Bucket of a duration.
+  static int bucket(int64_t micros);
+
+  void observe(int64_t micros);
+
+  // Cumulative bucket counts, sum and count, as Prometheus wants them.
+  void collect(uint64_t buckets[kBuckets],
+               int64_t* sum_micros,
+               uint64_t* count) const;
+  // Upper bound of the bucket of the given quantile, the largest bound for
+  // +Inf and 0 without observations.
+  int64_t percentileMicros(double quantile) const;
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> buckets[kBuckets];
+    std::atomic<int64_t> sum_micros{0};
+    char padding[metrics_internal::kPadding];
+
+    Slot() {
+      for (std::atomic<uint64_t>& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+      }
+    }
+  };
+  Slot slots_[metrics_internal::kSlots];
+};
+
+// Observes the time until it goes out of scope.
+class LatencyTimer {
+ public:
+  explicit LatencyTimer(Histogram* histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+
+  ~LatencyTimer() {
+    histogram_->observe(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start_).count());
+  }
+
+ private:
+  Histogram* histogram_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+// All metrics of the process by name and labels. Metrics live as long as
+// the process, so callers keep the pointers.
+class MetricsRegistry {
+ public:
+  static MetricsRegistry* instance();
+
+  // Returns the existing metric for the same name and labels, labels as in
+  // the exposition format: service="data".
+  Counter* counter(const std::string& name,
+                   const std::string& help,
+                   const std::string& labels = "");
+  Histogram* histogram(const std::string& name,
+                       const std::string& help,
+                       const std::string& labels = "");
+
+  // All metrics in the Prometheus text format.
+  std::string render() const;
+
+ private:
+  struct Family {
+    std::string help;
+    bool histogram = false;
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+  };
+
+  mutable std::mutex lock_;
+  std::map<std::string, Family> families_;
+};
+
+// Appends a gauge sample in the Prometheus text format, with its HELP and
+// TYPE lines when help is not empty.
+void AppendGauge(const std::string& name,
+                 const std::string& help,
+                 const std::string& labels,
+                 int64_t value,
+                 std::string* out);
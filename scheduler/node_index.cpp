@@ -0,0 +1,194 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "node_index.hpp"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+NodeIndex::Query::Query() {
+  std::fill(states, states + SERVICE_COUNT, 0);
+}
+
+const char* NodeIndex::serviceName(Service service) {
+  static const char* kNames[SERVICE_COUNT] = {
+    "prober", "registry", "metadata", "data", "client"
+  };
+  return kNames[service];
+}
+
+const quobyte::ServiceState& NodeIndex::service(
+    const quobyte::NodeState& node, Service service) {
+  switch (service) {
+    case PROBER:
+      return node.prober();
+    case REGISTRY:
+      return node.registry();
+    case METADATA:
+      return node.metadata();
+    case DATA:
+      return node.data();
+    case CLIENT:
+    default:
+      return node.client();
+  }
+}
+
+void NodeIndex::update(uint32_t index, const quobyte::NodeState& node) {
+  Entry entry;
+  for (int s = 0; s < SERVICE_COUNT; ++s) {
+    entry.states[s] = service(node, static_cast<Service>(s)).state();
+  }
+  for (int device_type : node.device_type()) {
+    entry.devices |= 1u << device_type;
+  }
+  entry.last_probe_s = node.last_probe_s();
+
+  std::lock_guard<std::mutex> lock(lock_);
+  if (index >= entries_.size()) {
+    CHECK_EQ(index, entries_.size());
+    by_hostname_[node.hostname()] = index;
+  } else {
+    const Entry& old = entries_[index];
+    for (int s = 0; s < SERVICE_COUNT; ++s) {
+      if (old.states[s] != entry.states[s]) {
+        by_state_[s][old.states[s]].erase(index);
+      }
+    }
+    for (int d = 0; d < kDeviceTypeCount; ++d) {
+      if ((old.devices & ~entry.devices) & (1u << d)) {
+        by_device_[d].erase(index);
+      }
+    }
+    if (old.last_probe_s != entry.last_probe_s) {
+      by_probe_.erase(std::make_pair(old.last_probe_s, index));
+    }
+  }
+  // Inserting what is already there is a no-op.
+  for (int s = 0; s < SERVICE_COUNT; ++s) {
+    by_state_[s][entry.states[s]].insert(index);
+  }
+  for (int d = 0; d < kDeviceTypeCount; ++d) {
+    if (entry.devices & (1u << d)) {
+      by_device_[d].insert(index);
+    }
+  }
+  by_probe_.insert(std::make_pair(entry.last_probe_s, index));
+  if (index >= entries_.size()) {
+    entries_.push_back(entry);
+  } else {
+    entries_[index] = entry;
+  }
+}
+
+uint32_t NodeIndex::findByHostname(const std::string& hostname) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto node = by_hostname_.find(hostname);
+  return node == by_hostname_.end() ? kNotFound : node->second;
+}
+
+bool NodeIndex::matches(const Entry& entry, const Query& query) const {
+  for (int s = 0; s < SERVICE_COUNT; ++s) {
+    if (query.states[s] != 0 && entry.states[s] != query.states[s]) {
+      return false;
+    }
+  }
+  if ((entry.devices & query.devices) != query.devices) {
+    return false;
+  }
+  return !query.probed_before_set ||
+      entry.last_probe_s < query.probed_before_s;
+}
+
+std::vector<uint32_t> NodeIndex::query(const Query& query,
+                                       uint32_t start,
+                                       size_t limit,
+                                       uint32_t* next) const {
+  std::vector<uint32_t> result;
+  *next = kNotFound;
+  std::lock_guard<std::mutex> lock(lock_);
+
+  // Walks the smallest index of the query, and checks the other conditions
+  // on the nodes it yields.
+  const std::set<uint32_t>* candidates = NULL;
+  for (int s = 0; s < SERVICE_COUNT; ++s) {
+    if (query.states[s] != 0) {
+      const std::set<uint32_t>& nodes = by_state_[s][query.states[s]];
+      if (candidates == NULL || nodes.size() < candidates->size()) {
+        candidates = &nodes;
+      }
+    }
+  }
+  for (int d = 0; d < kDeviceTypeCount; ++d) {
+    if (query.devices & (1u << d)) {
+      const std::set<uint32_t>& nodes = by_device_[d];
+      if (candidates == NULL || nodes.size() < candidates->size()) {
+        candidates = &nodes;
+      }
+    }
+  }
+
+  auto add = [&](uint32_t index) {
+    if (!matches(entries_[index], query)) {
+      return true;
+    }
+    if (result.size() == limit) {
+      *next = index;
+      return false;
+    }
+    result.push_back(index);
+    return true;
+  };
+
+  if (candidates != NULL) {
+    for (auto it = candidates->lower_bound(start);
+         it != candidates->end() && add(*it); ++it) {
+    }
+  } else if (query.probed_before_set) {
+    // The nodes probed before the cutoff lead the probe index.
+    const auto probed_end =
+        by_probe_.lower_bound(std::make_pair(query.probed_before_s, 0u));
+    std::vector<uint32_t> probed;
+    for (auto it = by_probe_.begin(); it != probed_end; ++it) {
+      if (it->second >= start) {
+        probed.push_back(it->second);
+      }
+    }
+    std::sort(probed.begin(), probed.end());
+    for (auto it = probed.begin(); it != probed.end() && add(*it); ++it) {
+    }
+  } else {
+    for (uint32_t index = start; index < entries_.size() && add(index);
+         ++index) {
+    }
+  }
+  return result;
+}
+
+std::vector<uint32_t> NodeIndex::withState(Service service,
+                                           int state,
+                                           uint32_t start,
+                                           size_t limit) const {
+  std::vector<uint32_t> result;
+  std::lock_guard<std::mutex> lock(lock_);
+  const std::set<uint32_t>& nodes = by_state_[service][state];
+  for (auto it = nodes.lower_bound(start);
+       it != nodes.end() && result.size() < limit; ++it) {
+    result.push_back(*it);
+  }
+  return result;
+}
+
+size_t NodeIndex::count(Service service, int state) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return by_state_[service][state].size();
+}
+
+size_t NodeIndex::size() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return entries_.size();
+}
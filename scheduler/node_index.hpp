@@ -0,0 +1,93 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "quobyte.pb.h"
+
+// Secondary indexes over the published node states for the JSON API:
+// nodes by service state, by device type and by last probe. The scheduler
+// updates a node whenever it publishes a change of it, queries return
+// NodeRegistry indexes in ascending order without looking at other nodes.
+// Thread-safe.
+class NodeIndex {
+ public:
+  // The services every node runs, in API order.
+  enum Service {
+    PROBER = 0,
+    REGISTRY,
+    METADATA,
+    DATA,
+    CLIENT,
+    SERVICE_COUNT
+  };
+  static const int kStateCount = quobyte::ServiceState::TaskState_MAX + 1;
+  static const int kDeviceTypeCount = quobyte::DeviceType_MAX + 1;
+  static const uint32_t kNotFound = UINT32_MAX;
+
+  // All given conditions must hold.
+  struct Query {
+    Query();
+
+    // 0 for any state.
+    int states[SERVICE_COUNT];
+    // Bits of DeviceType values the node must have.
+    uint32_t devices = 0;
+    // Nodes whose last probe was before, when set.
+    bool probed_before_set = false;
+    int64_t probed_before_s = 0;
+  };
+
+  static const char* serviceName(Service service);
+  static const quobyte::ServiceState& service(const quobyte::NodeState& node,
+                                              Service service);
+
+  void update(uint32_t index, const quobyte::NodeState& node);
+
+  uint32_t findByHostname(const std::string& hostname) const;
+
+  // Matching nodes from start on, at most limit. *next is the start of the
+  // following page, kNotFound after the last one.
+  std::vector<uint32_t> query(const Query& query,
+                              uint32_t start,
+                              size_t limit,
+                              uint32_t* next) const;
+
+  // Nodes whose service is in state, from start on.
+  std::vector<uint32_t> withState(Service service,
+                                  int state,
+                                  uint32_t start,
+                                  size_t limit) const;
+
+  // Number of nodes whose service is in state.
+  size_t count(Service service, int state) const;
+
+  size_t size() const;
+
+ private:
+  struct Entry {
+    int states[SERVICE_COUNT];
+    uint32_t devices = 0;
+    int64_t last_probe_s = 0;
+  };
+
+  bool matches(const Entry& entry, const Query& query) const;
+
+  mutable std::mutex lock_;
+  std::vector<Entry> entries_;
+  std::unordered_map<std::string, uint32_t> by_hostname_;
+  std::set<uint32_t> by_state_[SERVICE_COUNT][kStateCount];
+  std::set<uint32_t> by_device_[kDeviceTypeCount];
+  std::set<std::pair<int64_t, uint32_t>> by_probe_;
+};
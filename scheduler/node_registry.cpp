@@ -0,0 +1,55 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "node_registry.hpp"
+
+const NodeRegistry::Index NodeRegistry::kNotFound;
+
+NodeRegistry::Index NodeRegistry::find(
+    const std::unordered_map<std::string, Index>& index,
+    const std::string& key) {
+  std::unordered_map<std::string, Index>::const_iterator entry =
+      index.find(key);
+  return entry == index.end() ? kNotFound : entry->second;
+}
+
+NodeRegistry::Index NodeRegistry::add(const std::string& hostname,
+                                      const std::string& agent_id) {
+  Index index = findByHostname(hostname);
+  if (index != kNotFound) {
+    return index;
+  }
+  index = nodes_.size();
+  nodes_.emplace_back();
+  nodes_.back().set_hostname(hostname);
+  by_hostname_.emplace(hostname, index);
+  updateAgentId(index, agent_id);
+  return index;
+}
+
+NodeRegistry::Index NodeRegistry::findByHostname(
+    const std::string& hostname) const {
+  return find(by_hostname_, hostname);
+}
+
+NodeRegistry::Index NodeRegistry::findByAgentId(
+    const std::string& agent_id) const {
+  return find(by_agent_id_, agent_id);
+}
+
+void NodeRegistry::updateAgentId(Index index, const std::string& agent_id) {
+  quobyte::NodeState& node = nodes_[index];
+  if (node.has_slave_id_value() && node.slave_id_value() == agent_id) {
+    return;
+  }
+  if (node.has_slave_id_value()) {
+    by_agent_id_.erase(node.slave_id_value());
+  }
+  node.set_slave_id_value(agent_id);
+  if (!agent_id.empty()) {
+    by_agent_id_[agent_id] = index;
+  }
+}
@@ -0,0 +1,55 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "quobyte.pb.h"
+
+// All known nodes, stored contiguously and addressed by a dense index.
+// Hostnames and agent ids are interned to that index once, so
+// the scheduler callbacks resolve a node with a single hash lookup.
+// Indices are stable, references returned by at() are not: do not hold on
+// to them across add().
+class NodeRegistry {
+ public:
+  typedef uint32_t Index;
+  static const Index kNotFound = UINT32_MAX;
+
+  // Returns the existing index if the hostname is already known.
+  Index add(const std::string& hostname, const std::string& agent_id);
+
+  Index findByHostname(const std::string& hostname) const;
+  Index findByAgentId(const std::string& agent_id) const;
+
+  // Agents get a new id when they re-register, keep the index current.
+  void updateAgentId(Index index, const std::string& agent_id);
+
+  quobyte::NodeState& at(Index index) { return nodes_[index]; }
+  const quobyte::NodeState& at(Index index) const { return nodes_[index]; }
+  size_t size() const { return nodes_.size(); }
+
+  std::vector<quobyte::NodeState>::iterator begin() { return nodes_.begin(); }
+  std::vector<quobyte::NodeState>::iterator end() { return nodes_.end(); }
+  std::vector<quobyte::NodeState>::const_iterator begin() const {
+    return nodes_.begin();
+  }
+  std::vector<quobyte::NodeState>::const_iterator end() const {
+    return nodes_.end();
+  }
+
+ private:
+  static Index find(const std::unordered_map<std::string, Index>& index,
+                    const std::string& key);
+
+  std::vector<quobyte::NodeState> nodes_;
+  std::unordered_map<std::string, Index> by_hostname_;
+  std::unordered_map<std::string, Index> by_agent_id_;
+};
@@ -0,0 +1,591 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "node_state_store.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "metrics.hpp"
+
+DEFINE_int32(node_journal_batches, 100,
+             "Journal batches of node states before they are compacted "
+             "into the shards");
+
+DEFINE_int32(node_journal_interval_ms, 1000,
+             "Collect node state updates this long into one journal batch");
+
+DEFINE_int32(node_state_shards, 64,
+             "Shards of the persisted node states, for new deployments. "
+             "Existing ones keep their shard count");
+
+DECLARE_int32(state_retry_backoff_ms);
+
+static const int kMaxRetryBackoffMs = 10000;
+
+static Histogram* const write_latency = MetricsRegistry::instance()->histogram(
+    "quobyte_state_write_seconds", "Successful state store writes",
+    "store=\"nodes\"");
+// Keeps journal batches far below the 1MB znode limit.
+static const size_t kMaxBatchNodes = 1000;
+
+static int64_t MicrosNow() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string Fetch(mesos::state::State* state, const std::string& name) {
+  process::Future<mesos::state::Variable> fetched = state->fetch(name);
+  fetched.await();
+  if (!fetched.isReady()) {
+    LOG(FATAL) << "Could not fetch " << name << ": "
+        << (fetched.isFailed() ? fetched.failure() : "discarded");
+  }
+  return fetched.get().value();
+}
+
+static bool Await(const process::Future<mesos::state::Variable>& fetched,
+                  const std::string& name) {
+  fetched.await();
+  if (!fetched.isReady()) {
+    LOG(ERROR) << "Could not fetch " << name << ": "
+        << (fetched.isFailed() ? fetched.failure() : "discarded");
+    return false;
+  }
+  return true;
+}
+
+NodeStateStore::NodeStateStore(mesos::state::State* state,
+                               const std::string& path)
+    : state_(state), path_(path) {}
+
+NodeStateStore::~NodeStateStore() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stopping_ = true;
+  }
+  changed_.notify_all();
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+}
+
+std::string NodeStateStore::journalName(uint64_t sequence) const {
+  return path_ + "-journal-" + std::to_string(sequence);
+}
+
+std::string NodeStateStore::shardName(uint32_t shard) const {
+  return path_ + "-shard-" + std::to_string(shard);
+}
+
+uint32_t NodeStateStore::shardOf(const std::string& hostname) const {
+  // FNV-1a, std::hash is not guaranteed to be stable across builds.
+  uint32_t hash = 2166136261u;
+  for (unsigned char c : hostname) {
+    hash = (hash ^ c) * 16777619u;
+  }
+  return hash % shards_.size();
+}
+
+void NodeStateStore::setTerm(uint64_t term) {
+  term_ = term;
+  fencing_ = true;
+}
+
+void NodeStateStore::load(quobyte::NodeStateSnapshot* snapshot) {
+  if (fencing_) {
+    claimRoot();
+  }
+  // A leader that hands over compacts with its last batch, journal batches
+  // not followed yet may be gone.
+  readLatest();
+  if (!fencing_) {
+    term_ = std::max(root_.term(), journal_term_);
+  }
+  journal_start_ = root_.sequence() + 1;
+  LOG(INFO) << "Loaded " << image_index_.size() << " nodes from "
+      << shards_.size() << " shards at " << root_.sequence() << " and "
+      << sequence_ - root_.sequence() << " journal batches";
+
+  snapshot->Clear();
+  for (const quobyte::NodeStateShard& shard : shards_) {
+    snapshot->mutable_node()->MergeFrom(shard.node());
+  }
+  snapshot->mutable_api()->CopyFrom(root_.api());
+  snapshot->mutable_s3()->CopyFrom(root_.s3());
+  snapshot->mutable_console()->CopyFrom(root_.console());
+  snapshot->set_sequence(sequence_);
+  writer_ = std::thread(&NodeStateStore::writeLoop, this);
+}
+
+void NodeStateStore::follow() {
+  const uint64_t sequence = sequence_;
+  readLatest();
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.batches_followed += sequence_ - sequence;
+}
+
+void NodeStateStore::readLatest() {
+  const std::string root = Fetch(state_, path_ + "-root");
+  quobyte::NodeStateRoot current;
+  if (!current.ParsePartialFromString(root)) {
+    LOG(FATAL) << "Could not parse node state root " << path_;
+  }
+  // After a compaction the journal we have not seen yet may be gone.
+  if (shards_.empty() || current.sequence() > sequence_) {
+    readImage(root);
+  }
+  replayJournal();
+}
+
+void NodeStateStore::readImage(const std::string& root) {
+  root_.Clear();
+  shards_.clear();
+  image_index_.clear();
+  if (!root.empty() && !root_.ParsePartialFromString(root)) {
+    LOG(FATAL) << "Could not parse node state root " << path_;
+  }
+  if (root.empty()) {
+    root_.set_shard_count(std::max(FLAGS_node_state_shards, 1));
+  } else if (root_.shard_count() !=
+             static_cast<uint32_t>(FLAGS_node_state_shards)) {
+    LOG(INFO) << "Keeping " << root_.shard_count() << " node state shards";
+  }
+  shards_.resize(root_.shard_count());
+  dirty_shards_.assign(shards_.size(), false);
+  // The root's term may be newer than the journal after it, claimRoot()
+  // stamps it before replaying.
+  journal_term_ = 0;
+
+  if (!root.empty()) {
+    std::vector<process::Future<mesos::state::Variable>> fetches;
+    for (uint32_t shard = 0; shard < shards_.size(); ++shard) {
+      fetches.push_back(state_->fetch(shardName(shard)));
+    }
+    for (uint32_t shard = 0; shard < shards_.size(); ++shard) {
+      fetches[shard].await();
+      if (!fetches[shard].isReady()) {
+        LOG(FATAL) << "Could not fetch " << shardName(shard) << ": "
+            << (fetches[shard].isFailed() ? fetches[shard].failure()
+                                          : "discarded");
+      }
+      quobyte::NodeStateShard& loaded = shards_[shard];
+      if (!loaded.ParsePartialFromString(fetches[shard].get().value())) {
+        LOG(FATAL) << "Could not parse " << shardName(shard);
+      }
+      for (int i = 0; i < loaded.node_size(); ++i) {
+        image_index_[loaded.node(i).hostname()] = std::make_pair(shard, i);
+      }
+    }
+  }
+  sequence_ = root_.sequence();
+}
+
+void NodeStateStore::replayJournal() {
+  // A compaction interrupted before its root write leaves shards newer
+  // than the root's sequence. Replaying the journal on top is harmless,
+  // every batch carries complete node states.
+  while (true) {
+    const std::string entry = Fetch(state_, journalName(sequence_ + 1));
+    if (entry.empty()) {
+      break;
+    }
+    quobyte::NodeStateJournalBatch batch;
+    if (!batch.ParsePartialFromString(entry)) {
+      LOG(FATAL) << "Could not parse " << journalName(sequence_ + 1);
+    }
+    if (batch.term() < journal_term_) {
+      LOG(WARNING) << "Ignoring " << journalName(sequence_ + 1)
+          << " and later, written in term " << batch.term()
+          << " after term " << journal_term_;
+      break;
+    }
+    journal_term_ = batch.term();
+    apply(batch);
+    ++sequence_;
+  }
+}
+
+// Stamps the stored root with the term before anything else is written.
+// The leader of an earlier term checks the root before every write.
+void NodeStateStore::claimRoot() {
+  const std::string name = path_ + "-root";
+  process::Future<mesos::state::Variable> fetched = state_->fetch(name);
+  if (!Await(fetched, name)) {
+    LOG(FATAL) << "Could not claim the node states in term " << term_;
+  }
+  quobyte::NodeStateRoot root;
+  if (!root.ParsePartialFromString(fetched.get().value())) {
+    LOG(FATAL) << "Could not parse node state root " << path_;
+  }
+  if (root.term() > term_) {
+    LOG(FATAL) << "Node states were written in term " << root.term()
+        << ", after ours " << term_;
+  }
+  if (root.term() == term_ && !fetched.get().value().empty()) {
+    return;
+  }
+  if (fetched.get().value().empty()) {
+    root.set_shard_count(std::max(FLAGS_node_state_shards, 1));
+  }
+  root.set_term(term_);
+  if (!replace(fetched.get(), name, root.SerializePartialAsString())) {
+    LOG(FATAL) << "Could not claim the node states in term " << term_;
+  }
+}
+
+void NodeStateStore::updateNode(const quobyte::NodeState& node) {
+  std::lock_guard<std::mutex> lock(lock_);
+  pending_nodes_[node.hostname()] = node;
+  ++version_;
+  changed_.notify_one();
+}
+
+void NodeStateStore::updateServices(const quobyte::ServiceState& api,
+                                    const quobyte::ServiceState& s3,
+                                    const quobyte::ServiceState& console) {
+  std::lock_guard<std::mutex> lock(lock_);
+  api_ = api;
+  s3_ = s3;
+  console_ = console;
+  services_pending_ = true;
+  ++version_;
+  changed_.notify_one();
+}
+
+void NodeStateStore::erase() {
+  std::lock_guard<std::mutex> lock(lock_);
+  pending_nodes_.clear();
+  services_pending_ = false;
+  erase_pending_ = true;
+  ++version_;
+  changed_.notify_one();
+}
+
+void NodeStateStore::flush() {
+  std::unique_lock<std::mutex> lock(lock_);
+  const uint64_t version = version_;
+  ++flush_waiters_;
+  changed_.notify_one();
+  written_.wait(lock, [this, version] {
+    return written_version_ >= version || !writer_.joinable() || stopping_ ||
+        fenced_;
+  });
+  --flush_waiters_;
+}
+
+NodeStateStore::Stats NodeStateStore::stats() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  Stats stats = stats_;
+  stats.pending = pending_nodes_.size() + (services_pending_ ? 1 : 0);
+  return stats;
+}
+
+void NodeStateStore::writeLoop() {
+  int backoff_ms = 0;
+  bool more = false;
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    changed_.wait(lock, [this] {
+      return stopping_ || version_ != written_version_;
+    });
+    if (version_ == written_version_) {
+      return;
+    }
+    if (!more) {
+      changed_.wait_for(
+          lock, std::chrono::milliseconds(FLAGS_node_journal_interval_ms),
+          [this] { return stopping_ || flush_waiters_ > 0; });
+    }
+    const uint64_t version = version_;
+    if (erase_pending_) {
+      lock.unlock();
+      for (quobyte::NodeStateShard& shard : shards_) {
+        shard.Clear();
+      }
+      image_index_.clear();
+      root_.clear_api();
+      root_.clear_s3();
+      root_.clear_console();
+      dirty_shards_.assign(shards_.size(), true);
+      const bool erased = compact();
+      lock.lock();
+      if (!erased) {
+        // Until the root and the journal are gone, a load() would bring
+        // the nodes back.
+        ++stats_.failures;
+        if (stopping_ || fenced_) {
+          LOG(ERROR) << "Could not erase the node states";
+          written_.notify_all();
+          return;
+        }
+        more = false;
+        backoff_ms = std::min(
+            std::max(2 * backoff_ms, FLAGS_state_retry_backoff_ms),
+            kMaxRetryBackoffMs);
+        changed_.wait_for(lock, std::chrono::milliseconds(backoff_ms),
+                          [this] { return stopping_; });
+        continue;
+      }
+      erase_pending_ = false;
+    }
+    if (version_ == written_version_ || (pending_nodes_.empty() &&
+                                         !services_pending_)) {
+      more = false;
+      written_version_ = version;
+      written_.notify_all();
+      continue;
+    }
+    quobyte::NodeStateJournalBatch batch;
+    auto node = pending_nodes_.begin();
+    while (node != pending_nodes_.end() &&
+           static_cast<size_t>(batch.node_size()) < kMaxBatchNodes) {
+      batch.add_node()->Swap(&node->second);
+      node = pending_nodes_.erase(node);
+    }
+    more = !pending_nodes_.empty();
+    if (services_pending_) {
+      batch.mutable_api()->CopyFrom(api_);
+      batch.mutable_s3()->CopyFrom(s3_);
+      batch.mutable_console()->CopyFrom(console_);
+      services_pending_ = false;
+    }
+    lock.unlock();
+
+    batch.set_sequence(sequence_ + 1);
+    batch.set_term(term_);
+    const int64_t start = MicrosNow();
+    const bool written = writeBatch(batch);
+    if (written) {
+      ++sequence_;
+      apply(batch);
+      if (sequence_ - journal_start_ + 1 >=
+          static_cast<uint64_t>(FLAGS_node_journal_batches)) {
+        compact();
+      }
+    }
+    const int64_t micros = MicrosNow() - start;
+
+    lock.lock();
+    if (written) {
+      backoff_ms = 0;
+      if (!more) {
+        written_version_ = version;
+      }
+      ++stats_.batches;
+      stats_.last_write_micros = micros;
+      write_latency->observe(micros);
+      stats_.max_write_micros = std::max(stats_.max_write_micros, micros);
+      written_.notify_all();
+      continue;
+    }
+    ++stats_.failures;
+    // Updates queued meanwhile are newer than the ones of the batch.
+    for (const quobyte::NodeState& node : batch.node()) {
+      pending_nodes_.emplace(node.hostname(), node);
+    }
+    if (batch.has_api() && !services_pending_) {
+      api_ = batch.api();
+      s3_ = batch.s3();
+      console_ = batch.console();
+      services_pending_ = true;
+    }
+    if (stopping_ || fenced_) {
+      LOG(ERROR) << "Dropping " << pending_nodes_.size()
+          << " unsaved node states";
+      written_.notify_all();
+      return;
+    }
+    more = false;
+    backoff_ms = std::min(
+        std::max(2 * backoff_ms, FLAGS_state_retry_backoff_ms),
+        kMaxRetryBackoffMs);
+    changed_.wait_for(lock, std::chrono::milliseconds(backoff_ms),
+                      [this] { return stopping_; });
+  }
+}
+
+bool NodeStateStore::store(const std::string& name, const std::string& value) {
+  process::Future<mesos::state::Variable> fetched = state_->fetch(name);
+  if (!Await(fetched, name)) {
+    return false;
+  }
+  return replace(fetched.get(), name, value);
+}
+
+bool NodeStateStore::replace(const mesos::state::Variable& variable,
+                             const std::string& name,
+                             const std::string& value) {
+  process::Future<Option<mesos::state::Variable>> stored =
+      state_->store(variable.mutate(value));
+  stored.await();
+  if (!stored.isReady()) {
+    LOG(ERROR) << "Could not store " << name << ": "
+        << (stored.isFailed() ? stored.failure() : "discarded");
+    return false;
+  }
+  if (stored.get().isNone()) {
+    LOG(WARNING) << "Version conflict storing " << name;
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.bytes_written += value.size();
+  stats_.max_variable_bytes =
+      std::max<uint64_t>(stats_.max_variable_bytes, value.size());
+  return true;
+}
+
+bool NodeStateStore::checkTerm(uint64_t term, const std::string& name) {
+  if (!fencing_ || term <= term_) {
+    return true;
+  }
+  LOG(ERROR) << name << " was written in term " << term << ", after ours "
+      << term_ << ". Another scheduler leads, not writing node states";
+  std::lock_guard<std::mutex> lock(lock_);
+  fenced_ = true;
+  written_.notify_all();
+  return false;
+}
+
+bool NodeStateStore::checkRoot(
+    const process::Future<mesos::state::Variable>& fetched) {
+  if (!Await(fetched, path_ + "-root")) {
+    return false;
+  }
+  quobyte::NodeStateRoot root;
+  if (!root.ParsePartialFromString(fetched.get().value())) {
+    LOG(ERROR) << "Could not parse node state root " << path_;
+    return false;
+  }
+  return checkTerm(root.term(), path_ + "-root");
+}
+
+bool NodeStateStore::writeBatch(const quobyte::NodeStateJournalBatch& batch) {
+  const std::string name = journalName(batch.sequence());
+  process::Future<mesos::state::Variable> root;
+  if (fencing_) {
+    root = state_->fetch(path_ + "-root");
+  }
+  process::Future<mesos::state::Variable> fetched = state_->fetch(name);
+  if ((fencing_ && !checkRoot(root)) || !Await(fetched, name)) {
+    return false;
+  }
+  // A batch already there is ours from a store that seemed to fail, or was
+  // left by a replaced leader after we loaded. Both are replaced, a batch
+  // of a later term fences us off.
+  if (fencing_ && !fetched.get().value().empty()) {
+    quobyte::NodeStateJournalBatch written;
+    if (!written.ParsePartialFromString(fetched.get().value())) {
+      LOG(ERROR) << "Could not parse " << name;
+      return false;
+    }
+    if (!checkTerm(written.term(), name)) {
+      return false;
+    }
+  }
+  return replace(fetched.get(), name, batch.SerializePartialAsString());
+}
+
+void NodeStateStore::addNode(const quobyte::NodeState& node) {
+  auto known = image_index_.emplace(node.hostname(),
+                                    std::make_pair(0u, 0));
+  if (known.second) {
+    const uint32_t shard = shardOf(node.hostname());
+    known.first->second =
+        std::make_pair(shard, shards_[shard].node_size());
+    shards_[shard].add_node()->CopyFrom(node);
+    dirty_shards_[shard] = true;
+  } else {
+    const std::pair<uint32_t, int>& position = known.first->second;
+    shards_[position.first].mutable_node(position.second)->CopyFrom(node);
+    dirty_shards_[position.first] = true;
+  }
+}
+
+void NodeStateStore::apply(const quobyte::NodeStateJournalBatch& batch) {
+  for (const quobyte::NodeState& node : batch.node()) {
+    addNode(node);
+  }
+  if (batch.has_api()) {
+    root_.mutable_api()->CopyFrom(batch.api());
+    root_.mutable_s3()->CopyFrom(batch.s3());
+    root_.mutable_console()->CopyFrom(batch.console());
+  }
+}
+
+bool NodeStateStore::compact() {
+  // Written over the root as of now, the write fails if another scheduler
+  // wrote it meanwhile.
+  const std::string root_name = path_ + "-root";
+  process::Future<mesos::state::Variable> root = state_->fetch(root_name);
+  if (fencing_ ? !checkRoot(root) : !Await(root, root_name)) {
+    return false;
+  }
+  // Shards first: until the root moves on, a restart replays the journal
+  // on top of them.
+  uint64_t shards_written = 0;
+  for (uint32_t shard = 0; shard < shards_.size(); ++shard) {
+    if (!dirty_shards_[shard]) {
+      continue;
+    }
+    if (!store(shardName(shard), shards_[shard].SerializePartialAsString())) {
+      // Keeps the journal, the next batch tries again.
+      return false;
+    }
+    dirty_shards_[shard] = false;
+    ++shards_written;
+  }
+  root_.set_sequence(sequence_);
+  root_.set_term(term_);
+  if (!replace(root.get(), root_name, root_.SerializePartialAsString())) {
+    return false;
+  }
+  if (!expungeJournal()) {
+    // The root has moved on, the next batch tries again.
+    return false;
+  }
+  journal_start_ = sequence_ + 1;
+  std::lock_guard<std::mutex> lock(lock_);
+  ++stats_.compactions;
+  stats_.shards_written += shards_written;
+  return true;
+}
+
+bool NodeStateStore::expungeJournal() {
+  std::vector<process::Future<mesos::state::Variable>> fetches;
+  for (uint64_t sequence = journal_start_; sequence <= sequence_; ++sequence) {
+    fetches.push_back(state_->fetch(journalName(sequence)));
+  }
+  bool expunged = true;
+  std::vector<process::Future<bool>> expunges;
+  for (size_t i = 0; i < fetches.size(); ++i) {
+    fetches[i].await();
+    if (!fetches[i].isReady()) {
+      LOG(ERROR) << "Could not fetch " << journalName(journal_start_ + i)
+          << ": " << (fetches[i].isFailed() ? fetches[i].failure()
+                                             : "discarded");
+      expunged = false;
+    } else if (!fetches[i].get().value().empty()) {
+      // Empty if expunged by an earlier attempt.
+      expunges.push_back(state_->expunge(fetches[i].get()));
+    }
+  }
+  for (process::Future<bool>& expunge : expunges) {
+    expunge.await();
+    if (!expunge.isReady()) {
+      LOG(ERROR) << "Could not expunge the node state journal: "
+          << (expunge.isFailed() ? expunge.failure() : "discarded");
+      expunged = false;
+    } else if (!expunge.get()) {
+      LOG(WARNING) << "Version conflict expunging the node state journal";
+      expunged = false;
+    }
+  }
+  return expunged;
+}
@@ -0,0 +1,150 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <mesos/state/state.hpp>
+
+#include "quobyte.pb.h"
+
+// Persists the scheduler's node states, so that a restarted scheduler
+// starts with a warm view of the cluster and only has to confirm it. A
+// writer thread collects updates for --node_journal_interval_ms into a
+// journal batch, one variable per batch.
+//
+// The writer keeps its own image of all nodes, hashed by hostname into
+// shards. Every --node_journal_batches batches it writes the shards that
+// changed, then a small root record with the journal position and the
+// singleton services, and expunges the journal. No variable grows beyond
+// a shard, which keeps them below the ZooKeeper znode size limit.
+//
+// With leader election, the root and the journal batches carry the lease
+// term of the leader that wrote them. A leader that was replaced without
+// noticing stops writing once it sees a later term.
+class NodeStateStore {
+ public:
+  struct Stats {
+    uint64_t batches = 0;
+    uint64_t compactions = 0;
+    uint64_t shards_written = 0;
+    uint64_t bytes_written = 0;
+    uint64_t max_variable_bytes = 0;
+    // Journal batches of another scheduler, read by follow().
+    uint64_t batches_followed = 0;
+    uint64_t failures = 0;
+    // Nodes waiting for the next batch.
+    uint64_t pending = 0;
+    int64_t last_write_micros = 0;
+    int64_t max_write_micros = 0;
+  };
+
+  NodeStateStore(mesos::state::State* state, const std::string& path);
+  // Writes pending updates.
+  ~NodeStateStore();
+
+  // The lease term to write in, before load(). Fences off the leaders of
+  // earlier terms. Without it, the term of the stored state is kept and
+  // not checked.
+  void setTerm(uint64_t term);
+
+  // Reads the root record and all shards in parallel, replays the journal
+  // and starts the writer. After follow(), reads the shards again only if
+  // the root moved on.
+  void load(quobyte::NodeStateSnapshot* snapshot);
+
+  // Keeps the image up to date with the journal of another scheduler,
+  // before load(). Reads the shards again after a compaction.
+  void follow();
+
+  // Queues the current state of a node, later updates of the same node
+  // replace it.
+  void updateNode(const quobyte::NodeState& node);
+  void updateServices(const quobyte::ServiceState& api,
+                      const quobyte::ServiceState& s3,
+                      const quobyte::ServiceState& console);
+
+  // Drops all nodes, with the next write.
+  void erase();
+
+  // Blocks until all updates made so far are written.
+  void flush();
+
+  Stats stats() const;
+
+ private:
+  std::string journalName(uint64_t sequence) const;
+  std::string shardName(uint32_t shard) const;
+  uint32_t shardOf(const std::string& hostname) const;
+
+  bool store(const std::string& name, const std::string& value);
+  // Over the variable as fetched, false if that failed or lost against
+  // another write.
+  bool replace(const mesos::state::Variable& variable,
+               const std::string& name,
+               const std::string& value);
+  // False if a later term wrote name, the writer stops then.
+  bool checkTerm(uint64_t term, const std::string& name);
+  bool checkRoot(const process::Future<mesos::state::Variable>& fetched);
+  void claimRoot();
+  // The image as of the root record, or since the last call the journal
+  // batches on top.
+  void readLatest();
+  void readImage(const std::string& root);
+  void replayJournal();
+  void addNode(const quobyte::NodeState& node);
+  void writeLoop();
+  bool writeBatch(const quobyte::NodeStateJournalBatch& batch);
+  void apply(const quobyte::NodeStateJournalBatch& batch);
+  // False if some write failed.
+  bool compact();
+  // Of the batches up to sequence_, false if some remain.
+  bool expungeJournal();
+
+  mesos::state::State* state_;
+  const std::string path_;
+
+  mutable std::mutex lock_;
+  std::condition_variable changed_;
+  std::condition_variable written_;
+  std::unordered_map<std::string, quobyte::NodeState> pending_nodes_;
+  bool services_pending_ = false;
+  bool erase_pending_ = false;
+  quobyte::ServiceState api_;
+  quobyte::ServiceState s3_;
+  quobyte::ServiceState console_;
+  uint64_t version_ = 0;
+  uint64_t written_version_ = 0;
+  bool stopping_ = false;
+  int flush_waiters_ = 0;
+  // A later leader writes the node states.
+  bool fenced_ = false;
+  Stats stats_;
+
+  // Only used by the writer thread after load().
+  quobyte::NodeStateRoot root_;
+  std::vector<quobyte::NodeStateShard> shards_;
+  std::vector<bool> dirty_shards_;
+  // Shard and position of every node.
+  std::unordered_map<std::string, std::pair<uint32_t, int>> image_index_;
+  uint64_t sequence_ = 0;
+  uint64_t term_ = 0;
+  bool fencing_ = false;
+  // Of the last journal batch applied.
+  uint64_t journal_term_ = 0;
+  // Oldest journal batch not contained in the stored shards.
+  uint64_t journal_start_ = 1;
+
+  std::thread writer_;
+};
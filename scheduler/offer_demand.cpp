@@ -0,0 +1,144 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "offer_demand.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+DEFINE_int32(max_offer_refuse_s, 300,
+             "Longest refuse filter for declined offers");
+DEFINE_int32(suppress_offers_idle_s, 30,
+             "Suppress offers if no node needs one for this long");
+DEFINE_int32(offer_revive_interval_s, 300,
+             "Revive suppressed offers at least every n seconds to "
+             "discover new agents");
+DEFINE_int32(offer_revive_backoff_s, 10,
+             "Minimum time between two revives of unsuppressed offers");
+
+static const int64_t kNever = std::numeric_limits<int64_t>::max();
+
+OfferDemand::OfferDemand(const Clock* clock) : clock_(clock) {}
+
+void OfferDemand::setDue(NodeRegistry::Index node,
+                         int64_t due_s,
+                         int64_t refused_s) {
+  if (node >= due_s_.size()) {
+    due_s_.resize(node + 1, kNever);
+    refused_until_s_.resize(node + 1, 0);
+  }
+  refused_until_s_[node] = refused_s;
+  if (due_s_[node] != due_s) {
+    due_s_[node] = due_s;
+    due_heap_.push(DueEntry(due_s, node));
+  }
+}
+
+int64_t OfferDemand::earliestDue() {
+  while (!due_heap_.empty() &&
+         due_heap_.top().first != due_s_[due_heap_.top().second]) {
+    due_heap_.pop();
+  }
+  return due_heap_.empty() ? kNever : due_heap_.top().first;
+}
+
+mesos::Filters OfferDemand::decline(NodeRegistry::Index node, int64_t due_s) {
+  std::lock_guard<std::mutex> lock(lock_);
+  const int64_t now = clock_->nowSeconds();
+  mesos::Filters filters;
+  if (due_s > now) {
+    filters.set_refuse_seconds(
+        std::min<int64_t>(due_s - now, FLAGS_max_offer_refuse_s));
+  }
+  setDue(node, due_s, now + static_cast<int64_t>(filters.refuse_seconds()));
+  return filters;
+}
+
+void OfferDemand::launched(NodeRegistry::Index node, int64_t due_s) {
+  std::lock_guard<std::mutex> lock(lock_);
+  const int64_t now = clock_->nowSeconds();
+  setDue(node, due_s,
+         now + static_cast<int64_t>(mesos::Filters().refuse_seconds()));
+}
+
+void OfferDemand::update(NodeRegistry::Index node,
+                         int64_t due_s,
+                         mesos::SchedulerDriver* driver) {
+  std::lock_guard<std::mutex> lock(lock_);
+  const int64_t refused_s =
+      node < refused_until_s_.size() ? refused_until_s_[node] : 0;
+  setDue(node, due_s, refused_s);
+
+  const int64_t now = clock_->nowSeconds();
+  if (suppressed_) {
+    wake_s_ = std::min(wake_s_, due_s);
+    if (due_s <= now) {
+      revive(driver, now);
+    }
+  } else if (due_s < refused_s &&
+             refused_s - std::max(due_s, now) >
+                 mesos::Filters().refuse_seconds()) {
+    // The node's filter would delay it noticeably.
+    revive(driver, now);
+  }
+}
+
+void OfferDemand::reviveAll(mesos::SchedulerDriver* driver) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (driver == NULL) {
+    revive_pending_ = true;
+    return;
+  }
+  revive(driver, clock_->nowSeconds());
+}
+
+void OfferDemand::revive(mesos::SchedulerDriver* driver, int64_t now) {
+  if (!suppressed_ && now - last_revive_s_ < FLAGS_offer_revive_backoff_s) {
+    revive_pending_ = true;
+    return;
+  }
+  VLOG(1) << (suppressed_ ? "Reviving suppressed offers" : "Reviving offers");
+  driver->reviveOffers();
+  // Reviving also clears all filters.
+  std::fill(refused_until_s_.begin(), refused_until_s_.end(), 0);
+  suppressed_ = false;
+  revive_pending_ = false;
+  last_revive_s_ = now;
+}
+
+void OfferDemand::maybeSuppress(mesos::SchedulerDriver* driver) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (suppressed_ || revive_pending_) {
+    return;
+  }
+  const int64_t earliest = earliestDue();
+  const int64_t now = clock_->nowSeconds();
+  if (earliest == kNever || earliest - now < FLAGS_suppress_offers_idle_s) {
+    return;
+  }
+  wake_s_ = std::min(earliest, now + FLAGS_offer_revive_interval_s);
+  VLOG(1) << "No offers needed for " << wake_s_ - now << "s, suppressing";
+  driver->suppressOffers();
+  suppressed_ = true;
+}
+
+void OfferDemand::tick(mesos::SchedulerDriver* driver) {
+  std::lock_guard<std::mutex> lock(lock_);
+  const int64_t now = clock_->nowSeconds();
+  if ((suppressed_ && (now >= wake_s_ || revive_pending_)) ||
+      (revive_pending_ &&
+       now - last_revive_s_ >= FLAGS_offer_revive_backoff_s)) {
+    revive(driver, now);
+  }
+}
+
+bool OfferDemand::suppressed() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return suppressed_;
+}
@@ -0,0 +1,76 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include <mesos/mesos.hpp>
+#include <mesos/scheduler.hpp>
+
+#include "clock.hpp"
+#include "node_registry.hpp"
+
+// Tracks when each node next needs an offer (probe due, reconcile due,
+// pending launch) and shapes the offer stream accordingly: declines carry a
+// refuse filter up to that time, offers are suppressed while no node needs
+// one soon, and revived when demand returns earlier than the filters allow.
+//
+// Offer callbacks, status updates, the HTTP thread and the offer timer all
+// use it, so every method takes the internal lock.
+class OfferDemand {
+ public:
+  explicit OfferDemand(const Clock* clock);
+
+  // Records the node's next due time and returns the filters to decline
+  // its offer with. due_s <= now means it needs the next offer.
+  mesos::Filters decline(NodeRegistry::Index node, int64_t due_s);
+  // Records a launch on the node, the remaining resources are refused for
+  // the default filter time.
+  void launched(NodeRegistry::Index node, int64_t due_s);
+
+  // The node's due time moved, e.g. after a lost task or a probe response.
+  // Revives offers if the node would not see one in time.
+  void update(NodeRegistry::Index node, int64_t due_s,
+              mesos::SchedulerDriver* driver);
+  // Demand returned for all nodes, e.g. a new target version. Performed by
+  // the next tick() if no driver is at hand.
+  void reviveAll(mesos::SchedulerDriver* driver);
+
+  // After an offer round: suppresses offers if no node is due soon.
+  void maybeSuppress(mesos::SchedulerDriver* driver);
+  // Called periodically, revives when the earliest due time has come or a
+  // revive was deferred.
+  void tick(mesos::SchedulerDriver* driver);
+
+  bool suppressed() const;
+
+ private:
+  typedef std::pair<int64_t, NodeRegistry::Index> DueEntry;
+
+  void setDue(NodeRegistry::Index node, int64_t due_s, int64_t refused_s);
+  int64_t earliestDue();
+  void revive(mesos::SchedulerDriver* driver, int64_t now);
+
+  const Clock* clock_;
+  mutable std::mutex lock_;
+
+  std::vector<int64_t> due_s_;
+  std::vector<int64_t> refused_until_s_;
+  // Min-heap over due_s_, entries are stale if due_s_ changed since.
+  std::priority_queue<DueEntry, std::vector<DueEntry>,
+                      std::greater<DueEntry> > due_heap_;
+
+  bool suppressed_ = false;
+  bool revive_pending_ = false;
+  int64_t wake_s_ = 0;
+  int64_t last_revive_s_ = 0;
+};
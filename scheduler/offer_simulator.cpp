@@ -0,0 +1,454 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "offer_simulator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iterator>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "scheduler.hpp"
+#include "task_id.hpp"
+
+static const size_t kNoHost = std::numeric_limits<size_t>::max();
+
+static int64_t MicrosNow() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LatencySamples::add(int64_t micros) {
+  samples_.push_back(micros);
+  total_micros_ += micros;
+  sorted_ = false;
+}
+
+void LatencySamples::merge(const LatencySamples& other) {
+  samples_.insert(samples_.end(), other.samples_.begin(),
+                  other.samples_.end());
+  total_micros_ += other.total_micros_;
+  sorted_ = false;
+}
+
+void LatencySamples::clear() {
+  samples_.clear();
+  total_micros_ = 0;
+  sorted_ = true;
+}
+
+int64_t LatencySamples::percentile(double p) const {
+  if (samples_.empty()) {
+    return 0;
+  }
+  if (!sorted_) {
+    std::sort(samples_.begin(), samples_.end());
+    sorted_ = true;
+  }
+  size_t index = static_cast<size_t>(p * (samples_.size() - 1) + 0.5);
+  return samples_[std::min(index, samples_.size() - 1)];
+}
+
+OfferSimulator::OfferSimulator(QuobyteScheduler* scheduler,
+                               SimulatedClock* clock,
+                               const SimulatorConfig& config)
+    : scheduler_(scheduler),
+      clock_(clock),
+      config_(config),
+      agent_resources_(
+          mesos::Resources::parse(config.agent_resources).get()),
+      random_(config.seed) {
+  hosts_.resize(config_.hosts);
+  for (int i = 0; i < config_.hosts; ++i) {
+    char hostname[64];
+    snprintf(hostname, sizeof(hostname), "node%05d.sim", i);
+    SimHost& host = hosts_[i];
+    host.hostname = hostname;
+    host.slave_id.set_value("sim-agent-S" + std::to_string(i));
+    if (i < config_.registry_hosts) {
+      host.devices.push_back(quobyte::REGISTRY);
+    }
+    if (config_.metadata_every > 0 && i % config_.metadata_every == 0) {
+      host.devices.push_back(quobyte::METADATA);
+    }
+    if (config_.data_every > 0 && i % config_.data_every == 0) {
+      host.devices.push_back(quobyte::DATA);
+    }
+    host_by_slave_id_[host.slave_id.value()] = i;
+  }
+}
+
+void OfferSimulator::registerFramework() {
+  mesos::FrameworkID framework_id;
+  framework_id.set_value("sim-framework");
+  mesos::MasterInfo master;
+  master.set_id("sim-master");
+  master.set_ip(0);
+  master.set_port(5050);
+  scheduler_->registered(&driver_, framework_id, master);
+  processDriverCalls();
+  deliverEvents();
+}
+
+void OfferSimulator::failover(QuobyteScheduler* scheduler) {
+  scheduler_ = scheduler;
+  driver_.failover();
+  // The master rescinds the outstanding offers and drops the filters of the
+  // old scheduler.
+  host_by_offer_id_.clear();
+  for (SimHost& host : hosts_) {
+    host.refused_until_s = 0;
+  }
+  registerFramework();
+}
+
+void OfferSimulator::run(int rounds) {
+  const std::clock_t start = std::clock();
+  for (int i = 0; i < rounds; ++i) {
+    step();
+  }
+  cpu_micros_ += static_cast<int64_t>(
+      (std::clock() - start) * (1e6 / CLOCKS_PER_SEC));
+}
+
+void OfferSimulator::step() {
+  sim_time_s_ += config_.offer_interval_s;
+  clock_->advanceSeconds(config_.offer_interval_s);
+  ++rounds_;
+  injectFailures();
+  deliverEvents();
+  scheduler_->tick(&driver_);
+  if (driver_.counters().revives != revives_seen_) {
+    // Like the master, a revive clears all filters of the framework.
+    revives_seen_ = driver_.counters().revives;
+    for (SimHost& host : hosts_) {
+      if (host.refused_until_s != std::numeric_limits<int64_t>::max()) {
+        host.refused_until_s = 0;
+      }
+    }
+  }
+  if (driver_.suppressed()) {
+    return;
+  }
+
+  std::vector<mesos::Offer> batch;
+  for (size_t i = 0; i < hosts_.size(); ++i) {
+    SimHost& host = hosts_[i];
+    if (host.refused_until_s > sim_time_s_) {
+      continue;
+    }
+    const std::vector<mesos::Resources> parts =
+        splitResources(agent_resources_ - host.used);
+    for (const mesos::Resources& part : parts) {
+      mesos::Offer offer;
+      offer.mutable_id()->set_value(
+          "sim-offer-" + std::to_string(next_offer_id_++));
+      offer.mutable_framework_id()->set_value("sim-framework");
+      offer.mutable_slave_id()->CopyFrom(host.slave_id);
+      offer.set_hostname(host.hostname);
+      offer.mutable_resources()->CopyFrom(part);
+      host_by_offer_id_[offer.id().value()] = i;
+      batch.push_back(offer);
+    }
+    // Outstanding offers are not re-offered until they are answered.
+    host.refused_until_s = std::numeric_limits<int64_t>::max();
+
+    if (config_.offers_per_callback > 0 &&
+        batch.size() == static_cast<size_t>(config_.offers_per_callback)) {
+      sendOffers(batch);
+      batch.clear();
+    }
+  }
+  if (!batch.empty()) {
+    sendOffers(batch);
+  }
+}
+
+std::vector<mesos::Resources> OfferSimulator::splitResources(
+    const mesos::Resources& available) const {
+  const int count = std::max(config_.offers_per_agent, 1);
+  std::vector<mesos::Resources> parts(count);
+  for (const mesos::Resource& resource : available) {
+    if (resource.type() != mesos::Value::SCALAR) {
+      parts[0] += resource;
+      continue;
+    }
+    mesos::Resource part = resource;
+    part.mutable_scalar()->set_value(resource.scalar().value() / count);
+    for (mesos::Resources& offer : parts) {
+      offer += part;
+    }
+  }
+  return parts;
+}
+
+void OfferSimulator::sendOffers(const std::vector<mesos::Offer>& offers) {
+  const int64_t start = MicrosNow();
+  scheduler_->resourceOffers(&driver_, offers);
+  offer_latency_.add(MicrosNow() - start);
+  offers_sent_ += offers.size();
+
+  processDriverCalls();
+  deliverEvents();
+}
+
+void OfferSimulator::injectFailures() {
+  if (config_.task_failures_per_hour <= 0 || tasks_.empty()) {
+    return;
+  }
+  std::poisson_distribution<int> failures(
+      tasks_.size() * config_.task_failures_per_hour *
+      config_.offer_interval_s / 3600.0);
+  for (int count = failures(random_); count > 0 && !tasks_.empty(); --count) {
+    std::uniform_int_distribution<size_t> pick(0, tasks_.size() - 1);
+    auto task = std::next(tasks_.begin(), pick(random_));
+    hosts_[task->second.host].used -= task->second.resources;
+    queueStatus(task->first, task->second.host, mesos::TASK_FAILED,
+                "Simulated failure");
+    tasks_.erase(task);
+    ++failures_;
+  }
+}
+
+bool OfferSimulator::hostsStorage(size_t host) const {
+  for (quobyte::DeviceType device : hosts_[host].devices) {
+    if (device == quobyte::DATA || device == quobyte::METADATA) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void OfferSimulator::applyFilters(size_t host, const mesos::Filters& filters) {
+  hosts_[host].refused_until_s =
+      sim_time_s_ + static_cast<int64_t>(filters.refuse_seconds());
+}
+
+void OfferSimulator::queueStatus(const std::string& task_id,
+                                 size_t host,
+                                 mesos::TaskState state,
+                                 const std::string& message) {
+  Event event;
+  event.is_status = true;
+  event.status.mutable_task_id()->set_value(task_id);
+  event.status.set_state(state);
+  if (!message.empty()) {
+    event.status.set_message(message);
+  }
+  if (host != kNoHost) {
+    event.status.mutable_slave_id()->CopyFrom(hosts_[host].slave_id);
+  }
+  events_.push_back(event);
+}
+
+void OfferSimulator::processDriverCalls() {
+  std::vector<RecordingSchedulerDriver::Decline> declines;
+  declines.swap(driver_.declines);
+  for (const auto& decline : declines) {
+    auto offer = host_by_offer_id_.find(decline.offer_id.value());
+    if (offer == host_by_offer_id_.end()) {
+      LOG(ERROR) << "Declined unknown offer " << decline.offer_id.value();
+      continue;
+    }
+    applyFilters(offer->second, decline.filters);
+    host_by_offer_id_.erase(offer);
+  }
+
+  std::vector<RecordingSchedulerDriver::Launch> launches;
+  launches.swap(driver_.launches);
+  if (!launches.empty()) {
+    last_launch_round_ = rounds_;
+  }
+  for (const auto& launch : launches) {
+    for (const mesos::OfferID& offer_id : launch.offer_ids) {
+      auto offer = host_by_offer_id_.find(offer_id.value());
+      if (offer == host_by_offer_id_.end()) {
+        LOG(ERROR) << "Launch on unknown offer " << offer_id.value();
+        continue;
+      }
+      applyFilters(offer->second, launch.filters);
+      host_by_offer_id_.erase(offer);
+    }
+    for (const mesos::TaskInfo& task : launch.tasks) {
+      auto host = host_by_slave_id_.find(task.slave_id().value());
+      if (host == host_by_slave_id_.end()) {
+        LOG(ERROR) << "Launch on unknown agent " << task.slave_id().value();
+        continue;
+      }
+      if (task.has_executor()) {
+        // The prober executor finishes its task right away and stays alive
+        // to answer probe requests.
+        queueStatus(task.task_id().value(), host->second,
+                    mesos::TASK_FINISHED, "");
+        continue;
+      }
+      ServiceType service;
+      std::string hostname;
+      uint32_t incarnation;
+      if (TaskIdTable::parse(task.task_id().value(), &service, &hostname,
+                             &incarnation) &&
+          (service == API_SERVICE || service == S3_SERVICE ||
+           service == WEBCONSOLE_SERVICE) &&
+          hostsStorage(host->second)) {
+        ++singletons_on_storage_;
+      }
+      SimTask& sim_task = tasks_[task.task_id().value()];
+      sim_task.host = host->second;
+      sim_task.state = mesos::TASK_RUNNING;
+      sim_task.resources = task.resources();
+      hosts_[host->second].used += sim_task.resources;
+      queueStatus(task.task_id().value(), host->second,
+                  mesos::TASK_STARTING, "");
+      queueStatus(task.task_id().value(), host->second,
+                  mesos::TASK_RUNNING, "");
+    }
+  }
+
+  std::vector<mesos::TaskID> kills;
+  kills.swap(driver_.kills);
+  for (const mesos::TaskID& task_id : kills) {
+    auto task = tasks_.find(task_id.value());
+    if (task == tasks_.end()) {
+      queueStatus(task_id.value(), kNoHost, mesos::TASK_LOST,
+                  "Attempted to kill an unknown task");
+      continue;
+    }
+    hosts_[task->second.host].used -= task->second.resources;
+    queueStatus(task_id.value(), task->second.host, mesos::TASK_KILLED, "");
+    tasks_.erase(task);
+  }
+
+  std::vector<RecordingSchedulerDriver::Message> messages;
+  messages.swap(driver_.messages);
+  for (const auto& message : messages) {
+    auto host = host_by_slave_id_.find(message.slave_id.value());
+    if (host == host_by_slave_id_.end()) {
+      continue;
+    }
+    quobyte::ProbeResponse response;
+    for (quobyte::DeviceType device : hosts_[host->second].devices) {
+      response.add_device_type(device);
+    }
+    response.set_client_mount_point(config_.client_mount_point);
+
+    Event event;
+    event.is_status = false;
+    event.executor_id = message.executor_id;
+    event.slave_id = message.slave_id;
+    event.data = response.SerializeAsString();
+    events_.push_back(event);
+  }
+
+  if (driver_.reconcile_all) {
+    driver_.reconcile_all = false;
+    for (const auto& task : tasks_) {
+      queueStatus(task.first, task.second.host, task.second.state,
+                  "Reconciliation: Latest task state");
+    }
+  }
+
+  std::vector<mesos::TaskStatus> reconciles;
+  reconciles.swap(driver_.reconciles);
+  for (const mesos::TaskStatus& status : reconciles) {
+    auto task = tasks_.find(status.task_id().value());
+    if (task == tasks_.end()) {
+      queueStatus(status.task_id().value(), kNoHost, mesos::TASK_LOST,
+                  "Reconciliation: Task is unknown");
+    } else {
+      queueStatus(task->first, task->second.host, task->second.state,
+                  "Reconciliation: Latest task state");
+    }
+  }
+}
+
+void OfferSimulator::deliverEvents() {
+  while (!events_.empty()) {
+    Event event = events_.front();
+    events_.pop_front();
+
+    const int64_t start = MicrosNow();
+    if (event.is_status) {
+      scheduler_->statusUpdate(&driver_, event.status);
+      status_latency_.add(MicrosNow() - start);
+    } else {
+      scheduler_->frameworkMessage(
+          &driver_, event.executor_id, event.slave_id, event.data);
+      message_latency_.add(MicrosNow() - start);
+    }
+    processDriverCalls();
+  }
+}
+
+size_t OfferSimulator::running_tasks() const {
+  return tasks_.size();
+}
+
+static void ReportLine(std::ostream& out,
+                       const char* name,
+                       const LatencySamples& samples) {
+  char line[256];
+  const double total_s = samples.total_micros() / 1e6;
+  snprintf(line, sizeof(line),
+           "%-18s %9zu %9lld %9lld %9lld %9lld %10.1f %12.0f\n",
+           name,
+           samples.count(),
+           static_cast<long long>(samples.percentile(0.5)),
+           static_cast<long long>(samples.percentile(0.9)),
+           static_cast<long long>(samples.percentile(0.99)),
+           static_cast<long long>(samples.percentile(1.0)),
+           total_s * 1000,
+           total_s > 0 ? samples.count() / total_s : 0.0);
+  out << line;
+}
+
+void OfferSimulator::report(std::ostream& out) const {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "%-18s %9s %9s %9s %9s %9s %10s %12s\n",
+           "callback", "calls", "p50_us", "p90_us", "p99_us", "max_us",
+           "total_ms", "calls/s");
+  out << line;
+  ReportLine(out, "resourceOffers", offer_latency_);
+  ReportLine(out, "statusUpdate", status_latency_);
+  ReportLine(out, "frameworkMessage", message_latency_);
+
+  const double offer_s = offer_latency_.total_micros() / 1e6;
+  const RecordingSchedulerDriver::Counters& counters = driver_.counters();
+  const double sim_hours = sim_time_s_ / 3600.0;
+  const int64_t callback_micros = offer_latency_.total_micros() +
+      status_latency_.total_micros() + message_latency_.total_micros();
+  out << "hosts " << hosts_.size()
+      << ", rounds " << rounds_
+      << ", simulated " << sim_time_s_ << "s"
+      << ", offers " << offers_sent_
+      << " (" << static_cast<uint64_t>(offer_s > 0 ? offers_sent_ / offer_s : 0)
+      << " offers/s)\n";
+  out << "launch calls " << counters.launch_calls
+      << ", tasks launched " << counters.tasks_launched
+      << " (last in round " << last_launch_round_ << ")"
+      << ", running " << running_tasks()
+      << ", declines " << counters.declines
+      << ", kills " << counters.kills
+      << ", probes " << counters.messages
+      << ", reconciled " << counters.tasks_reconciled
+      << ", revives " << counters.revives
+      << ", suppresses " << counters.suppresses
+      << ", failures " << failures_
+      << ", singletons on storage nodes " << singletons_on_storage_
+      << "\n";
+  if (sim_hours > 0) {
+    out << "per simulated hour: callbacks "
+        << static_cast<int64_t>(callback_micros / 1000 / sim_hours) << "ms"
+        << ", process cpu "
+        << static_cast<int64_t>(cpu_micros_ / 1000 / sim_hours) << "ms"
+        << ", offers " << static_cast<int64_t>(offers_sent_ / sim_hours)
+        << "\n";
+  }
+}
@@ -0,0 +1,159 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <ostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <mesos/resources.hpp>
+#include <mesos/scheduler.hpp>
+
+#include "clock.hpp"
+#include "quobyte.pb.h"
+#include "recording_driver.hpp"
+
+class QuobyteScheduler;
+
+// Collects callback latencies in microseconds and reports percentiles.
+class LatencySamples {
+ public:
+  void add(int64_t micros);
+  void merge(const LatencySamples& other);
+  void clear();
+
+  size_t count() const { return samples_.size(); }
+  int64_t total_micros() const { return total_micros_; }
+  // p in [0, 1]
+  int64_t percentile(double p) const;
+
+ private:
+  mutable std::vector<int64_t> samples_;
+  mutable bool sorted_ = true;
+  int64_t total_micros_ = 0;
+};
+
+struct SimulatorConfig {
+  int hosts = 2000;
+  // Simulated seconds between two allocation rounds of the fake master.
+  int offer_interval_s = 1;
+  // Offers per resourceOffers callback, 0 puts all offers in one callback.
+  int offers_per_callback = 0;
+  // Offers per agent and round. Scalars are split evenly, ports go to the
+  // first offer.
+  int offers_per_agent = 1;
+  // Hosts [0, registry_hosts) carry a registry device.
+  int registry_hosts = 3;
+  // Every n-th host carries a metadata or data device, 0 for none.
+  int metadata_every = 10;
+  int data_every = 1;
+  bool client_mount_point = false;
+  // Fraction of running service tasks that fail per simulated hour.
+  double task_failures_per_hour = 0;
+  uint32_t seed = 42;
+  std::string agent_resources =
+      "cpus:32;mem:262144;disk:4000000;ports:[80-80,8000-9000,21000-22000]";
+};
+
+// Plays the Mesos master and the agents for a QuobyteScheduler. Every
+// allocation round generates offers for all agents that are not filtered,
+// and answers launches, kills, reconciliations and probe requests with
+// synthetic status updates and probe responses. Each scheduler callback is
+// timed. Simulated time only advances between rounds, so hours of cluster
+// life run as fast as the scheduler can process them.
+class OfferSimulator {
+ public:
+  OfferSimulator(QuobyteScheduler* scheduler,
+                 SimulatedClock* clock,
+                 const SimulatorConfig& config);
+
+  void registerFramework();
+  // Replaces the scheduler by a restarted one, which registers with the
+  // same framework id. Agents and their tasks keep running.
+  void failover(QuobyteScheduler* scheduler);
+  // Runs one allocation round and delivers all resulting events.
+  void step();
+  void run(int rounds);
+
+  void report(std::ostream& out) const;
+
+  int64_t sim_time_s() const { return sim_time_s_; }
+  // Process CPU time spent in run() so far.
+  int64_t cpu_micros() const { return cpu_micros_; }
+  size_t running_tasks() const;
+  const RecordingSchedulerDriver& driver() const { return driver_; }
+  const LatencySamples& offer_latency() const { return offer_latency_; }
+  const LatencySamples& status_latency() const { return status_latency_; }
+  const LatencySamples& message_latency() const { return message_latency_; }
+
+ private:
+  struct SimTask {
+    size_t host;
+    mesos::TaskState state;
+    mesos::Resources resources;
+  };
+
+  struct SimHost {
+    std::string hostname;
+    mesos::SlaveID slave_id;
+    std::vector<quobyte::DeviceType> devices;
+    int64_t refused_until_s = 0;
+    mesos::Resources used;
+  };
+
+  struct Event {
+    bool is_status;
+    mesos::TaskStatus status;
+    mesos::ExecutorID executor_id;
+    mesos::SlaveID slave_id;
+    std::string data;
+  };
+
+  std::vector<mesos::Resources> splitResources(
+      const mesos::Resources& available) const;
+  void sendOffers(const std::vector<mesos::Offer>& offers);
+  void processDriverCalls();
+  void deliverEvents();
+  bool hostsStorage(size_t host) const;
+  void applyFilters(size_t host, const mesos::Filters& filters);
+  void injectFailures();
+  void queueStatus(const std::string& task_id, size_t host,
+                   mesos::TaskState state, const std::string& message);
+
+  QuobyteScheduler* scheduler_;
+  SimulatedClock* clock_;
+  const SimulatorConfig config_;
+  RecordingSchedulerDriver driver_;
+  mesos::Resources agent_resources_;
+
+  std::vector<SimHost> hosts_;
+  std::unordered_map<std::string, size_t> host_by_slave_id_;
+  std::unordered_map<std::string, size_t> host_by_offer_id_;
+  std::map<std::string, SimTask> tasks_;
+  std::deque<Event> events_;
+  std::mt19937 random_;
+
+  int64_t sim_time_s_ = 0;
+  uint64_t next_offer_id_ = 0;
+  uint64_t offers_sent_ = 0;
+  uint64_t rounds_ = 0;
+  uint64_t last_launch_round_ = 0;
+  // API, S3 and webconsole tasks placed on data or metadata hosts.
+  uint64_t singletons_on_storage_ = 0;
+  uint64_t failures_ = 0;
+  uint64_t revives_seen_ = 0;
+  int64_t cpu_micros_ = 0;
+
+  LatencySamples offer_latency_;
+  LatencySamples status_latency_;
+  LatencySamples message_latency_;
+};
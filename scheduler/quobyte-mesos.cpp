@@ -4,23 +4,39 @@
  * See LICENSE file for license details.
  */
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <regex>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include <gflags/gflags.h>
 #include <mesos/resources.hpp>
 #include <mesos/scheduler.hpp>
-#include <mesos/state/zookeeper.hpp>
 #include <mesos/state/state.hpp>
 
+#include "async_log.hpp"
+#include "clock.hpp"
 #include "scheduler.hpp"
 #include "http_server.hpp"
+#include "leader_election.hpp"
+#include "state_backend.hpp"
 
 DEFINE_string(master, "",
               "Mesos master host:port or zk://host:port/mesos URL");
 DEFINE_string(zk, "", "Zookeeper host:port");
 DEFINE_string(zk_path, "/quobyte", "Zookeeper persistent state location");
+DEFINE_string(state_backend, "zookeeper",
+              "Where to keep the framework state: zookeeper, leveldb "
+              "(local disk, --state_leveldb_path) or in_memory (for tests)");
+DEFINE_string(state_leveldb_path, "quobyte-mesos-state",
+              "LevelDB directory for --state_backend=leveldb");
 DEFINE_int32(port, 7888, "Scheduler status port and API");
 DEFINE_int32(failover_timeout_s, 24 * 3600, "Mesos framework timeout");
 DEFINE_string(deployment, "default", "Quobyte deployment name");
@@ -32,6 +48,17 @@ DEFINE_string(framework_principal, "*",
               "Mesos framework principal. "
               "Provide secret via environment variable QUOBYTE_MESOS_SECRET");
 DEFINE_bool(reset, false, "Reset all state for this deployment");
+DEFINE_bool(persist_node_state, true,
+            "Persist the node states for a warm restart");
+DEFINE_bool(leader_election, false,
+            "Run as one of several schedulers, the one holding a lease in "
+            "the state store leads and the others follow its state");
+DEFINE_int32(async_log_queue_size, 16384,
+             "Log messages queued for the background writer of the log "
+             "files, more are dropped. 0 writes them on the logging thread");
+DEFINE_int32(leader_lease_ms, 5000,
+             "Leader lease, a follower takes over after not seeing it "
+             "renewed for this long");
 
 using std::placeholders::_1;
 using std::placeholders::_2;
@@ -47,8 +74,6 @@ static bool NotEmpty(const char* flagname, const std::string& value) {
 
 static const bool validate_master =
     gflags::RegisterFlagValidator(&FLAGS_master, &NotEmpty);
-static const bool validate_zk =
-    gflags::RegisterFlagValidator(&FLAGS_zk, &NotEmpty);
 
 static std::string GetHostname() {
   char hostname[1024];
@@ -66,16 +91,101 @@ int main(int argc, char* argv[]) {
   gflags::SetUsageMessage("Quobyte Mesos framework");
   gflags::ParseCommandLineFlags(&argc, &argv, true);
 
-  mesos::state::ZooKeeperStorage storage(
-      FLAGS_zk, Seconds(120), FLAGS_zk_path);
-  mesos::state::State state_storage(&storage);
+  // Keeps log file writes off the driver thread, until main returns.
+  std::unique_ptr<AsyncLogWriter> log_writer;
+  if (FLAGS_async_log_queue_size > 0) {
+    log_writer.reset(new AsyncLogWriter(FLAGS_async_log_queue_size));
+  }
+
+  if (FLAGS_state_backend == "zookeeper" && !NotEmpty("zk", FLAGS_zk)) {
+    return 1;
+  }
+  StateBackendConfig backend;
+  backend.backend = FLAGS_state_backend;
+  backend.zk_servers = FLAGS_zk;
+  backend.zk_path = FLAGS_zk_path;
+  backend.leveldb_path = FLAGS_state_leveldb_path;
+  std::unique_ptr<mesos::state::Storage> storage = CreateStateStorage(backend);
+  LOG_IF(FATAL, !storage) << "Unknown --state_backend " << FLAGS_state_backend;
+  mesos::state::State state_storage(storage.get());
 
   const std::string state_path = "scheduler-" + FLAGS_deployment;
+  NodeStateStore node_store(&state_storage, state_path + "-nodes");
+
+  SystemClock clock;
+  std::unique_ptr<LeaderElection> election;
+  const std::chrono::milliseconds lease_poll_interval(
+      std::max(FLAGS_leader_lease_ms / 10, 1));
+  if (FLAGS_leader_election) {
+    election.reset(new LeaderElection(
+        &state_storage, state_path + "-leader",
+        GetHostname() + ":" + std::to_string(FLAGS_port) + ":" +
+            std::to_string(getpid()),
+        &clock, FLAGS_leader_lease_ms * 1000LL));
+    LOG(INFO) << "Following the leader until its lease expires";
+    // Passes health checks meanwhile, so that Marathon keeps the standby.
+    // A reset only waits for the lease.
+    std::mutex leader_lock;
+    std::string leader;
+    quobyte::HttpServer follower_http(FLAGS_port);
+    if (!FLAGS_reset) {
+      follower_http.Start([&](const std::string& method,
+                              const std::string& path,
+                              const std::string& data) -> std::string {
+        if (method != "GET" || (path != "/v1/health" && path != "/")) {
+          return "";
+        }
+        std::lock_guard<std::mutex> lock(leader_lock);
+        return "OK. Following " + (leader.empty() ? "no leader" : leader);
+      });
+    }
+    while (!election->poll()) {
+      {
+        std::lock_guard<std::mutex> lock(leader_lock);
+        leader = election->leader();
+      }
+      if (FLAGS_persist_node_state && !FLAGS_reset) {
+        node_store.follow();
+      }
+      std::this_thread::sleep_for(lease_poll_interval);
+    }
+    follower_http.Stop();
+    node_store.setTerm(election->term());
+  }
+
+  // Renews the lease from here on, loading the state may take longer than
+  // the lease. A leader that lost its lease exits, the new leader has taken
+  // over.
+  std::atomic<bool> running(true);
+  std::thread lease_keeper;
+  if (election) {
+    lease_keeper = std::thread([&]() {
+      while (running.load()) {
+        std::this_thread::sleep_for(lease_poll_interval);
+        LOG_IF(FATAL, !election->poll())
+            << "Lost the lease to " << election->leader();
+      }
+    });
+  }
+
   SchedulerStateProxy state_proxy(&state_storage, state_path);
+  if (election) {
+    state_proxy.setTerm(election->term());
+  }
 
   if (FLAGS_reset) {
     LOG(INFO) << "Erased state for deployment " << FLAGS_deployment;
     state_proxy.erase();
+    quobyte::NodeStateSnapshot ignored;
+    node_store.load(&ignored);
+    node_store.erase();
+    state_proxy.flush();
+    node_store.flush();
+    running.store(false);
+    if (lease_keeper.joinable()) {
+      lease_keeper.join();
+      election->release();
+    }
     return 0;
   }
 
@@ -103,9 +213,12 @@ int main(int argc, char* argv[]) {
   }
   framework.set_checkpoint(true);
 
-  QuobyteScheduler dfsScheduler(&state_proxy, &framework);
+  QuobyteScheduler dfsScheduler(
+      &state_proxy, FLAGS_persist_node_state ? &node_store : NULL,
+      &framework, &clock);
 
   quobyte::HttpServer http(FLAGS_port);
+  dfsScheduler.registerHttpHandlers(&http);
   http.Start(std::bind(&QuobyteScheduler::handleHTTP, &dfsScheduler,_1, _2, _3));
   LOG(INFO) << "Started http://" << GetHostname() << ":" << FLAGS_port;
 
@@ -127,12 +240,33 @@ int main(int argc, char* argv[]) {
             &dfsScheduler, framework, FLAGS_master));
   }
 
+  // Revives offers after they were suppressed or filtered.
+  std::thread offer_timer([&]() {
+    while (running.load()) {
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+      dfsScheduler.tick(schedulerDriver.get());
+    }
+  });
+
   const int status = schedulerDriver->run() == mesos::DRIVER_STOPPED ? 0 : 1;
 
+  running.store(false);
+  offer_timer.join();
+  if (lease_keeper.joinable()) {
+    lease_keeper.join();
+  }
+
   // Ensure that the driver process terminates.
   schedulerDriver->stop();
 
   http.Stop();
 
+  // Hands over to a follower once the state is written.
+  state_proxy.flush();
+  node_store.flush();
+  if (election) {
+    election->release();
+  }
+
   return status;
 }
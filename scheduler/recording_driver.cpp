@@ -0,0 +1,126 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "recording_driver.hpp"
+
+mesos::Status RecordingSchedulerDriver::start() {
+  return mesos::DRIVER_RUNNING;
+}
+
+mesos::Status RecordingSchedulerDriver::stop(bool failover) {
+  return mesos::DRIVER_STOPPED;
+}
+
+mesos::Status RecordingSchedulerDriver::abort() {
+  return mesos::DRIVER_ABORTED;
+}
+
+mesos::Status RecordingSchedulerDriver::join() {
+  return mesos::DRIVER_STOPPED;
+}
+
+mesos::Status RecordingSchedulerDriver::run() {
+  return mesos::DRIVER_STOPPED;
+}
+
+mesos::Status RecordingSchedulerDriver::requestResources(
+    const std::vector<mesos::Request>& requests) {
+  return mesos::DRIVER_RUNNING;
+}
+
+mesos::Status RecordingSchedulerDriver::launchTasks(
+    const std::vector<mesos::OfferID>& offerIds,
+    const std::vector<mesos::TaskInfo>& tasks,
+    const mesos::Filters& filters) {
+  Launch launch;
+  launch.offer_ids = offerIds;
+  launch.tasks = tasks;
+  launch.filters = filters;
+  launches.push_back(launch);
+  ++counters_.launch_calls;
+  counters_.tasks_launched += tasks.size();
+  return mesos::DRIVER_RUNNING;
+}
+
+mesos::Status RecordingSchedulerDriver::launchTasks(
+    const mesos::OfferID& offerId,
+    const std::vector<mesos::TaskInfo>& tasks,
+    const mesos::Filters& filters) {
+  return launchTasks(std::vector<mesos::OfferID>({offerId}), tasks, filters);
+}
+
+mesos::Status RecordingSchedulerDriver::killTask(const mesos::TaskID& taskId) {
+  kills.push_back(taskId);
+  ++counters_.kills;
+  return mesos::DRIVER_RUNNING;
+}
+
+mesos::Status RecordingSchedulerDriver::acceptOffers(
+    const std::vector<mesos::OfferID>& offerIds,
+    const std::vector<mesos::Offer::Operation>& operations,
+    const mesos::Filters& filters) {
+  std::vector<mesos::TaskInfo> tasks;
+  for (const mesos::Offer::Operation& operation : operations) {
+    if (operation.type() == mesos::Offer::Operation::LAUNCH) {
+      tasks.insert(tasks.end(),
+                   operation.launch().task_infos().begin(),
+                   operation.launch().task_infos().end());
+    }
+  }
+  return launchTasks(offerIds, tasks, filters);
+}
+
+mesos::Status RecordingSchedulerDriver::declineOffer(
+    const mesos::OfferID& offerId,
+    const mesos::Filters& filters) {
+  Decline decline;
+  decline.offer_id = offerId;
+  decline.filters = filters;
+  declines.push_back(decline);
+  ++counters_.declines;
+  return mesos::DRIVER_RUNNING;
+}
+
+mesos::Status RecordingSchedulerDriver::reviveOffers() {
+  suppressed_ = false;
+  ++counters_.revives;
+  return mesos::DRIVER_RUNNING;
+}
+
+mesos::Status RecordingSchedulerDriver::suppressOffers() {
+  suppressed_ = true;
+  ++counters_.suppresses;
+  return mesos::DRIVER_RUNNING;
+}
+
+mesos::Status RecordingSchedulerDriver::acknowledgeStatusUpdate(
+    const mesos::TaskStatus& status) {
+  return mesos::DRIVER_RUNNING;
+}
+
+mesos::Status RecordingSchedulerDriver::sendFrameworkMessage(
+    const mesos::ExecutorID& executorId,
+    const mesos::SlaveID& slaveId,
+    const std::string& data) {
+  Message message;
+  message.executor_id = executorId;
+  message.slave_id = slaveId;
+  message.data = data;
+  messages.push_back(message);
+  ++counters_.messages;
+  return mesos::DRIVER_RUNNING;
+}
+
+mesos::Status RecordingSchedulerDriver::reconcileTasks(
+    const std::vector<mesos::TaskStatus>& statuses) {
+  reconciles.insert(reconciles.end(), statuses.begin(), statuses.end());
+  if (statuses.empty()) {
+    reconcile_all = true;
+  }
+  ++counters_.reconcile_calls;
+  counters_.tasks_reconciled += statuses.size();
+  return mesos::DRIVER_RUNNING;
+}
@@ -0,0 +1,113 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <mesos/scheduler.hpp>
+
+// Stand-in for the Mesos scheduler driver that records every call made by
+// the scheduler instead of talking to a master. Used by the offer simulator.
+class RecordingSchedulerDriver : public mesos::SchedulerDriver {
+ public:
+  struct Launch {
+    std::vector<mesos::OfferID> offer_ids;
+    std::vector<mesos::TaskInfo> tasks;
+    mesos::Filters filters;
+  };
+
+  struct Decline {
+    mesos::OfferID offer_id;
+    mesos::Filters filters;
+  };
+
+  struct Message {
+    mesos::ExecutorID executor_id;
+    mesos::SlaveID slave_id;
+    std::string data;
+  };
+
+  struct Counters {
+    uint64_t launch_calls = 0;
+    uint64_t tasks_launched = 0;
+    uint64_t declines = 0;
+    uint64_t kills = 0;
+    uint64_t messages = 0;
+    uint64_t reconcile_calls = 0;
+    uint64_t tasks_reconciled = 0;
+    uint64_t revives = 0;
+    uint64_t suppresses = 0;
+  };
+
+  RecordingSchedulerDriver() {}
+  virtual ~RecordingSchedulerDriver() {}
+
+  virtual mesos::Status start() override;
+  virtual mesos::Status stop(bool failover = false) override;
+  virtual mesos::Status abort() override;
+  virtual mesos::Status join() override;
+  virtual mesos::Status run() override;
+
+  virtual mesos::Status requestResources(
+      const std::vector<mesos::Request>& requests) override;
+
+  virtual mesos::Status launchTasks(
+      const std::vector<mesos::OfferID>& offerIds,
+      const std::vector<mesos::TaskInfo>& tasks,
+      const mesos::Filters& filters = mesos::Filters()) override;
+
+  virtual mesos::Status launchTasks(
+      const mesos::OfferID& offerId,
+      const std::vector<mesos::TaskInfo>& tasks,
+      const mesos::Filters& filters = mesos::Filters()) override;
+
+  virtual mesos::Status killTask(const mesos::TaskID& taskId) override;
+
+  virtual mesos::Status acceptOffers(
+      const std::vector<mesos::OfferID>& offerIds,
+      const std::vector<mesos::Offer::Operation>& operations,
+      const mesos::Filters& filters = mesos::Filters()) override;
+
+  virtual mesos::Status declineOffer(
+      const mesos::OfferID& offerId,
+      const mesos::Filters& filters = mesos::Filters()) override;
+
+  virtual mesos::Status reviveOffers() override;
+  virtual mesos::Status suppressOffers() override;
+
+  virtual mesos::Status acknowledgeStatusUpdate(
+      const mesos::TaskStatus& status) override;
+
+  virtual mesos::Status sendFrameworkMessage(
+      const mesos::ExecutorID& executorId,
+      const mesos::SlaveID& slaveId,
+      const std::string& data) override;
+
+  virtual mesos::Status reconcileTasks(
+      const std::vector<mesos::TaskStatus>& statuses) override;
+
+  // Pending calls, drained by the consumer.
+  std::vector<Launch> launches;
+  std::vector<Decline> declines;
+  std::vector<mesos::TaskID> kills;
+  std::vector<Message> messages;
+  std::vector<mesos::TaskStatus> reconciles;
+  // An implicit reconciliation of all tasks was requested.
+  bool reconcile_all = false;
+
+  const Counters& counters() const { return counters_; }
+  bool suppressed() const { return suppressed_; }
+
+  // A restarted scheduler uses a new driver, offers are not suppressed.
+  void failover() { suppressed_ = false; }
+
+ private:
+  Counters counters_;
+  bool suppressed_ = false;
+};
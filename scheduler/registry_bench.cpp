@@ -0,0 +1,118 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "benchmarks.hpp"
+#include "node_registry.hpp"
+#include "quobyte.pb.h"
+#include "task_id.hpp"
+
+DEFINE_int32(registry_lookups, 1000000,
+             "Lookups per case in the registry benchmark");
+
+static int64_t NanosNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs fn for --registry_lookups iterations and prints ns per lookup.
+static void Measure(const char* name, const std::function<size_t(int)>& fn) {
+  size_t found = 0;
+  const int64_t start = NanosNow();
+  for (int i = 0; i < FLAGS_registry_lookups; ++i) {
+    found += fn(i);
+  }
+  const int64_t elapsed = NanosNow() - start;
+  printf("%-40s %10.1f ns/lookup (%zu hits)\n",
+         name, static_cast<double>(elapsed) / FLAGS_registry_lookups, found);
+}
+
+// Compares the node lookups of the scheduler callbacks with the previous
+// std::map<hostname, NodeState> plus linear agent id scan.
+int RunRegistryBenchmark() {
+  const int hosts = FLAGS_hosts;
+  std::vector<std::string> hostnames;
+  std::vector<std::string> agent_ids;
+  std::vector<std::string> task_ids;
+  std::vector<std::string> legacy_task_ids;
+  for (int i = 0; i < hosts; ++i) {
+    char hostname[64];
+    snprintf(hostname, sizeof(hostname), "node%05d.bench", i);
+    hostnames.push_back(hostname);
+    agent_ids.push_back("bench-agent-S" + std::to_string(i));
+    task_ids.push_back(TaskIdTable::encode(DATA_SERVICE, hostname, 1));
+    legacy_task_ids.push_back(TaskIdTable::encode(DATA_SERVICE, hostname, 0));
+  }
+
+  std::map<std::string, quobyte::NodeState> map_nodes;
+  NodeRegistry registry;
+  TaskIdTable task_id_table;
+  for (int i = 0; i < hosts; ++i) {
+    quobyte::NodeState node;
+    node.set_hostname(hostnames[i]);
+    node.set_slave_id_value(agent_ids[i]);
+    map_nodes.insert(std::make_pair(hostnames[i], node));
+
+    NodeRegistry::Index index = registry.add(hostnames[i], agent_ids[i]);
+    task_id_table.add(DATA_SERVICE, index, hostnames[i], 1);
+  }
+  printf("%d nodes, %d lookups per case\n", hosts, FLAGS_registry_lookups);
+
+  Measure("map: hostname", [&](int i) {
+    return map_nodes.count(hostnames[i % hosts]);
+  });
+  Measure("registry: hostname", [&](int i) {
+    return registry.findByHostname(hostnames[i % hosts]) !=
+        NodeRegistry::kNotFound ? 1 : 0;
+  });
+
+  // frameworkMessage used to scan all nodes for the agent id.
+  const int scan_lookups = std::max(1, FLAGS_registry_lookups / hosts);
+  size_t found = 0;
+  int64_t start = NanosNow();
+  for (int i = 0; i < scan_lookups; ++i) {
+    const std::string& agent_id = agent_ids[(i * 7919) % hosts];
+    for (const auto& node : map_nodes) {
+      if (node.second.slave_id_value() == agent_id) {
+        ++found;
+      }
+    }
+  }
+  printf("%-40s %10.1f ns/lookup (%zu hits)\n",
+         "map: agent id (linear scan)",
+         static_cast<double>(NanosNow() - start) / scan_lookups, found);
+  Measure("registry: agent id", [&](int i) {
+    return registry.findByAgentId(agent_ids[i % hosts]) !=
+        NodeRegistry::kNotFound ? 1 : 0;
+  });
+
+  // statusUpdate used to cut the hostname out of the task id.
+  Measure("map: task id (rfind + substr + find)", [&](int i) {
+    const std::string& task_id = legacy_task_ids[i % hosts];
+    const size_t pos = task_id.rfind("-");
+    const std::string service = task_id.substr(0, pos);
+    const std::string hostname = task_id.substr(pos + 1);
+    return map_nodes.count(hostname);
+  });
+  Measure("task id table: task id", [&](int i) {
+    return task_id_table.find(task_ids[i % hosts]) != NULL ? 1 : 0;
+  });
+  Measure("task id table: parse", [&](int i) {
+    ServiceType service;
+    std::string hostname;
+    uint32_t incarnation;
+    return TaskIdTable::parse(
+        task_ids[i % hosts], &service, &hostname, &incarnation) ? 1 : 0;
+  });
+  return 0;
+}
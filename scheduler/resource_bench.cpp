@@ -0,0 +1,96 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <mesos/resources.hpp>
+
+#include "benchmarks.hpp"
+#include "resource_vector.hpp"
+
+DEFINE_int32(resource_offers, 100000,
+             "Offers per case in the resources benchmark");
+
+static int64_t NanosNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Fit checks of one offer for a node with registry, metadata and data
+// devices, as in resourceOffers: convert the offer, check all eight
+// services, take the three core services.
+int RunResourceBenchmark() {
+  const std::vector<std::string> demand_strings = {
+    "cpus:0.1;mem:256;disk:150",
+    "cpus:1.0;mem:2084;disk:32;ports:[21000-21000,21001-21001]",
+    "cpus:2.0;mem:8192;disk:32;ports:[21002-21002,21003-21003]",
+    "cpus:4.0;mem:4096;disk:32;ports:[21004-21004,21005-21005]",
+    "cpus:0.1;mem:512;disk:32;ports:[21006-21006,21007-21007,8889-8889]",
+    "cpus:1.0;mem:512;disk:32;ports:[21010-21010,21011-21011,80-80]",
+    "cpus:0.5;mem:512;disk:32;ports:[21008-21008,21009-21009,8888-8888]",
+    "cpus:2.0;mem:2048;disk:150",
+  };
+  const char* kRole = "public";
+
+  std::vector<mesos::Resources> demands;
+  std::vector<ResourceVector> demand_vectors;
+  ResourceLayout layout;
+  for (const std::string& demand : demand_strings) {
+    demands.push_back(mesos::Resources::parse(demand).get());
+    demand_vectors.push_back(layout.addDemand(demands.back()));
+  }
+
+  mesos::Offer offer;
+  offer.mutable_resources()->CopyFrom(
+      mesos::Resources::parse(
+          "cpus:32;mem:262144;disk:4000000;"
+          "ports:[80-80,8000-9000,21000-22000]").get());
+
+  const int offers = FLAGS_resource_offers;
+  size_t fits = 0;
+  int64_t start = NanosNow();
+  for (int i = 0; i < offers; ++i) {
+    mesos::Resources remaining = offer.resources();
+    for (size_t d = 0; d < demands.size(); ++d) {
+      if (remaining.contains(demands[d])) {
+        ++fits;
+        if (d >= 1 && d <= 3) {
+          remaining -= demands[d];
+        }
+      }
+      if (d >= 4 && d <= 6 && remaining.reserved(kRole).size() > 0) {
+        ++fits;
+      }
+    }
+  }
+  const int64_t resources_nanos = NanosNow() - start;
+  printf("%-40s %10.1f ns/offer (%zu fits)\n", "mesos::Resources",
+         static_cast<double>(resources_nanos) / offers, fits);
+
+  fits = 0;
+  start = NanosNow();
+  for (int i = 0; i < offers; ++i) {
+    ResourceVector remaining = layout.fromOffer(offer.resources(), kRole);
+    for (size_t d = 0; d < demand_vectors.size(); ++d) {
+      if (remaining.contains(demand_vectors[d])) {
+        ++fits;
+        if (d >= 1 && d <= 3) {
+          remaining -= demand_vectors[d];
+        }
+      }
+      if (d >= 4 && d <= 6 && remaining.role_reserved) {
+        ++fits;
+      }
+    }
+  }
+  const int64_t vector_nanos = NanosNow() - start;
+  printf("%-40s %10.1f ns/offer (%zu fits)\n", "ResourceVector",
+         static_cast<double>(vector_nanos) / offers, fits);
+  return 0;
+}
@@ -0,0 +1,94 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "resource_vector.hpp"
+
+#include <cmath>
+
+#include <glog/logging.h>
+
+const size_t ResourceLayout::kMaxPorts;
+
+static int64_t Fixed(double value) {
+  return std::llround(value * 1000);
+}
+
+// Only these match the unreserved demands of the services.
+static bool IsPlain(const mesos::Resource& resource) {
+  return resource.role() == "*" &&
+      !resource.has_disk() &&
+      !resource.has_revocable();
+}
+
+static void AddScalar(const mesos::Resource& resource, ResourceVector* vector) {
+  if (resource.name() == "cpus") {
+    vector->cpus += Fixed(resource.scalar().value());
+  } else if (resource.name() == "mem") {
+    vector->mem += Fixed(resource.scalar().value());
+  } else if (resource.name() == "disk") {
+    vector->disk += Fixed(resource.scalar().value());
+  }
+}
+
+int ResourceLayout::portBit(uint64_t port) const {
+  for (size_t i = 0; i < ports_.size(); ++i) {
+    if (ports_[i] == port) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+ResourceVector ResourceLayout::addDemand(const mesos::Resources& resources) {
+  ResourceVector demand;
+  for (const mesos::Resource& resource : resources) {
+    if (resource.type() == mesos::Value::SCALAR) {
+      AddScalar(resource, &demand);
+    } else if (resource.name() == "ports" &&
+               resource.type() == mesos::Value::RANGES) {
+      for (const mesos::Value::Range& range : resource.ranges().range()) {
+        for (uint64_t port = range.begin(); port <= range.end(); ++port) {
+          int bit = portBit(port);
+          if (bit == -1) {
+            LOG_IF(FATAL, ports_.size() == kMaxPorts)
+                << "More than " << kMaxPorts << " service ports";
+            bit = ports_.size();
+            ports_.push_back(port);
+          }
+          demand.ports |= 1ULL << bit;
+        }
+      }
+    }
+  }
+  return demand;
+}
+
+ResourceVector ResourceLayout::fromOffer(
+    const google::protobuf::RepeatedPtrField<mesos::Resource>& resources,
+    const std::string& reserved_role) const {
+  ResourceVector offered;
+  for (const mesos::Resource& resource : resources) {
+    if (resource.role() != "*" && resource.role() == reserved_role) {
+      offered.role_reserved = true;
+    }
+    if (!IsPlain(resource)) {
+      continue;
+    }
+    if (resource.type() == mesos::Value::SCALAR) {
+      AddScalar(resource, &offered);
+    } else if (resource.name() == "ports" &&
+               resource.type() == mesos::Value::RANGES) {
+      for (const mesos::Value::Range& range : resource.ranges().range()) {
+        for (size_t i = 0; i < ports_.size(); ++i) {
+          if (ports_[i] >= range.begin() && ports_[i] <= range.end()) {
+            offered.ports |= 1ULL << i;
+          }
+        }
+      }
+    }
+  }
+  return offered;
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/repeated_field.h>
+#include <mesos/mesos.hpp>
+#include <mesos/resources.hpp>
+
+// Unreserved cpus, mem and disk in thousandths (Mesos' own fixed point
+// precision) and the free ports of interest as a bitmap. Fit checks against
+// an offer are a few integer comparisons instead of mesos::Resources
+// arithmetic.
+struct ResourceVector {
+  int64_t cpus = 0;
+  int64_t mem = 0;
+  int64_t disk = 0;
+  uint64_t ports = 0;
+  // Offer carries resources reserved for the role given to
+  // ResourceLayout::fromOffer().
+  bool role_reserved = false;
+
+  bool contains(const ResourceVector& demand) const {
+    return cpus >= demand.cpus &&
+        mem >= demand.mem &&
+        disk >= demand.disk &&
+        (ports & demand.ports) == demand.ports;
+  }
+
+  // Merges another offer of the same agent.
+  ResourceVector& operator+=(const ResourceVector& offered) {
+    cpus += offered.cpus;
+    mem += offered.mem;
+    disk += offered.disk;
+    ports |= offered.ports;
+    role_reserved = role_reserved || offered.role_reserved;
+    return *this;
+  }
+
+  ResourceVector& operator-=(const ResourceVector& demand) {
+    cpus -= demand.cpus;
+    mem -= demand.mem;
+    disk -= demand.disk;
+    ports &= ~demand.ports;
+    return *this;
+  }
+};
+
+// Maps the ports the services ask for to bits of ResourceVector::ports.
+// All demands have to be added before offers are converted.
+class ResourceLayout {
+ public:
+  static const size_t kMaxPorts = 64;
+
+  // Interns the demand's ports.
+  ResourceVector addDemand(const mesos::Resources& resources);
+
+  ResourceVector fromOffer(
+      const google::protobuf::RepeatedPtrField<mesos::Resource>& resources,
+      const std::string& reserved_role) const;
+
+ private:
+  int portBit(uint64_t port) const;
+
+  std::vector<uint64_t> ports_;
+};
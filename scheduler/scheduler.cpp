@@ -8,13 +8,18 @@
 
 #include <string>
 #include <cstdint>
-#include <chrono>
-#include <google/protobuf/text_format.h>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory>
+#include <unordered_map>
 #include <gflags/gflags.h>
 
 #include <mesos/resources.hpp>
 #include <mesos/scheduler.hpp>
 
+#include "cluster_api.hpp"
+
 // Bridge networking does not work reliably as UDP communication does
 // not go through well.
 // #define BRIDGE_NETWORKING
@@ -28,8 +33,6 @@ const std::string S3_TASK = "s3";
 const std::string WEBCONSOLE_TASK = "webconsole";
 const std::string CLIENT_TASK = "client";
 
-const uint32_t kBufferSize = 100*1024*1024;
-
 DEFINE_int32(probe_interval_s, 120,
              "Device probe interval");
 DEFINE_int32(probe_executor_keepalive_interval_s, 60,
@@ -92,18 +95,28 @@ DEFINE_bool(autodetect_service_ip, true,
             "Auto-detect service IP");
 DEFINE_string(client_mount_point, "",
               "If this directory exists on the host, schedule a client");
+DEFINE_int32(event_log_size, 10000,
+             "Recent state changes kept for watchers of /v1/events");
+DEFINE_int32(decision_trace_size, 100000,
+             "Recent scheduling decisions kept for /v1/decisions");
+DEFINE_int32(decision_log_every_n, 1000,
+             "Log only every nth occurrence of a reason to decline offers, "
+             "/v1/decisions has all of them");
+DECLARE_int32(max_offer_refuse_s);
 
 static const char* kExecutorId = "quobyte-mesos-prober-";
 static const char* kArchiveUrl = "/executor.tar.gz";
+static const char* kArchivePath = "executor/executor.tar.gz";
 static const char* kVersionAPIUrl = "/v1/version";
 static const char* kHealthUrl = "/v1/health";
+static const char* kNodesApiUrl = "/v1/nodes";
+static const char* kServicesApiUrl = "/v1/services";
+static const char* kMetricsUrl = "/metrics";
+static const char* kEventsUrl = "/v1/events";
+static const char* kTaskLatencyUrl = "/v1/task_latency";
+static const char* kDecisionsUrl = "/v1/decisions";
 static const char* kDockerImageVersion = "docker_image_version";
 
-static int64_t now() {
-  std::chrono::steady_clock::time_point p = std::chrono::steady_clock::now();
-  return std::chrono::duration_cast<std::chrono::seconds>(p.time_since_epoch()).count();
-}
-
 static bool IsTerminal(mesos::TaskState state) {
   switch (state) {
     case mesos::TASK_STAGING:
@@ -136,8 +149,9 @@ static bool DoStartService(
     const quobyte::NodeState& node,
     quobyte::ServiceState_TaskState state) {
   if (!node.device_types_valid()) {
-    LOG(INFO) << "Not scheduling services on "
-        << node.hostname() << ", waiting for devices";
+    LOG_EVERY_N(INFO, FLAGS_decision_log_every_n)
+        << "Not scheduling services on " << node.hostname()
+        << ", waiting for devices";
     return false;
   }
 
@@ -156,8 +170,9 @@ static bool DoStartService(
       && service_type != REGISTRY_TASK
       && service_type != METADATA_TASK
       && service_type != DATA_TASK) {
-    LOG(INFO) << "Not scheduling non-core service on "
-        << node.hostname() << ", waiting for devices";
+    LOG_EVERY_N(INFO, FLAGS_decision_log_every_n)
+        << "Not scheduling non-core service on " << node.hostname()
+        << ", waiting for devices";
     return false;
   }
   return ShouldServiceBeStarted(state);
@@ -165,12 +180,12 @@ static bool DoStartService(
 
 static void KillServiceIfRunning(
     mesos::SchedulerDriver* driver,
-    const std::string& task_id_value,
     const quobyte::ServiceState& service) {
-  if (service.state() == quobyte::ServiceState::RUNNING) {
-    LOG(INFO) << "Shutting down " << task_id_value;
+  if (service.state() == quobyte::ServiceState::RUNNING &&
+      !service.task_id().empty()) {
+    LOG(INFO) << "Shutting down " << service.task_id();
     mesos::TaskID task_id;
-    task_id.set_value(task_id_value);
+    task_id.set_value(service.task_id());
     driver->killTask(task_id);
   }
 }
@@ -231,9 +246,10 @@ static int32_t memMbFromResourceString(const std::string& resource_string) {
 }
 
 
-static std::string constructDockerExecuteCommand(
+// The docker command is <prefix><host part><suffix>, only the host part
+// differs between launches of the same service and version.
+static std::string constructDockerExecutePrefix(
     const std::string& service_name,
-    const std::string& host_name,
     size_t rpcPort, size_t httpPort) {
   std::ostringstream rcs;
   LOG_IF(FATAL, FLAGS_registry_dns_name.empty())
@@ -297,13 +313,22 @@ static std::string constructDockerExecuteCommand(
         << memMbFromResourceString(FLAGS_webconsole_resources)
         << "m";
   }
+  return rcs.str();
+}
 
+static std::string constructDockerExecuteHostPart(
+    const std::string& host_name) {
   // If Mesos slaves are not configured correctly, host_name might contain an IP.
-  rcs << " && export DIG_LOOKUP=$(dig +short " + host_name + ")";
+  std::string result = " && export DIG_LOOKUP=$(dig +short " + host_name + ")";
 
   if (!FLAGS_autodetect_service_ip) {
-    rcs << " && export HOST_IP=${DIG_LOOKUP:-" + host_name + "}";
+    result += " && export HOST_IP=${DIG_LOOKUP:-" + host_name + "}";
   }
+  return result;
+}
+
+static std::string constructDockerExecuteSuffix() {
+  std::ostringstream rcs;
   if (!FLAGS_extra_service_config.empty()) {
     rcs << " && export QUOBYTE_EXTRA_SERVICE_CONFIG="
         << FLAGS_extra_service_config;
@@ -316,9 +341,6 @@ static std::string constructDockerExecuteCommand(
     rcs << " && export QUOBYTE_ENABLE_ASSERTIONS=true";
   }
   rcs << " && /opt/main.sh";
-
-  VLOG(1) << "Constructed docker command: " << rcs.str() << "\n";
-
   return rcs.str();
 }
 
@@ -390,93 +412,141 @@ static mesos::TaskInfo createClientTaskInfo() {
 }
 
 
-SchedulerStateProxy::SchedulerStateProxy(
-    mesos::state::State* state,
-    const std::string& path) : state_(state), path_(path) {
-  std::string textformat = state_->fetch(path_).get().value();
-  google::protobuf::TextFormat::Parser p;
-  if (!p.ParseFromString(textformat, &data_)) {
-    LOG(FATAL) << "Could not parse " << textformat;
-  }
-  LOG(INFO) << "Initial framework state: " << data_.ShortDebugString();
+static int CountRunning(const quobyte::NodeState& node) {
+  return (node.registry().state() == quobyte::ServiceState::RUNNING) +
+      (node.metadata().state() == quobyte::ServiceState::RUNNING) +
+      (node.data().state() == quobyte::ServiceState::RUNNING);
 }
 
-std::string SchedulerStateProxy::framework_id() {
-  return data_.framework_id_value();
+static int CountRunning(const ClusterSnapshot& snapshot) {
+  return (snapshot.api.state() == quobyte::ServiceState::RUNNING) +
+      (snapshot.s3.state() == quobyte::ServiceState::RUNNING) +
+      (snapshot.console.state() == quobyte::ServiceState::RUNNING);
 }
 
-void SchedulerStateProxy::set_framework_id(const std::string& id) {
-  data_.set_framework_id_value(id);
-  writeback();
-}
-
-void SchedulerStateProxy::set_target_version(const std::string& version) {
-  data_.set_target_version(version);
-  writeback();
-}
-
-const quobyte::SchedulerState& SchedulerStateProxy::state() {
-  return data_;
+static std::string EventStart(int64_t time_s, const std::string& hostname) {
+  std::string data = "{\"time_s\":" + std::to_string(time_s);
+  if (!hostname.empty()) {
+    data += ",\"host\":";
+    AppendJsonString(hostname, &data);
+  }
+  return data;
 }
 
-
-void SchedulerStateProxy::writeback() {
-  std::string serialized;
-  google::protobuf::TextFormat::Printer p;
-  if (!p.PrintToString(data_, &serialized)) {
-    LOG(FATAL) << "Could not serialize " << data_.ShortDebugString();
+static void LogServiceEvent(int64_t time_s,
+                            const std::string& hostname,
+                            const char* service,
+                            const quobyte::ServiceState& before,
+                            const quobyte::ServiceState& after,
+                            EventLog* events) {
+  if (before.state() == after.state()) {
+    return;
   }
-
-  mesos::state::Variable variable =
-      state_->fetch(path_).get();
-  variable = variable.mutate(serialized);
-  state_->store(variable);
+  std::string data = EventStart(time_s, hostname);
+  data += std::string(",\"service\":\"") + service + "\",\"state\":\"" +
+      quobyte::ServiceState::TaskState_Name(after.state()) +
+      "\",\"previous\":\"" +
+      quobyte::ServiceState::TaskState_Name(before.state()) + "\"";
+  if (after.has_task_id()) {
+    data += ",\"task_id\":";
+    AppendJsonString(after.task_id(), &data);
+  }
+  events->append("service", data + "}");
 }
 
-void SchedulerStateProxy::erase() {
-  data_.Clear();
-  writeback();
+// The events of a published change of a node, before is NULL for a new
+// node.
+static void LogNodeEvents(int64_t time_s,
+                          const quobyte::NodeState* before,
+                          const quobyte::NodeState& after,
+                          EventLog* events) {
+  if (before == NULL) {
+    events->append("node", EventStart(time_s, after.hostname()) + "}");
+    return;
+  }
+  for (int s = 0; s < NodeIndex::SERVICE_COUNT; ++s) {
+    const NodeIndex::Service service = static_cast<NodeIndex::Service>(s);
+    LogServiceEvent(time_s, after.hostname(), NodeIndex::serviceName(service),
+                    NodeIndex::service(*before, service),
+                    NodeIndex::service(after, service), events);
+  }
+  bool devices_changed =
+      before->device_types_valid() != after.device_types_valid() ||
+      before->device_type_size() != after.device_type_size() ||
+      before->client_mount_point() != after.client_mount_point();
+  for (int i = 0; !devices_changed && i < after.device_type_size(); ++i) {
+    devices_changed = before->device_type(i) != after.device_type(i);
+  }
+  if (devices_changed) {
+    std::string data = EventStart(time_s, after.hostname());
+    data += ",\"device_type\":[";
+    for (int i = 0; i < after.device_type_size(); ++i) {
+      data += std::string(i > 0 ? ",\"" : "\"") +
+          quobyte::DeviceType_Name(after.device_type(i)) + "\"";
+    }
+    data += std::string("],\"client_mount_point\":") +
+        (after.client_mount_point() ? "true" : "false") + "}";
+    events->append("probe", data);
+  }
 }
 
-
 QuobyteScheduler::QuobyteScheduler(
     SchedulerStateProxy* state,
-    mesos::FrameworkInfo* framework)
+    NodeStateStore* node_store,
+    mesos::FrameworkInfo* framework,
+    const Clock* clock)
     : state_(state),
-      framework_(framework) {
+      node_store_(node_store),
+      framework_(framework),
+      clock_(clock),
+      demand_(clock),
+      events_(FLAGS_event_log_size),
+      decisions_(FLAGS_decision_trace_size) {
   LOG(INFO) << framework->ShortDebugString();
 
+  for (int service = 0; service < SERVICE_TYPE_COUNT; ++service) {
+    launches_[service] = MetricsRegistry::instance()->counter(
+        "quobyte_scheduler_task_launches_total", "Tasks launched by service",
+        "service=\"" + ServiceName(static_cast<ServiceType>(service)) + "\"");
+  }
+
   prepareServiceResources(
+      REGISTRY_SERVICE,
       REGISTRY_TASK,
       FLAGS_port_range_base,
       FLAGS_port_range_base + 1,
       FLAGS_registry_resources);
 
   prepareServiceResources(
+      METADATA_SERVICE,
       METADATA_TASK,
       FLAGS_port_range_base + 2,
       FLAGS_port_range_base + 3,
       FLAGS_metadata_resources);
 
   prepareServiceResources(
+      DATA_SERVICE,
       DATA_TASK,
       FLAGS_port_range_base + 4,
       FLAGS_port_range_base + 5,
       FLAGS_data_resources);
 
   prepareServiceResources(
+      API_SERVICE,
       API_TASK,
       FLAGS_port_range_base + 6,
       FLAGS_port_range_base + 7,
       FLAGS_api_resources);
 
   prepareServiceResources(
+      WEBCONSOLE_SERVICE,
       WEBCONSOLE_TASK,
       FLAGS_port_range_base + 8,
       FLAGS_port_range_base + 9,
       FLAGS_webconsole_resources);
 
   prepareServiceResources(
+      S3_SERVICE,
       S3_TASK,
       FLAGS_port_range_base + 10,
       FLAGS_port_range_base + 11,
@@ -486,11 +556,204 @@ QuobyteScheduler::QuobyteScheduler(
       mesos::Resources::parse(
           FLAGS_prober_resources).get();
   resources_.emplace(PROBER_TASK, prober_resources);
+  demands_[PROBER_SERVICE] = resource_layout_.addDemand(prober_resources);
 
   mesos::Resources client_resources =
       mesos::Resources::parse(
           FLAGS_client_resources).get();
   resources_.emplace(CLIENT_TASK, client_resources);
+  demands_[CLIENT_SERVICE] = resource_layout_.addDemand(client_resources);
+
+  if (node_store_ != NULL) {
+    restoreNodes();
+  }
+  std::shared_ptr<ClusterSnapshot> initial =
+      std::make_shared<ClusterSnapshot>();
+  initial->api.CopyFrom(api_state_);
+  initial->s3.CopyFrom(s3_state_);
+  initial->console.CopyFrom(console_state_);
+  initial->running_services = CountRunning(*initial);
+  snapshot_ = std::move(initial);
+  publishDirty();
+  log_events_ = true;
+}
+
+// The clock is monotonic, its times mean nothing to another host or after
+// a reboot. Restored times in the future would hold off probes, prober
+// relaunches and offers for as long, they count as of now instead. Times
+// in the past only make these due early.
+static int64_t Rebase(int64_t time_s, int64_t now) {
+  return std::min(time_s, now);
+}
+
+static void RebaseTimes(quobyte::ServiceState* service, int64_t now) {
+  service->set_last_update_s(Rebase(service->last_update_s(), now));
+  service->set_last_seen_s(Rebase(service->last_seen_s(), now));
+}
+
+static void RebaseTimes(quobyte::NodeState* node, int64_t now) {
+  node->set_last_probe_s(Rebase(node->last_probe_s(), now));
+  node->set_last_offer_s(Rebase(node->last_offer_s(), now));
+  for (quobyte::ServiceState* service :
+           {node->mutable_prober(), node->mutable_registry(),
+            node->mutable_metadata(), node->mutable_data(),
+            node->mutable_client()}) {
+    RebaseTimes(service, now);
+  }
+}
+
+void QuobyteScheduler::restoreNodes() {
+  quobyte::NodeStateSnapshot snapshot;
+  node_store_->load(&snapshot);
+  const int64_t now_s = now();
+  for (quobyte::NodeState& node : *snapshot.mutable_node()) {
+    RebaseTimes(&node, now_s);
+    const NodeRegistry::Index index =
+        nodes_.add(node.hostname(), node.slave_id_value());
+    nodes_.at(index).Swap(&node);
+    for (int i = PROBER_SERVICE; i <= CLIENT_SERVICE; ++i) {
+      const ServiceType service = static_cast<ServiceType>(i);
+      const quobyte::ServiceState* service_state =
+          getService(&nodes_.at(index), service);
+      if (service_state != NULL && !service_state->task_id().empty() &&
+          (service < API_SERVICE || service > WEBCONSOLE_SERVICE)) {
+        task_ids_.add(service_state->task_id(),
+                      TaskKey{service, index, service_state->incarnation()});
+      }
+    }
+  }
+  api_state_.CopyFrom(snapshot.api());
+  s3_state_.CopyFrom(snapshot.s3());
+  console_state_.CopyFrom(snapshot.console());
+  for (quobyte::ServiceState* service_state :
+           {&api_state_, &s3_state_, &console_state_}) {
+    RebaseTimes(service_state, now_s);
+  }
+  for (const quobyte::ServiceState* service_state :
+           {&api_state_, &s3_state_, &console_state_}) {
+    ServiceType service;
+    std::string hostname;
+    uint32_t incarnation;
+    if (service_state->task_id().empty() ||
+        !TaskIdTable::parse(service_state->task_id(), &service, &hostname,
+                            &incarnation)) {
+      continue;
+    }
+    const NodeRegistry::Index index = nodes_.findByHostname(hostname);
+    if (index != NodeRegistry::kNotFound) {
+      task_ids_.add(service_state->task_id(),
+                    TaskKey{service, index, incarnation});
+    }
+  }
+  LOG(INFO) << "Restored " << nodes_.size() << " nodes, "
+      << task_ids_.size() << " tasks to confirm";
+}
+
+void QuobyteScheduler::markDirty(ServiceType service,
+                                 NodeRegistry::Index index) {
+  if (service == API_SERVICE || service == S3_SERVICE ||
+      service == WEBCONSOLE_SERVICE) {
+    services_dirty_ = true;
+    return;
+  }
+  if (index >= node_dirty_.size()) {
+    node_dirty_.resize(index + 1, false);
+  }
+  if (!node_dirty_[index]) {
+    node_dirty_[index] = true;
+    dirty_nodes_.push_back(index);
+  }
+}
+
+void QuobyteScheduler::publishDirty() {
+  const std::shared_ptr<const ClusterSnapshot> previous = snapshot();
+  if (dirty_nodes_.empty() && !services_dirty_ &&
+      previous->node_count == nodes_.size()) {
+    return;
+  }
+  std::shared_ptr<ClusterSnapshot> next =
+      std::make_shared<ClusterSnapshot>(*previous);
+  ++next->generation;
+  EventLog* events = log_events_ ? &events_ : NULL;
+  // Chunks copied for this snapshot, by chunk index.
+  std::map<size_t, std::shared_ptr<ClusterSnapshot::NodeChunk>> copied;
+  std::vector<NodeRegistry::Index> changed;
+  auto chunk = [&](size_t index) -> ClusterSnapshot::NodeChunk* {
+    const size_t chunk_index = index / ClusterSnapshot::kChunkSize;
+    std::shared_ptr<ClusterSnapshot::NodeChunk>& copy = copied[chunk_index];
+    if (!copy) {
+      if (chunk_index < next->chunks.size()) {
+        copy = std::make_shared<ClusterSnapshot::NodeChunk>(
+            *next->chunks[chunk_index]);
+        next->chunks[chunk_index] = copy;
+      } else {
+        copy = std::make_shared<ClusterSnapshot::NodeChunk>();
+        copy->reserve(ClusterSnapshot::kChunkSize);
+        next->chunks.push_back(copy);
+      }
+    }
+    return copy.get();
+  };
+
+  for (NodeRegistry::Index index : dirty_nodes_) {
+    if (node_store_ != NULL) {
+      node_store_->updateNode(nodes_.at(index));
+    }
+    node_dirty_[index] = false;
+    if (index < next->node_count) {
+      if (events != NULL) {
+        LogNodeEvents(now(), &next->node(index), nodes_.at(index), events);
+      }
+      next->running_services -= CountRunning(next->node(index));
+      next->running_services += CountRunning(nodes_.at(index));
+      (*chunk(index))[index % ClusterSnapshot::kChunkSize] = {
+          std::make_shared<const quobyte::NodeState>(nodes_.at(index)),
+          next->generation};
+      changed.push_back(index);
+    }
+  }
+  dirty_nodes_.clear();
+  for (NodeRegistry::Index index = next->node_count; index < nodes_.size();
+       ++index) {
+    if (events != NULL) {
+      LogNodeEvents(now(), NULL, nodes_.at(index), events);
+    }
+    next->running_services += CountRunning(nodes_.at(index));
+    chunk(index)->push_back({
+        std::make_shared<const quobyte::NodeState>(nodes_.at(index)),
+        next->generation});
+    changed.push_back(index);
+  }
+  next->node_count = nodes_.size();
+  if (services_dirty_) {
+    if (node_store_ != NULL) {
+      node_store_->updateServices(api_state_, s3_state_, console_state_);
+    }
+    services_dirty_ = false;
+    if (events != NULL) {
+      LogServiceEvent(now(), "", "api", next->api, api_state_, events);
+      LogServiceEvent(now(), "", "s3", next->s3, s3_state_, events);
+      LogServiceEvent(now(), "", "console", next->console, console_state_,
+                      events);
+    }
+    next->running_services -= CountRunning(*next);
+    next->api.CopyFrom(api_state_);
+    next->s3.CopyFrom(s3_state_);
+    next->console.CopyFrom(console_state_);
+    next->running_services += CountRunning(*next);
+  }
+  std::atomic_store(&snapshot_,
+                    std::shared_ptr<const ClusterSnapshot>(std::move(next)));
+  // After the snapshot, so that API readers that query the index first
+  // find all its nodes in the snapshot they take next.
+  for (NodeRegistry::Index index : changed) {
+    node_index_.update(index, nodes_.at(index));
+  }
+  events_.notify();
+}
+
+std::shared_ptr<const ClusterSnapshot> QuobyteScheduler::snapshot() const {
+  return std::atomic_load(&snapshot_);
 }
 
 void QuobyteScheduler::registered(mesos::SchedulerDriver* driver,
@@ -498,9 +761,35 @@ void QuobyteScheduler::registered(mesos::SchedulerDriver* driver,
                                   const mesos::MasterInfo&) {
   LOG(INFO) << "Storing framework id " << framework_id.value();
   state_->set_framework_id(framework_id.value());
+  // A lost framework id orphans all tasks after a restart.
+  state_->flush();
   LOG(INFO) << "Quobyte Mesos framework registered. Reconciling.";
   std::vector<mesos::TaskStatus> status;
   driver->reconcileTasks(status);
+  reconcileKnownTasks(driver);
+}
+
+void QuobyteScheduler::reconcileKnownTasks(mesos::SchedulerDriver* driver) {
+  // The master does not report tasks it does not know in an implicit
+  // reconciliation, ask for them explicitly to get TASK_LOST.
+  std::vector<mesos::TaskStatus> status;
+  mesos::TaskStatus task;
+  task.set_state(mesos::TASK_LOST);
+  for (NodeRegistry::Index index = 0; index < nodes_.size(); ++index) {
+    for (int i = PROBER_SERVICE; i <= CLIENT_SERVICE; ++i) {
+      const quobyte::ServiceState* service_state =
+          getService(&nodes_.at(index), static_cast<ServiceType>(i));
+      if (service_state != NULL && !service_state->task_id().empty() &&
+          task_ids_.find(service_state->task_id()) != NULL &&
+          task_ids_.find(service_state->task_id())->node == index) {
+        task.mutable_task_id()->set_value(service_state->task_id());
+        status.push_back(task);
+      }
+    }
+  }
+  if (!status.empty()) {
+    driver->reconcileTasks(status);
+  }
 }
 
 void QuobyteScheduler::reregistered(mesos::SchedulerDriver* driver,
@@ -525,63 +814,223 @@ void QuobyteScheduler::error(mesos::SchedulerDriver* driver,
 }
 
 
-void QuobyteScheduler::createHost(const std::string& hostname,
+NodeRegistry::Index QuobyteScheduler::createHost(const std::string& hostname,
    const std::string& slave_id) {
-  quobyte::NodeState node_state;
-  node_state.set_hostname(hostname);
-  node_state.set_slave_id_value(slave_id);
-  nodes_.insert(std::make_pair(hostname, node_state));
+  return nodes_.add(hostname, slave_id);
 }
 
 
 void QuobyteScheduler::reconcileHost(mesos::SchedulerDriver* driver,
                                      const mesos::Offer& offer) {
-  createHost(offer.hostname(), offer.slave_id().value());
+  const NodeRegistry::Index index =
+      createHost(offer.hostname(), offer.slave_id().value());
 
+  // Ids without incarnation, as launched by earlier framework versions,
+  // and the current tasks of the node.
   std::vector<mesos::TaskStatus> status;
   mesos::TaskStatus prober;
   prober.set_state(mesos::TASK_LOST);
-  prober.mutable_task_id()->set_value("quobyte-device-prober-" + offer.hostname());
-  status.push_back(prober);
-  prober.mutable_task_id()->set_value("quobyte-registry-" + offer.hostname());
-  status.push_back(prober);
-  prober.mutable_task_id()->set_value("quobyte-metadata-" + offer.hostname());
-  status.push_back(prober);
-  prober.mutable_task_id()->set_value("quobyte-data-" + offer.hostname());
-  status.push_back(prober);
-  prober.mutable_task_id()->set_value("quobyte-webconsole-" + offer.hostname());
-  status.push_back(prober);
-  prober.mutable_task_id()->set_value("quobyte-api-" + offer.hostname());
-  status.push_back(prober);
-  prober.mutable_task_id()->set_value("quobyte-s3-" + offer.hostname());
-  status.push_back(prober);
+  for (int i = PROBER_SERVICE; i <= WEBCONSOLE_SERVICE; ++i) {
+    const ServiceType service = static_cast<ServiceType>(i);
+    prober.mutable_task_id()->set_value(
+        task_ids_.add(service, index, offer.hostname(), 0));
+    status.push_back(prober);
+
+    const quobyte::ServiceState* service_state =
+        getService(&nodes_.at(index), service);
+    if (!service_state->task_id().empty() &&
+        task_ids_.find(service_state->task_id()) != NULL &&
+        task_ids_.find(service_state->task_id())->node == index) {
+      prober.mutable_task_id()->set_value(service_state->task_id());
+      status.push_back(prober);
+    }
+  }
   driver->reconcileTasks(status);
 }
 
-static bool NoRecentUpdates(const quobyte::ServiceState& service) {
+static bool NoRecentUpdates(const quobyte::ServiceState& service,
+                            int64_t now) {
   return service.last_update_s() == 0 ||
-      now() - service.last_update_s() > FLAGS_reconcile_service_interval_s;
+      now - service.last_update_s() > FLAGS_reconcile_service_interval_s;
+}
+
+int64_t QuobyteScheduler::now() const {
+  return clock_->nowSeconds();
+}
+
+static bool NeedsStart(const quobyte::ServiceState& service) {
+  return service.state() == quobyte::ServiceState::NOT_RUNNING;
+}
+
+int64_t QuobyteScheduler::nextOfferDue(const quobyte::NodeState& node) const {
+  const int64_t now_s = now();
+  const quobyte::ServiceState& prober = node.prober();
+  // Probes also reconcile the node's tasks.
+  int64_t due_s = node.last_probe_s() + FLAGS_probe_interval_s + 1;
+  if (prober.state() != quobyte::ServiceState::RUNNING &&
+      prober.state() != quobyte::ServiceState::STARTING) {
+    due_s = std::min<int64_t>(
+        due_s, prober.last_seen_s() + FLAGS_probe_executor_keepalive_interval_s + 1);
+  } else if (node.last_probe_s() > prober.last_seen_s() &&
+             now_s - node.last_probe_s() <
+                 FLAGS_probe_executor_keepalive_interval_s) {
+    // Probe response outstanding, it may bring new devices.
+    return now_s;
+  }
+
+  if (state_->target_version().empty()) {
+    if (node.registry().state() == quobyte::ServiceState::RUNNING ||
+        node.metadata().state() == quobyte::ServiceState::RUNNING ||
+        node.data().state() == quobyte::ServiceState::RUNNING) {
+      return now_s;  // to be shut down
+    }
+    return due_s;
+  }
+  if (!node.device_types_valid()) {
+    return due_s;
+  }
+
+  int core_services_running = 0;
+  for (auto device_type : node.device_type()) {
+    const quobyte::ServiceState* service = NULL;
+    switch (device_type) {
+      case quobyte::DeviceType::REGISTRY:
+        service = &node.registry();
+        break;
+      case quobyte::DeviceType::METADATA:
+        service = &node.metadata();
+        break;
+      case quobyte::DeviceType::DATA:
+        service = &node.data();
+        break;
+      default:
+        continue;
+    }
+    if (NeedsStart(*service)) {
+      return now_s;
+    }
+    if (service->state() == quobyte::ServiceState::RUNNING) {
+      ++core_services_running;
+    }
+  }
+  if (core_services_running == node.device_type_size() &&
+      ((node.client_mount_point() && NeedsStart(node.client())) ||
+       NeedsStart(api_state_) ||
+       NeedsStart(console_state_) ||
+       (!FLAGS_s3_hostname.empty() && NeedsStart(s3_state_)))) {
+    return now_s;
+  }
+  return due_s;
+}
+
+void QuobyteScheduler::updateOfferDemand(mesos::SchedulerDriver* driver,
+                                         NodeRegistry::Index index) {
+  demand_.update(index, nextOfferDue(nodes_.at(index)), driver);
+}
+
+void QuobyteScheduler::tick(mesos::SchedulerDriver* driver) {
+  demand_.tick(driver);
+}
+
+// The master may split the resources of an agent into several offers.
+static std::vector<std::vector<const mesos::Offer*>> GroupOffersByAgent(
+    const std::vector<mesos::Offer>& offers) {
+  std::vector<std::vector<const mesos::Offer*>> agents;
+  agents.reserve(offers.size());
+  std::unordered_map<std::string, size_t> agent_by_slave_id;
+  agent_by_slave_id.reserve(offers.size());
+  for (const mesos::Offer& offer : offers) {
+    auto agent = agent_by_slave_id.emplace(offer.slave_id().value(),
+                                           agents.size());
+    if (agent.second) {
+      agents.emplace_back();
+    }
+    agents[agent.first->second].push_back(&offer);
+  }
+  return agents;
+}
+
+static Counter* const offers_received = MetricsRegistry::instance()->counter(
+    "quobyte_scheduler_offers_total", "Resource offers by outcome",
+    "outcome=\"received\"");
+static Counter* const offers_declined = MetricsRegistry::instance()->counter(
+    "quobyte_scheduler_offers_total", "Resource offers by outcome",
+    "outcome=\"declined\"");
+static Counter* const offers_accepted = MetricsRegistry::instance()->counter(
+    "quobyte_scheduler_offers_total", "Resource offers by outcome",
+    "outcome=\"accepted\"");
+static Histogram* const resource_offers_latency =
+    MetricsRegistry::instance()->histogram(
+        "quobyte_scheduler_callback_seconds",
+        "Time spent in scheduler callbacks", "callback=\"resourceOffers\"");
+static Histogram* const status_update_latency =
+    MetricsRegistry::instance()->histogram(
+        "quobyte_scheduler_callback_seconds",
+        "Time spent in scheduler callbacks", "callback=\"statusUpdate\"");
+static Histogram* const probe_rtt = MetricsRegistry::instance()->histogram(
+    "quobyte_scheduler_probe_rtt_seconds",
+    "Time from a probe request to the prober's response");
+
+static void DeclineOffers(mesos::SchedulerDriver* driver,
+                          const std::vector<const mesos::Offer*>& offers,
+                          const mesos::Filters& filters) {
+  offers_declined->increment(offers.size());
+  for (const mesos::Offer* offer : offers) {
+    driver->declineOffer(offer->id(), filters);
+  }
+}
+
+// Takes all offers of an agent, the master returns what the tasks do not
+// use.
+static void LaunchOnOffers(mesos::SchedulerDriver* driver,
+                           const std::vector<const mesos::Offer*>& offers,
+                           const std::vector<mesos::TaskInfo>& tasks) {
+  offers_accepted->increment(offers.size());
+  std::vector<mesos::OfferID> offer_ids;
+  offer_ids.reserve(offers.size());
+  for (const mesos::Offer* offer : offers) {
+    offer_ids.push_back(offer->id());
+  }
+  mesos::Offer::Operation launch;
+  launch.set_type(mesos::Offer::Operation::LAUNCH);
+  for (const mesos::TaskInfo& task : tasks) {
+    launch.mutable_launch()->add_task_infos()->CopyFrom(task);
+  }
+  driver->acceptOffers(offer_ids, {launch});
 }
 
 void QuobyteScheduler::resourceOffers(mesos::SchedulerDriver* driver,
                                       const std::vector<mesos::Offer>& offers) {
-  std::vector<mesos::TaskInfo> tasks;
-
-  for (const auto& offer : offers) {
+  LatencyTimer timer(resource_offers_latency);
+  offers_received->increment(offers.size());
+  // Offers that may take services, launched or declined at the end.
+  std::vector<OfferPlacement> placements;
+  placements.reserve(offers.size());
+
+  for (const std::vector<const mesos::Offer*>& agent_offers :
+           GroupOffersByAgent(offers)) {
+    // The first offer stands in for the agent, the resources of all of them
+    // are used together.
+    const mesos::Offer& offer = *agent_offers.front();
     if (!FLAGS_restrict_hosts.empty() &&
         FLAGS_restrict_hosts.find(offer.hostname()) == -1) {
-      driver->declineOffer(offer.id());
+      mesos::Filters filters;
+      filters.set_refuse_seconds(FLAGS_max_offer_refuse_s);
+      DeclineOffers(driver, agent_offers, filters);
+      traceDecision(nodes_.findByHostname(offer.hostname()),
+                    DecisionTrace::HOST_NOT_ALLOWED, agent_offers.size());
       VLOG(1) << "Ignoring host " << offer.hostname();
       continue;
     }
 
     VLOG(1) << "Offer for " << offer.hostname();
-    std::map<std::string, quobyte::NodeState>::iterator node =
-        nodes_.find(offer.hostname());
-    if (node == nodes_.end()) {
+    const NodeRegistry::Index index = nodes_.findByHostname(offer.hostname());
+    if (index == NodeRegistry::kNotFound) {
       VLOG(1) << "New node " << offer.hostname();
       reconcileHost(driver, offer);
-      driver->declineOffer(offer.id());
+      DeclineOffers(driver, agent_offers, mesos::Filters());
+      traceDecision(nodes_.findByHostname(offer.hostname()),
+                    DecisionTrace::NEW_NODE, agent_offers.size());
       continue;
     }
 
@@ -609,25 +1058,29 @@ void QuobyteScheduler::resourceOffers(mesos::SchedulerDriver* driver,
       }
     }
 */
-    mesos::Resources remaining_resources = offer.resources();
-    quobyte::NodeState& node_state = node->second;
+    ResourceVector remaining_resources;
+    for (const mesos::Offer* agent_offer : agent_offers) {
+      remaining_resources += resource_layout_.fromOffer(
+          agent_offer->resources(), FLAGS_public_slave_role);
+    }
+    nodes_.updateAgentId(index, offer.slave_id().value());
+    quobyte::NodeState& node_state = nodes_.at(index);
     node_state.set_last_offer_s(now());
 
     if (now() - node_state.prober().last_seen_s() >
             FLAGS_probe_executor_keepalive_interval_s &&
         node_state.prober().state() != quobyte::ServiceState::RUNNING &&
         node_state.prober().state() != quobyte::ServiceState::STARTING) {
-      if (remaining_resources.contains(resources_[PROBER_TASK])) {
-        node->second.mutable_prober()->set_state(quobyte::ServiceState::STARTING);
-        node->second.mutable_prober()->set_last_update_s(now());
+      if (remaining_resources.contains(demands_[PROBER_SERVICE])) {
+        node_state.mutable_prober()->set_state(quobyte::ServiceState::STARTING);
+        node_state.mutable_prober()->set_last_update_s(now());
         LOG(INFO) << "Starting prober on " << offer.hostname();
 
-        mesos::TaskInfo task = createProberTaskInfo(state_->framework_id());
-        task.set_name("quobyte-device-prober");
+        mesos::TaskInfo task(
+            taskTemplate(PROBER_SERVICE, PROBER_TASK, 0, 0).task);
         task.mutable_task_id()->set_value(
-            "quobyte-device-prober-" + offer.hostname());
+            newTaskId(PROBER_SERVICE, index, node_state.mutable_prober()));
         task.mutable_slave_id()->MergeFrom(offer.slave_id());
-        task.mutable_resources()->MergeFrom(resources_[PROBER_TASK]);
 
 #if 0
         mesos::CommandInfo command;
@@ -646,11 +1099,16 @@ void QuobyteScheduler::resourceOffers(mesos::SchedulerDriver* driver,
         var->set_value(".libs");
 #endif
 
-        mesos::Status status = driver->launchTasks(
-            offer.id(), std::vector<mesos::TaskInfo>({{task}}));
+        LaunchOnOffers(driver, agent_offers,
+                       std::vector<mesos::TaskInfo>({{task}}));
+        demand_.launched(index, nextOfferDue(node_state));
+        traceDecision(index, DecisionTrace::ACCEPTED, agent_offers.size());
         continue;  // offer taken check next
       } else {
-        LOG(ERROR) << "Not enough resources for prober on " << offer.hostname();
+        traceDecision(index, DecisionTrace::INSUFFICIENT_RESOURCES,
+                      PROBER_SERVICE);
+        LOG_EVERY_N(ERROR, FLAGS_decision_log_every_n)
+            << "Not enough resources for prober on " << offer.hostname();
       }
     }
 
@@ -659,6 +1117,8 @@ void QuobyteScheduler::resourceOffers(mesos::SchedulerDriver* driver,
       VLOG(1) << "Triggering discovery on " << offer.hostname();
       // Trigger device discovery
       node_state.set_last_probe_s(now());
+      probe_sent_micros_[index] = clock_->nowMicros();
+      markDirty(PROBER_SERVICE, index);
       mesos::ExecutorID executor_id;
       executor_id.set_value(
           kExecutorId + state_->framework_id());
@@ -669,173 +1129,280 @@ void QuobyteScheduler::resourceOffers(mesos::SchedulerDriver* driver,
           request.SerializeAsString());
       // Also reconcile tasks
       reconcileHost(driver, offer);
-      driver->declineOffer(offer.id());
+      DeclineOffers(driver, agent_offers,
+                    demand_.decline(index, nextOfferDue(node_state)));
+      traceDecision(index, DecisionTrace::PROBING, agent_offers.size());
       continue;
     }
 
-    if (!state_->state().target_version().empty()) {
-      std::vector<mesos::TaskInfo> tasks_to_start;
-      if (remaining_resources.contains(resources_[API_TASK]) &&
-          DoStartService(API_TASK, node_state, api_state_.state()) &&
-          (FLAGS_public_slave_role.empty() ||
-           remaining_resources.reserved(FLAGS_public_slave_role).size() > 0)) {
-        remaining_resources -= resources_[API_TASK];
-        tasks_to_start.push_back(
-            makeTask(API_TASK,
-                     "quobyte-api",
-                     "quobyte-api-" + offer.hostname(),
-                     offer.hostname(),
-                     FLAGS_port_range_base + 6,
-                     FLAGS_port_range_base + 7,
-                     offer.slave_id()));
-        api_state_.set_state(quobyte::ServiceState::RUNNING);
-        api_state_.set_task_id("quobyte-api-" + offer.hostname());
-      }
-      if (!FLAGS_s3_hostname.empty() &&
-          remaining_resources.contains(resources_[S3_TASK]) &&
-          DoStartService(S3_TASK, node_state, s3_state_.state()) &&
-          (FLAGS_public_slave_role.empty() ||
-           remaining_resources.reserved(FLAGS_public_slave_role).size() > 0)) {
-        remaining_resources -= resources_[S3_TASK];
-        tasks_to_start.push_back(
-            makeTask(S3_TASK,
-                     "quobyte-s3",
-                     "quobyte-s3-" + offer.hostname(),
-                     offer.hostname(),
-                     FLAGS_port_range_base + 10,
-                     FLAGS_port_range_base + 11,
-                     offer.slave_id()));
-        s3_state_.set_state(quobyte::ServiceState::RUNNING);
-        s3_state_.set_task_id("quobyte-s3-" + offer.hostname());
+    if (!state_->target_version().empty()) {
+      if (!node_state.device_types_valid()) {
+        traceDecision(index, DecisionTrace::WAITING_FOR_DEVICES);
       }
-      if (remaining_resources.contains(resources_[WEBCONSOLE_TASK]) &&
-          DoStartService(WEBCONSOLE_TASK, node_state, console_state_.state()) &&
-          (FLAGS_public_slave_role.empty() ||
-           remaining_resources.reserved(FLAGS_public_slave_role).size() > 0)) {
-        remaining_resources -= resources_[WEBCONSOLE_TASK];
-        tasks_to_start.push_back(
-            makeTask(WEBCONSOLE_TASK,
-                     "quobyte-webconsole",
-                     "quobyte-webconsole-" + offer.hostname(),
-                     offer.hostname(),
-                     FLAGS_port_range_base + 8,
-                     FLAGS_port_range_base + 9,
-                     offer.slave_id()));
-        console_state_.set_state(quobyte::ServiceState::RUNNING);
-        console_state_.set_task_id("quobyte-webconsole-" + offer.hostname());
-      }
-      if (remaining_resources.contains(resources_[CLIENT_TASK]) &&
-          DoStartService(CLIENT_TASK, node_state, node_state.client().state()) &&
-          node_state.client_mount_point()) {
-        remaining_resources -= resources_[CLIENT_TASK];
-        mesos::TaskInfo task = createClientTaskInfo();
-        task.set_name("quobyte-client");
-        task.mutable_task_id()->set_value("quobyte-client-" + offer.hostname());
-        task.mutable_slave_id()->set_value(offer.slave_id().value());
-        tasks_to_start.push_back(task);
-        node_state.mutable_client()->set_state(quobyte::ServiceState::RUNNING);
-        node_state.mutable_client()->set_task_id("quobyte-client-" + offer.hostname());
-      }
-
+      std::vector<mesos::TaskInfo> tasks_to_start;
       for (auto device_type : node_state.device_type()) {
         switch (device_type) {
           case quobyte::DeviceType::REGISTRY:
             if (DoStartService(REGISTRY_TASK, node_state, node_state.registry().state())) {
-              if (!remaining_resources.contains(resources_[REGISTRY_TASK])) {
-                LOG(ERROR) << "Could not start registry: insufficient resources "
-                    << offer.DebugString();
+              if (!remaining_resources.contains(demands_[REGISTRY_SERVICE])) {
+                traceDecision(index, DecisionTrace::INSUFFICIENT_RESOURCES,
+                              REGISTRY_SERVICE);
+                LOG_EVERY_N(ERROR, FLAGS_decision_log_every_n)
+                    << "Could not start registry on " << offer.hostname()
+                    << ": insufficient resources";
                 node_state.mutable_registry()->set_last_message(
                     "Could not start registry: insufficient resources");
                 continue;
               }
-              LOG(INFO) << "Starting registry on " << offer.hostname();
-              remaining_resources -= resources_[REGISTRY_TASK];
+              VLOG(1) << "Starting registry on " << offer.hostname();
+              remaining_resources -= demands_[REGISTRY_SERVICE];
 
               tasks_to_start.push_back(
-                  makeTask(REGISTRY_TASK,
-                           "quobyte-registry",
-                           "quobyte-registry-" + offer.hostname(),
+                  makeTask(REGISTRY_SERVICE,
+                           REGISTRY_TASK,
+                           newTaskId(REGISTRY_SERVICE, index,
+                                     node_state.mutable_registry()),
                            offer.hostname(),
                            FLAGS_port_range_base,
                            FLAGS_port_range_base + 1,
                            offer.slave_id()));
+              node_state.mutable_registry()->set_state(
+                  quobyte::ServiceState::STARTING);
+              node_state.mutable_registry()->set_last_update_s(now());
             }
             break;
           case quobyte::DeviceType::METADATA:
             if (DoStartService(METADATA_TASK, node_state, node_state.metadata().state())) {
-              if (!remaining_resources.contains(resources_[METADATA_TASK])) {
-                LOG(ERROR) << "Could not start metadata: insufficient resources "
-                    << offer.DebugString();
+              if (!remaining_resources.contains(demands_[METADATA_SERVICE])) {
+                traceDecision(index, DecisionTrace::INSUFFICIENT_RESOURCES,
+                              METADATA_SERVICE);
+                LOG_EVERY_N(ERROR, FLAGS_decision_log_every_n)
+                    << "Could not start metadata on " << offer.hostname()
+                    << ": insufficient resources";
                 node_state.mutable_metadata()->set_last_message(
                     "Could not start metadata: insufficient resources");
                 continue;
               }
-              LOG(INFO) << "Starting metadata on " << offer.hostname();
-              remaining_resources -= resources_[METADATA_TASK];
+              VLOG(1) << "Starting metadata on " << offer.hostname();
+              remaining_resources -= demands_[METADATA_SERVICE];
 
               tasks_to_start.push_back(
-                  makeTask(METADATA_TASK,
-                           "quobyte-metadata",
-                           "quobyte-metadata-" + offer.hostname(),
+                  makeTask(METADATA_SERVICE,
+                           METADATA_TASK,
+                           newTaskId(METADATA_SERVICE, index,
+                                     node_state.mutable_metadata()),
                            offer.hostname(),
                            FLAGS_port_range_base + 2,
                            FLAGS_port_range_base + 3,
                            offer.slave_id()));
+              node_state.mutable_metadata()->set_state(
+                  quobyte::ServiceState::STARTING);
+              node_state.mutable_metadata()->set_last_update_s(now());
             }
             break;
           case quobyte::DeviceType::DATA:
             if (DoStartService(DATA_TASK, node_state, node_state.data().state())) {
-              if (!remaining_resources.contains(resources_[DATA_TASK])) {
-                LOG(ERROR) << "Could not start data: insufficient resources "
-                    << offer.DebugString();
+              if (!remaining_resources.contains(demands_[DATA_SERVICE])) {
+                traceDecision(index, DecisionTrace::INSUFFICIENT_RESOURCES,
+                              DATA_SERVICE);
+                LOG_EVERY_N(ERROR, FLAGS_decision_log_every_n)
+                    << "Could not start data on " << offer.hostname()
+                    << ": insufficient resources";
                 node_state.mutable_data()->set_last_message(
                     "Could not start data: insufficient resources");
                 continue;
               }
 
-              LOG(INFO) << "Starting data on " << offer.hostname();
-              remaining_resources -= resources_[DATA_TASK];
+              VLOG(1) << "Starting data on " << offer.hostname();
+              remaining_resources -= demands_[DATA_SERVICE];
 
               tasks_to_start.push_back(
-                  makeTask(DATA_TASK,
-                           "quobyte-data",
-                           "quobyte-data-" + offer.hostname(),
+                  makeTask(DATA_SERVICE,
+                           DATA_TASK,
+                           newTaskId(DATA_SERVICE, index,
+                                     node_state.mutable_data()),
                            offer.hostname(),
                            FLAGS_port_range_base + 4,
                            FLAGS_port_range_base + 5,
                            offer.slave_id()));
+              node_state.mutable_data()->set_state(
+                  quobyte::ServiceState::STARTING);
+              node_state.mutable_data()->set_last_update_s(now());
             }
             break;
           default:
             break;
         }
       }
-      if (!tasks_to_start.empty()) {
-        driver->launchTasks(offer.id(), tasks_to_start);
-        continue;
+      if (remaining_resources.contains(demands_[CLIENT_SERVICE]) &&
+          DoStartService(CLIENT_TASK, node_state, node_state.client().state()) &&
+          node_state.client_mount_point()) {
+        remaining_resources -= demands_[CLIENT_SERVICE];
+        mesos::TaskInfo task(
+            taskTemplate(CLIENT_SERVICE, CLIENT_TASK, 0, 0).task);
+        task.mutable_task_id()->set_value(
+            newTaskId(CLIENT_SERVICE, index, node_state.mutable_client()));
+        task.mutable_slave_id()->set_value(offer.slave_id().value());
+        tasks_to_start.push_back(task);
+        node_state.mutable_client()->set_state(quobyte::ServiceState::RUNNING);
       }
+
+      // Singleton services are placed once the whole batch is known.
+      placements.emplace_back();
+      OfferPlacement& placement = placements.back();
+      placement.offers = agent_offers;
+      placement.node = index;
+      placement.remaining = remaining_resources;
+      placement.tasks.swap(tasks_to_start);
+      continue;
+    } else {
+      KillServiceIfRunning(driver, node_state.registry());
+      KillServiceIfRunning(driver, node_state.data());
+      KillServiceIfRunning(driver, node_state.metadata());
+      KillServiceIfRunning(driver, api_state_);
+      KillServiceIfRunning(driver, s3_state_);
+      KillServiceIfRunning(driver, console_state_);
+    }
+    DeclineOffers(driver, agent_offers,
+                  demand_.decline(index, nextOfferDue(node_state)));
+    traceDecision(index, DecisionTrace::NO_TARGET_VERSION,
+                  agent_offers.size());
+  }
+
+  placeSingleton(API_SERVICE, API_TASK,
+                 FLAGS_port_range_base + 6, FLAGS_port_range_base + 7,
+                 &api_state_, &placements);
+  if (!FLAGS_s3_hostname.empty()) {
+    placeSingleton(S3_SERVICE, S3_TASK,
+                   FLAGS_port_range_base + 10, FLAGS_port_range_base + 11,
+                   &s3_state_, &placements);
+  }
+  placeSingleton(WEBCONSOLE_SERVICE, WEBCONSOLE_TASK,
+                 FLAGS_port_range_base + 8, FLAGS_port_range_base + 9,
+                 &console_state_, &placements);
+
+  for (const OfferPlacement& placement : placements) {
+    if (placement.tasks.empty()) {
+      DeclineOffers(driver, placement.offers,
+                    demand_.decline(placement.node,
+                                    nextOfferDue(nodes_.at(placement.node))));
+      traceDecision(placement.node, DecisionTrace::DECLINED,
+                    placement.offers.size());
     } else {
-      KillServiceIfRunning(driver,
-                           "quobyte-registry-" + offer.hostname(),
-                           node_state.registry());
-      KillServiceIfRunning(driver,
-                           "quobyte-data-" + offer.hostname(),
-                           node_state.data());
-      KillServiceIfRunning(driver,
-                           "quobyte-metadata-" + offer.hostname(),
-                           node_state.metadata());
-      KillServiceIfRunning(driver,
-                           "quobyte-api-" + offer.hostname(),
-                           api_state_);
-      KillServiceIfRunning(driver,
-                           "quobyte-s3-" + offer.hostname(),
-                           s3_state_);
-      KillServiceIfRunning(driver,
-                           "quobyte-webconsole-" + offer.hostname(),
-                           console_state_);
+      LaunchOnOffers(driver, placement.offers, placement.tasks);
+      demand_.launched(placement.node,
+                       nextOfferDue(nodes_.at(placement.node)));
+      traceDecision(placement.node, DecisionTrace::ACCEPTED,
+                    placement.offers.size());
     }
-    driver->declineOffer(offer.id());
   }
+  demand_.maybeSuppress(driver);
+  publishDirty();
+}
+
+// Nodes without data or metadata devices are preferred for singletons, to
+// keep them from competing with the storage services.
+static bool HostsStorageServices(const quobyte::NodeState& node) {
+  for (auto device_type : node.device_type()) {
+    if (device_type == quobyte::DeviceType::DATA ||
+        device_type == quobyte::DeviceType::METADATA) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool CoreServicesRunning(const quobyte::NodeState& node) {
+  int core_services_running = 0;
+  if (node.registry().state() == quobyte::ServiceState::RUNNING) {
+    ++core_services_running;
+  }
+  if (node.metadata().state() == quobyte::ServiceState::RUNNING) {
+    ++core_services_running;
+  }
+  if (node.data().state() == quobyte::ServiceState::RUNNING) {
+    ++core_services_running;
+  }
+  return node.device_types_valid() &&
+      core_services_running == node.device_type_size();
+}
+
+// How many more instances of the demand fit, by the scarcer of cpus and mem.
+static double SpareCapacity(const ResourceVector& remaining,
+                            const ResourceVector& demand) {
+  double spare = std::numeric_limits<double>::max();
+  if (demand.cpus > 0) {
+    spare = std::min(spare, static_cast<double>(remaining.cpus) / demand.cpus);
+  }
+  if (demand.mem > 0) {
+    spare = std::min(spare, static_cast<double>(remaining.mem) / demand.mem);
+  }
+  return spare;
+}
+
+void QuobyteScheduler::placeSingleton(
+    ServiceType service,
+    const std::string& service_id,
+    uint16_t rpcPort,
+    uint16_t httpPort,
+    quobyte::ServiceState* service_state,
+    std::vector<OfferPlacement>* placements) {
+  if (!ShouldServiceBeStarted(service_state->state())) {
+    return;
+  }
+  const ResourceVector& demand = demands_[service];
+  OfferPlacement* best = NULL;
+  bool best_hosts_storage = true;
+  double best_spare = 0;
+  for (OfferPlacement& placement : *placements) {
+    const quobyte::NodeState& node = nodes_.at(placement.node);
+    if (!placement.remaining.contains(demand) ||
+        (!FLAGS_public_slave_role.empty() &&
+         !placement.remaining.role_reserved) ||
+        !CoreServicesRunning(node)) {
+      continue;
+    }
+    const bool hosts_storage = HostsStorageServices(node);
+    const double spare = SpareCapacity(placement.remaining, demand);
+    if (best == NULL ||
+        (best_hosts_storage && !hosts_storage) ||
+        (best_hosts_storage == hosts_storage && spare > best_spare)) {
+      best = &placement;
+      best_hosts_storage = hosts_storage;
+      best_spare = spare;
+    }
+  }
+  if (best == NULL) {
+    VLOG(1) << "No offer for " << ServiceTaskName(service);
+    return;
+  }
+
+  const mesos::Offer& offer = *best->offers.front();
+  LOG(INFO) << "Placing " << ServiceTaskName(service)
+      << " on " << offer.hostname();
+  best->remaining -= demand;
+  best->tasks.push_back(
+      makeTask(service,
+               service_id,
+               newTaskId(service, best->node, service_state),
+               offer.hostname(),
+               rpcPort,
+               httpPort,
+               offer.slave_id()));
+  service_state->set_state(quobyte::ServiceState::RUNNING);
+}
+
+void QuobyteScheduler::traceDecision(NodeRegistry::Index index,
+                                     DecisionTrace::Decision decision,
+                                     size_t offers) {
+  decisions_.record(clock_->nowMicros(), index, decision, SERVICE_TYPE_COUNT,
+                    offers);
+}
+
+void QuobyteScheduler::traceDecision(NodeRegistry::Index index,
+                                     DecisionTrace::Decision decision,
+                                     ServiceType service) {
+  decisions_.record(clock_->nowMicros(), index, decision, service, 0);
 }
 
 void QuobyteScheduler::offerRescinded(mesos::SchedulerDriver* driver,
@@ -844,79 +1411,121 @@ void QuobyteScheduler::offerRescinded(mesos::SchedulerDriver* driver,
 }
 
 quobyte::ServiceState* QuobyteScheduler::getService(
-    quobyte::NodeState* node, const std::string& service) {
-  if (service == "quobyte-device-prober") {
-    return node->mutable_prober();
-  } else if (service == "quobyte-registry") {
-    return node->mutable_registry();
-  } else if (service == "quobyte-metadata") {
-    return node->mutable_metadata();
-  } else if (service == "quobyte-data") {
-    return node->mutable_data();
-  } else if (service == "quobyte-api") {
-    return &api_state_;
-  } else if (service == "quobyte-s3") {
-    return &s3_state_;
-  } else if (service == "quobyte-webconsole") {
-    return &console_state_;
-  } else if (service == "quobyte-client") {
-    return node->mutable_client();
-  } else {
-    return NULL;
+    quobyte::NodeState* node, ServiceType service) {
+  switch (service) {
+    case PROBER_SERVICE:
+      return node->mutable_prober();
+    case REGISTRY_SERVICE:
+      return node->mutable_registry();
+    case METADATA_SERVICE:
+      return node->mutable_metadata();
+    case DATA_SERVICE:
+      return node->mutable_data();
+    case API_SERVICE:
+      return &api_state_;
+    case S3_SERVICE:
+      return &s3_state_;
+    case WEBCONSOLE_SERVICE:
+      return &console_state_;
+    case CLIENT_SERVICE:
+      return node->mutable_client();
+    default:
+      return NULL;
   }
 }
 
+const std::string& QuobyteScheduler::newTaskId(
+    ServiceType service,
+    NodeRegistry::Index index,
+    quobyte::ServiceState* service_state) {
+  service_state->set_incarnation(service_state->incarnation() + 1);
+  const std::string& task_id = task_ids_.add(
+      service, index, nodes_.at(index).hostname(),
+      service_state->incarnation());
+  service_state->set_task_id(task_id);
+  markDirty(service, index);
+  launches_[service]->increment();
+  decisions_.record(clock_->nowMicros(), index, DecisionTrace::LAUNCHED,
+                    service, 0);
+  task_latencies_.launched(service, index, service_state->incarnation(),
+                           clock_->nowMicros());
+  return task_id;
+}
+
 void QuobyteScheduler::statusUpdate(mesos::SchedulerDriver* driver,
                                     const mesos::TaskStatus& status)  {
+  LatencyTimer timer(status_update_latency);
   VLOG(1) << "statusUpdate " << status.ShortDebugString();
-  const int pos = status.task_id().value().rfind("-");
-  if (pos == -1) {
-    return;
-  }
-
-  const std::string service = status.task_id().value().substr(0, pos);
-  const std::string hostname = status.task_id().value().substr(pos + 1);
-
-  std::map<std::string, quobyte::NodeState>::iterator node =
-      nodes_.find(hostname);
+  const std::string& task_id = status.task_id().value();
 
-  if (node == nodes_.end()) {
-    VLOG(1) << "Node not found, creating " << hostname;
-    createHost(hostname, status.slave_id().value());
-    node = nodes_.find(hostname);
+  TaskKey key;
+  const TaskKey* known_key = task_ids_.find(task_id);
+  if (known_key != NULL) {
+    key = *known_key;
+  } else {
+    // Launched before a failover or by an earlier framework version.
+    std::string hostname;
+    if (!TaskIdTable::parse(
+            task_id, &key.service, &hostname, &key.incarnation)) {
+      LOG(ERROR) << "Unknown task " << task_id;
+      return;
+    }
+    key.node = nodes_.findByHostname(hostname);
+    if (key.node == NodeRegistry::kNotFound) {
+      VLOG(1) << "Node not found, creating " << hostname;
+      key.node = createHost(hostname, status.slave_id().value());
+    }
+    task_ids_.add(task_id, key);
   }
+  const ServiceType service = key.service;
+  quobyte::NodeState* node = &nodes_.at(key.node);
 
-  quobyte::ServiceState* service_state = getService(&node->second, service);
+  quobyte::ServiceState* service_state = getService(node, service);
   if (service_state == NULL) {
     LOG(ERROR) << "Unknown service " << service;
     return;
   }
+  task_latencies_.update(service, key.node, key.incarnation, status.state(),
+                         clock_->nowMicros());
+  const quobyte::ServiceState_TaskState previous_state =
+      service_state->state();
+  const uint32_t previous_incarnation = service_state->incarnation();
+  if (key.incarnation > service_state->incarnation()) {
+    // Do not reuse incarnations of tasks from before a failover.
+    service_state->set_incarnation(key.incarnation);
+  }
 
   if (status.state() == mesos::TASK_RUNNING ||
       status.state() == mesos::TASK_FINISHED) {
     bool service_should_run = true;
 
-    if ((service == "quobyte-api" || service == "quobyte-webconsole" || service == "quobyte-s3") &&
+    if ((service == API_SERVICE || service == WEBCONSOLE_SERVICE || service == S3_SERVICE) &&
         service_state->state() == quobyte::ServiceState::RUNNING &&
-        service_state->task_id() != status.task_id().value()) {
+        service_state->task_id() != task_id) {
+      service_should_run = false;
+    }
+    if (key.incarnation < service_state->incarnation() &&
+        !service_state->task_id().empty() &&
+        service_state->task_id() != task_id) {
+      // Superseded by a newer launch of the same service.
       service_should_run = false;
     }
 
-    if (node->second.device_types_valid()) {
+    if (node->device_types_valid()) {
       const std::set<int> device_types(
-          node->second.device_type().begin(),
-          node->second.device_type().end());
-      if (service == "quobyte-registry" &&
+          node->device_type().begin(),
+          node->device_type().end());
+      if (service == REGISTRY_SERVICE &&
           device_types.count(quobyte::DeviceType::REGISTRY) == 0) {
         service_should_run = false;
-      } else if (service == "quobyte-metadata" &&
+      } else if (service == METADATA_SERVICE &&
                  device_types.count(quobyte::DeviceType::METADATA) == 0) {
         service_should_run = false;
-      } else if (service == "quobyte-data" &&
+      } else if (service == DATA_SERVICE &&
                  device_types.count(quobyte::DeviceType::DATA) == 0) {
         service_should_run = false;
-      } else if (service == "quobyte-client" &&
-                 !node->second.client_mount_point()) {
+      } else if (service == CLIENT_SERVICE &&
+                 !node->client_mount_point()) {
         service_should_run = false;
       }
     }
@@ -947,7 +1556,25 @@ void QuobyteScheduler::statusUpdate(mesos::SchedulerDriver* driver,
         << ": " << service_state->ShortDebugString();
   }
 
-  if (service == "quobyte-device-prober" || IsTerminal(status.state())) {
+  // Sightings of running tasks are not worth persisting.
+  if (service_state->state() != previous_state ||
+      service_state->incarnation() != previous_incarnation) {
+    markDirty(service, key.node);
+    publishDirty();
+  }
+
+  // Running core services unblock the client and singleton services.
+  const bool core_service = service == REGISTRY_SERVICE ||
+      service == METADATA_SERVICE || service == DATA_SERVICE;
+  if (service == PROBER_SERVICE || core_service ||
+      service_state->state() == quobyte::ServiceState::NOT_RUNNING) {
+    updateOfferDemand(driver, key.node);
+  }
+
+  if (IsTerminal(status.state())) {
+    task_ids_.remove(task_id);
+  }
+  if (service == PROBER_SERVICE || IsTerminal(status.state())) {
     return;
   }
 
@@ -966,12 +1593,12 @@ void QuobyteScheduler::statusUpdate(mesos::SchedulerDriver* driver,
         << status.labels().ShortDebugString();
   }
 
-  if (state_->state().target_version().empty()) {
+  if (state_->target_version().empty()) {
     LOG(INFO) << "Shut down requested, killing " << status.task_id();
     driver->killTask(status.task_id());
-  } else if (!version.empty() && version != state_->state().target_version()) {
+  } else if (!version.empty() && version != state_->target_version()) {
     LOG(INFO) << "Version mismatch (target: "
-        << state_->state().target_version() << ", actual: "
+        << state_->target_version() << ", actual: "
         << version << ")"
         ", restarting " << status.task_id();
   }
@@ -981,22 +1608,31 @@ void QuobyteScheduler::frameworkMessage(mesos::SchedulerDriver* driver,
                                         const mesos::ExecutorID& executorId,
                                         const mesos::SlaveID& slaveId,
                                         const std::string& data)  {
-  for (auto& node : nodes_) {
-    if (node.second.slave_id_value() == slaveId.value()) {
-      quobyte::ProbeResponse response;
-      if (!response.ParseFromString(data)) {
-        LOG(ERROR) << "Bad response";
-        return;
-      }
-      LOG(INFO) << "Message from prober on " << slaveId.value()
-          << " " << response.ShortDebugString();
-      node.second.mutable_device_type()->CopyFrom(response.device_type());
-      // We also know that the executor is alive
-      node.second.set_client_mount_point(response.client_mount_point());
-      node.second.mutable_prober()->set_last_seen_s(now());
-      node.second.set_device_types_valid(true);
-    }
+  const NodeRegistry::Index index = nodes_.findByAgentId(slaveId.value());
+  if (index == NodeRegistry::kNotFound) {
+    return;
   }
+  quobyte::NodeState& node = nodes_.at(index);
+  quobyte::ProbeResponse response;
+  if (!response.ParseFromString(data)) {
+    LOG(ERROR) << "Bad response";
+    return;
+  }
+  LOG(INFO) << "Message from prober on " << slaveId.value()
+      << " " << response.ShortDebugString();
+  auto probe = probe_sent_micros_.find(index);
+  if (probe != probe_sent_micros_.end()) {
+    probe_rtt->observe(clock_->nowMicros() - probe->second);
+    probe_sent_micros_.erase(probe);
+  }
+  node.mutable_device_type()->CopyFrom(response.device_type());
+  // We also know that the executor is alive
+  node.set_client_mount_point(response.client_mount_point());
+  node.mutable_prober()->set_last_seen_s(now());
+  node.set_device_types_valid(true);
+  markDirty(PROBER_SERVICE, index);
+  publishDirty();
+  updateOfferDemand(driver, index);
 }
 
 void QuobyteScheduler::executorLost(mesos::SchedulerDriver* driver,
@@ -1008,6 +1644,7 @@ void QuobyteScheduler::executorLost(mesos::SchedulerDriver* driver,
 }
 
 void QuobyteScheduler::prepareServiceResources(
+    ServiceType service,
     const std::string& service_id,
     uint16_t rpcPort,
     uint16_t httpPort,
@@ -1026,25 +1663,53 @@ void QuobyteScheduler::prepareServiceResources(
   LOG(INFO) << service_id << " " << res_string;
   mesos::Resources resources = mesos::Resources::parse(res_string).get();
   resources_.emplace(service_id, resources);
+  demands_[service] = resource_layout_.addDemand(resources);
 }
 
-mesos::TaskInfo QuobyteScheduler::makeTask(const std::string& service_id,
-                                           const std::string& name,
-                                           const std::string& task_id,
-                                           const std::string& host_name,
-                                           uint16_t rpcPort,
-                                           uint16_t httpPort,
-                                           const mesos::SlaveID& slave_id) {
+const QuobyteScheduler::TaskTemplate& QuobyteScheduler::taskTemplate(
+    ServiceType service,
+    const std::string& service_id,
+    uint16_t rpcPort,
+    uint16_t httpPort) {
+  if (templates_version_ != state_->target_version() ||
+      templates_framework_id_ != state_->framework_id()) {
+    for (TaskTemplate& task_template : templates_) {
+      task_template.valid = false;
+    }
+    templates_version_ = state_->target_version();
+    templates_framework_id_ = state_->framework_id();
+  }
+
+  TaskTemplate& task_template = templates_[service];
+  if (!task_template.valid) {
+    VLOG(1) << "Building task template for " << ServiceTaskName(service)
+        << " version " << templates_version_;
+    if (service == PROBER_SERVICE) {
+      task_template.task = createProberTaskInfo(templates_framework_id_);
+      task_template.task.mutable_resources()->MergeFrom(resources_[PROBER_TASK]);
+    } else if (service == CLIENT_SERVICE) {
+      task_template.task = createClientTaskInfo();
+    } else {
+      buildTaskTemplate(service_id, rpcPort, httpPort, &task_template);
+    }
+    task_template.task.set_name(ServiceTaskName(service));
+    task_template.valid = true;
+  }
+  return task_template;
+}
+
+void QuobyteScheduler::buildTaskTemplate(const std::string& service_id,
+                                         uint16_t rpcPort,
+                                         uint16_t httpPort,
+                                         TaskTemplate* task_template) {
   // Not semantically equivalent, but works for now
   std::string systemd_service_name = service_id;
 
-  mesos::TaskInfo taskInfo;
-  taskInfo.set_name(name);
-  taskInfo.mutable_task_id()->set_value(task_id);
-  taskInfo.mutable_slave_id()->MergeFrom(slave_id);
+  mesos::TaskInfo& taskInfo = task_template->task;
+  taskInfo.Clear();
   taskInfo.mutable_resources()->MergeFrom(resources_[service_id]);
 
-  const std::string docker_image_version = state_->state().target_version();
+  const std::string docker_image_version = state_->target_version();
   mesos::ContainerInfo containerInfo = createQbContainerInfo();
   mesos::ContainerInfo::DockerInfo dockerInfo =
       createQbDockerInfo(FLAGS_docker_image + ":" + docker_image_version);
@@ -1066,11 +1731,11 @@ mesos::TaskInfo QuobyteScheduler::makeTask(const std::string& service_id,
 #endif
   containerInfo.mutable_docker()->CopyFrom(dockerInfo);
 
+  task_template->command_prefix =
+      constructDockerExecutePrefix(systemd_service_name, rpcPort, httpPort);
+  task_template->command_suffix = constructDockerExecuteSuffix();
+
   mesos::CommandInfo command;
-  command.set_value(constructDockerExecuteCommand(systemd_service_name,
-                                                  host_name,
-                                                  rpcPort,
-                                                  httpPort));
   command.set_shell(true);
 
   taskInfo.mutable_command()->CopyFrom(command);
@@ -1110,32 +1775,38 @@ mesos::TaskInfo QuobyteScheduler::makeTask(const std::string& service_id,
     port2->set_protocol("tcp");
   }
 #endif
+}
 
-  LOG(INFO) << "Launching " << taskInfo.DebugString();
-
+mesos::TaskInfo QuobyteScheduler::makeTask(ServiceType service,
+                                           const std::string& service_id,
+                                           const std::string& task_id,
+                                           const std::string& host_name,
+                                           uint16_t rpcPort,
+                                           uint16_t httpPort,
+                                           const mesos::SlaveID& slave_id) {
+  const TaskTemplate& task_template =
+      taskTemplate(service, service_id, rpcPort, httpPort);
+  mesos::TaskInfo taskInfo(task_template.task);
+  taskInfo.mutable_task_id()->set_value(task_id);
+  taskInfo.mutable_slave_id()->CopyFrom(slave_id);
+  std::string* command = taskInfo.mutable_command()->mutable_value();
+  *command = task_template.command_prefix;
+  *command += constructDockerExecuteHostPart(host_name);
+  *command += task_template.command_suffix;
+
+  LOG(INFO) << "Launching " << task_id;
+  VLOG(2) << taskInfo.ShortDebugString();
   return taskInfo;
 }
 
-static std::string renderService(
-    const std::string& name,
-    bool has_device,
-    const quobyte::NodeState& node,
-    const quobyte::ServiceState& service) {
-  std::string device_msg = "no device";
-  if (!node.device_types_valid()) {
-    device_msg = "waiting for prober";
-  }
-
-  std::string extra;
-  if (has_device && service.state() != quobyte::ServiceState::RUNNING) {
-    extra = "style='background-color: yellow'";
+size_t QuobyteScheduler::countProbedNodes() const {
+  size_t result = 0;
+  for (const quobyte::NodeState& node : nodes_) {
+    if (node.device_types_valid()) {
+      ++result;
+    }
   }
-
-  return std::string("<tr><td>") + name + ": </td><td>"
-      + (has_device ? "found" : device_msg)
-      + " <span title=\"" +  service.last_message() + "\" " + extra + ">\n"
-      + ServiceState_TaskState_Name(service.state()) + "</span>"
-      + "</td></tr>\n";
+  return result;
 }
 
 int QuobyteScheduler::countRunningServices() {
@@ -1150,101 +1821,209 @@ int QuobyteScheduler::countRunningServices() {
     result++;
   }
 
-  for (const auto& node : nodes_) {
-    if (node.second.registry().state() == quobyte::ServiceState::RUNNING) {
-      result++;
+  for (const quobyte::NodeState& node : nodes_) {
+    result += CountRunning(node);
+  }
+
+  return result;
+}
+
+void QuobyteScheduler::registerHttpHandlers(quobyte::HttpServer* http) {
+  http->ServeFile(kArchiveUrl, kArchivePath);
+  http->ServePage("/", std::bind(&QuobyteScheduler::renderStatusPage, this));
+  typedef quobyte::HttpServer::Arguments Arguments;
+  http->ServeApi(kNodesApiUrl, [this](const std::string& path,
+                                      const Arguments& arguments,
+                                      std::string* body) {
+    return ServeNodesApi(*snapshot(), node_index_, now(), path, arguments,
+                         body);
+  });
+  http->ServeApi(kServicesApiUrl, [this](const std::string& path,
+                                         const Arguments& arguments,
+                                         std::string* body) {
+    return ServeServicesApi(*snapshot(), node_index_, arguments, body);
+  });
+  http->ServeApi(kTaskLatencyUrl, [this](const std::string& path,
+                                         const Arguments& arguments,
+                                         std::string* body) {
+    return ServeTaskLatencyApi(*snapshot(), node_index_, task_latencies_,
+                               path, body);
+  });
+  http->ServeApi(kDecisionsUrl, [this](const std::string& path,
+                                       const Arguments& arguments,
+                                       std::string* body) {
+    return ServeDecisionsApi(*snapshot(), node_index_, decisions_,
+                             clock_->nowMicros(), path, arguments, body);
+  });
+  http->ServeEvents(kEventsUrl, [this](const Arguments& arguments,
+                                       const std::string& last_event_id) {
+    // Resumes after the last event seen, or starts with the next one.
+    uint64_t next = events_.next();
+    auto since = arguments.find("since");
+    const std::string* seen =
+        since != arguments.end() ? &since->second :
+        !last_event_id.empty() ? &last_event_id : NULL;
+    if (seen != NULL) {
+      uint64_t sequence;
+      if (!ParseNumber(*seen, &sequence)) {
+        return quobyte::HttpServer::EventReader();
+      }
+      next = sequence + 1;
     }
-    if (node.second.metadata().state() == quobyte::ServiceState::RUNNING) {
-      result++;
+    return quobyte::HttpServer::EventReader(
+        [this, next](std::string* out) mutable {
+          events_.read(&next, out);
+          return true;
+        });
+  });
+  events_.setListener(
+      std::bind(&quobyte::HttpServer::NotifyEvents, http));
+  http->ServePage(kMetricsUrl, [this]() {
+    return quobyte::PageFragments(
+        {std::make_shared<const std::string>(renderMetrics())});
+  });
+}
+
+static std::string ServiceLabels(const char* service, int state) {
+  return std::string("service=\"") + service + "\",state=\"" +
+      quobyte::ServiceState::TaskState_Name(
+          static_cast<quobyte::ServiceState::TaskState>(state)) + "\"";
+}
+
+std::string QuobyteScheduler::renderMetrics() const {
+  std::string result = MetricsRegistry::instance()->render();
+  const std::shared_ptr<const ClusterSnapshot> cluster = snapshot();
+  AppendGauge("quobyte_scheduler_nodes", "Known nodes", "",
+              cluster->node_count, &result);
+  AppendGauge("quobyte_scheduler_running_services", "Running services", "",
+              cluster->running_services, &result);
+
+  // Node services are counted by the node index as they change.
+  result += "# HELP quobyte_scheduler_services Services by state\n"
+            "# TYPE quobyte_scheduler_services gauge\n";
+  for (int s = 0; s < NodeIndex::SERVICE_COUNT; ++s) {
+    const NodeIndex::Service service = static_cast<NodeIndex::Service>(s);
+    for (int state = 0; state < NodeIndex::kStateCount; ++state) {
+      if (quobyte::ServiceState::TaskState_IsValid(state)) {
+        AppendGauge("quobyte_scheduler_services", "",
+                    ServiceLabels(NodeIndex::serviceName(service), state),
+                    node_index_.count(service, state), &result);
+      }
     }
-    if (node.second.data().state() == quobyte::ServiceState::RUNNING) {
-      result++;
+  }
+  const std::pair<const char*, const quobyte::ServiceState*> singletons[] = {
+    {"api", &cluster->api},
+    {"s3", &cluster->s3},
+    {"console", &cluster->console},
+  };
+  for (const auto& singleton : singletons) {
+    for (int state = 0; state < NodeIndex::kStateCount; ++state) {
+      if (quobyte::ServiceState::TaskState_IsValid(state)) {
+        AppendGauge("quobyte_scheduler_services", "",
+                    ServiceLabels(singleton.first, state),
+                    singleton.second->state() == state ? 1 : 0, &result);
+      }
     }
   }
-
   return result;
 }
 
+quobyte::PageFragments QuobyteScheduler::renderStatusPage() {
+  const std::shared_ptr<const ClusterSnapshot> cluster = snapshot();
+  const quobyte::SchedulerState framework_state = state_->state();
+  std::string result;
+  result = "<html><head>";
+  result += "<style>.details { display: none; } .hostbox:hover .details { display:block; position:absolute; background:#fafafa; border: 2px solid lightgray; }</style>";
+  result += "</head><body style='font-family: sans-serif'>";
+  result += "<h1><img style='vertical-align:middle; padding:3px' src=\"http://www.quobyte.com/favicon-128.png\" width=\"60\">Quobyte Mesos Framework Scheduler</h1>\n";
+  result += "<table><tbody>";
+  result += "<tr><td>Deployed container version:</td><td>";
+  result += framework_state.target_version().empty() ?
+      "No version to deploy (set via REST API)" : framework_state.target_version();
+  result += "<div class=\"details\">" + framework_state.DebugString() + "</div></td></tr>";
+  const SchedulerStateProxy::Stats state_stats = state_->stats();
+  result += "<tr><td>State store:</td><td>" +
+      std::to_string(state_stats.pending) + " pending, " +
+      std::to_string(state_stats.stores) + " stores, last " +
+      std::to_string(state_stats.last_store_micros / 1000) + "ms, max " +
+      std::to_string(state_stats.max_store_micros / 1000) + "ms, " +
+      std::to_string(state_stats.conflicts) + " conflicts, " +
+      std::to_string(state_stats.failures) + " failures</td></tr>";
+  if (node_store_ != NULL) {
+    const NodeStateStore::Stats node_stats = node_store_->stats();
+    result += "<tr><td>Node store:</td><td>" +
+        std::to_string(node_stats.pending) + " pending, " +
+        std::to_string(node_stats.batches) + " batches, " +
+        std::to_string(node_stats.compactions) + " compactions, " +
+        std::to_string(node_stats.shards_written) + " shards written, " +
+        std::to_string(node_stats.max_variable_bytes / 1024) +
+        "kB largest variable, last " +
+        std::to_string(node_stats.last_write_micros / 1000) + "ms, max " +
+        std::to_string(node_stats.max_write_micros / 1000) + "ms, " +
+        std::to_string(node_stats.failures) + " failures</td></tr>";
+  }
+
+  result += "<tr class='hostbox'><td>API: </td><td>" +  ServiceState_TaskState_Name(cluster->api.state()) +
+      " " + cluster->api.task_id();
+  result += "<div class=\"details\"><pre>" + cluster->api.DebugString() + "</pre></div></td></tr>";
+
+  result += "<tr class='hostbox'><td>S3: </td><td>" +  ServiceState_TaskState_Name(cluster->s3.state()) +
+      " " + cluster->s3.task_id();
+  result += "<div class=\"details\"><pre>" + cluster->s3.DebugString() + "</pre></div></td></tr>";
+
+  result += "<tr class='hostbox'><td>Console: </td><td>" +  ServiceState_TaskState_Name(cluster->console.state()) +
+      " " + cluster->console.task_id();
+  result += "<div class=\"details\"><pre>" + cluster->console.DebugString() + "</pre></div></td></tr>";
+  result += "</tbody></table>\n\n";
+
+  quobyte::PageFragments page;
+  page.push_back(std::make_shared<const std::string>(std::move(result)));
+  status_page_.renderNodes(*cluster, &page);
+  page.push_back(std::make_shared<const std::string>("</body></html>"));
+  return page;
+}
+
 std::string QuobyteScheduler::handleHTTP(
     const std::string& method,
     const std::string& path,
     const std::string& data) {
-  LOG(INFO) << method << " request to " << path << " with body '" << data <<"'";
-  if (method == "GET" && path == kArchiveUrl) {
-    int fd = open("executor/executor.tar.gz", O_RDONLY);
-    if (fd == -1) {
-      LOG(ERROR) << "Could not open executor";
-      return "";
-    }
-    std::unique_ptr<char[]> buffer(new char[kBufferSize]);
-    int bytes = read(fd, buffer.get(), kBufferSize);
-    if (bytes <=0 || bytes == kBufferSize) {
-      LOG(FATAL) << "Binary too large " << bytes;
-    }
-    close(fd);
-    return std::string(buffer.get(), bytes);
-  } else if (path.find(kVersionAPIUrl) == 0) {
+  if (method == "GET") {
+    VLOG(1) << method << " request to " << path;
+  } else {
+    LOG(INFO) << method << " request to " << path << " with body '" << data
+        << "'";
+  }
+  if (path.find(kVersionAPIUrl) == 0) {
     if (method == "POST") {
+      const std::string previous = state_->target_version();
       state_->set_target_version(data);
+      if (previous != data) {
+        std::string event = EventStart(now(), "");
+        event += ",\"target_version\":";
+        AppendJsonString(data, &event);
+        event += ",\"previous\":";
+        AppendJsonString(previous, &event);
+        events_.append("version", event + "}");
+        events_.notify();
+      }
+      demand_.reviveAll(NULL);
       if (data.empty()) {
         LOG(INFO) << "Will shutdown tasks";
       } else {
         LOG(INFO) << "Rolling out version " << data;
       }
     }
-    return state_->state().target_version();
+    return state_->target_version();
   } else if (method == "GET" && path == kHealthUrl) {
-    int running = countRunningServices();
-    LOG(INFO) << "Health check";
+    int running = snapshot()->running_services;
+    VLOG(1) << "Health check";
     return "OK. Running services: " + std::to_string(running);
   } else if (method == "GET" && path == "/") {
     std::string result;
-    result = "<html><head>";
-    result += "<style>.details { display: none; } .hostbox:hover .details { display:block; position:absolute; background:#fafafa; border: 2px solid lightgray; }</style>";
-    result += "</head><body style='font-family: sans-serif'>";
-    result += "<h1><img style='vertical-align:middle; padding:3px' src=\"http://www.quobyte.com/favicon-128.png\" width=\"60\">Quobyte Mesos Framework Scheduler</h1>\n";
-    result += "<table><tbody>";
-    result += "<tr><td>Deployed container version:</td><td>";
-    result += state_->state().target_version().empty() ?
-        "No version to deploy (set via REST API)" : state_->state().target_version();
-    result += "<div class=\"details\">" + state_->state().DebugString() + "</div></td></tr>";
-
-    result += "<tr class='hostbox'><td>API: </td><td>" +  ServiceState_TaskState_Name(api_state_.state()) +
-        " " + api_state_.task_id();
-    result += "<div class=\"details\"><pre>" + api_state_.DebugString() + "</pre></div></td></tr>";
-
-    result += "<tr class='hostbox'><td>S3: </td><td>" +  ServiceState_TaskState_Name(s3_state_.state()) +
-        " " + s3_state_.task_id();
-    result += "<div class=\"details\"><pre>" + s3_state_.DebugString() + "</pre></div></td></tr>";
-
-    result += "<tr class='hostbox'><td>Console: </td><td>" +  ServiceState_TaskState_Name(console_state_.state()) +
-        " " + console_state_.task_id();
-    result += "<div class=\"details\"><pre>" + console_state_.DebugString() + "</pre></div></td></tr>";
-    result += "</tbody></table>\n\n";
-
-    for (const auto& node : nodes_) {
-      const std::set<int> device_types(
-          node.second.device_type().begin(),
-          node.second.device_type().end());
-
-      result += "<div class='hostbox' style=\"display: inline-block; border: 1px solid lightgray; padding: 3px; margin: 3px\"><h3>" +
-          node.first +
-          "<div class=\"details\"><pre>" + node.second.DebugString() + "</pre></div>" +
-          "</h3>";
-
-      std::string device_msg = "no device";
-      if (!node.second.device_types_valid()) {
-        device_msg = "waiting for prober";
-      }
-      result += "<table><tbody>";
-      result += renderService("Registry", device_types.count(quobyte::DeviceType::REGISTRY) > 0, node.second, node.second.registry());
-      result += renderService("Data", device_types.count(quobyte::DeviceType::DATA) > 0, node.second, node.second.data());
-      result += renderService("Metadata", device_types.count(quobyte::DeviceType::METADATA) > 0, node.second, node.second.metadata());
-      result += "</table></tbody>";
-      result += "</div>\n";
+    for (const std::shared_ptr<const std::string>& fragment :
+         renderStatusPage()) {
+      result += *fragment;
     }
-
-    result += "</body></html>";
     return result;
   } else {
     return "";
@@ -8,38 +8,36 @@
 
 #include <string>
 #include <cstdint>
+#include <memory>
+#include <unordered_map>
 
 #include <mesos/resources.hpp>
 #include <mesos/scheduler.hpp>
-#include <mesos/state/zookeeper.hpp>
-#include <mesos/state/state.hpp>
 
+#include "clock.hpp"
+#include "cluster_snapshot.hpp"
+#include "decision_trace.hpp"
+#include "event_log.hpp"
+#include "http_server.hpp"
+#include "metrics.hpp"
+#include "node_index.hpp"
+#include "node_registry.hpp"
+#include "node_state_store.hpp"
+#include "offer_demand.hpp"
+#include "resource_vector.hpp"
+#include "scheduler_state.hpp"
+#include "status_page.hpp"
+#include "task_id.hpp"
+#include "task_latency.hpp"
 #include "quobyte.pb.h"
 
-class SchedulerStateProxy {
- public:
-  SchedulerStateProxy(mesos::state::State* state,
-                      const std::string& path);
-  void erase();
-  std::string framework_id();
-  void set_framework_id(const std::string& id);
-
-  void set_target_version(const std::string& version);
-
-  const quobyte::SchedulerState& state();
-
- private:
-  void writeback();
-
-  mesos::state::State* state_;
-  const std::string path_;
-  quobyte::SchedulerState data_;
-};
-
 class QuobyteScheduler : public mesos::Scheduler {
 public:
+  // Starts with the nodes persisted in node_store, if given.
   QuobyteScheduler(SchedulerStateProxy* state,
-                   mesos::FrameworkInfo* framework);
+                   NodeStateStore* node_store,
+                   mesos::FrameworkInfo* framework,
+                   const Clock* clock);
   virtual ~QuobyteScheduler() {}
 
   virtual void registered(mesos::SchedulerDriver* driver,
@@ -74,13 +72,62 @@ public:
                             const mesos::SlaveID& slaveID,
                             int status) override;
 
+  // Registers the files, pages and APIs served next to handleHTTP(): the
+  // executor archive, the status page and the JSON API.
+  void registerHttpHandlers(quobyte::HttpServer* http);
+  // The status page, from any thread.
+  quobyte::PageFragments renderStatusPage();
+  const StatusPage& statusPage() const {
+    return status_page_;
+  }
+  const NodeIndex& nodeIndex() const {
+    return node_index_;
+  }
+  EventLog* eventLog() {
+    return &events_;
+  }
+  const TaskLatencies& taskLatencies() const {
+    return task_latencies_;
+  }
+  // Counters, latencies and service states in the Prometheus text format.
+  std::string renderMetrics() const;
   std::string handleHTTP(const std::string& method,
                          const std::string& path,
                          const std::string& data);
 
+  // Revives suppressed or filtered offers once they are needed again.
+  // Called about once a second, from any thread.
+  void tick(mesos::SchedulerDriver* driver);
+
+  // From the driver thread, others use snapshot().
+  int countRunningServices();
+  // Nodes whose device types are known.
+  size_t countProbedNodes() const;
+
+  // The latest published view of the cluster, from any thread.
+  std::shared_ptr<const ClusterSnapshot> snapshot() const;
+
  private:
-  mesos::TaskInfo makeTask(const std::string& service_id,
-                           const std::string& name,
+  // Ready-made task of a service for the current target version, a launch
+  // only fills in the task id, agent and the host part of the command.
+  struct TaskTemplate {
+    bool valid = false;
+    mesos::TaskInfo task;
+    std::string command_prefix;
+    std::string command_suffix;
+  };
+
+  const TaskTemplate& taskTemplate(ServiceType service,
+                                   const std::string& service_id,
+                                   uint16_t rpcPort,
+                                   uint16_t httpPort);
+  void buildTaskTemplate(const std::string& service_id,
+                         uint16_t rpcPort,
+                         uint16_t httpPort,
+                         TaskTemplate* task_template);
+
+  mesos::TaskInfo makeTask(ServiceType service,
+                           const std::string& service_id,
                            const std::string& task_id,
                            const std::string& host_name,
                            uint16_t rpcPort,
@@ -88,31 +135,111 @@ public:
                            const mesos::SlaveID& slave_id);
 
   void prepareServiceResources(
+      ServiceType service,
       const std::string& service_id,
       uint16_t rpcPort,
       uint16_t httpPort,
       const std::string& resources);
 
   quobyte::ServiceState* getService(
-      quobyte::NodeState* node, const std::string& service);
+      quobyte::NodeState* node, ServiceType service);
+
+  // Registers the id of the next incarnation of the service on the node
+  // and makes it the service's current task.
+  const std::string& newTaskId(ServiceType service,
+                               NodeRegistry::Index index,
+                               quobyte::ServiceState* service_state);
 
   void reconcileHost(
       mesos::SchedulerDriver* driver,
       const mesos::Offer& offer);
-
-  void createHost(const std::string& hostname,
+  // Confirms all tasks of the restored or current view.
+  void reconcileKnownTasks(mesos::SchedulerDriver* driver);
+
+  void restoreNodes();
+  // Queues the node, or the singleton services, for the node store and
+  // the next snapshot.
+  void markDirty(ServiceType service, NodeRegistry::Index index);
+  // Hands the changes since the last call to the node store and publishes
+  // a new snapshot. New nodes are published even when not marked.
+  void publishDirty();
+
+  NodeRegistry::Index createHost(const std::string& hostname,
       const std::string& slave_id);
 
-  int countRunningServices();
+  // The offers of an agent and the tasks placed on them so far.
+  struct OfferPlacement {
+    std::vector<const mesos::Offer*> offers;
+    NodeRegistry::Index node;
+    ResourceVector remaining;
+    std::vector<mesos::TaskInfo> tasks;
+  };
+
+  // Puts a service that runs once per cluster on the best offer of the
+  // batch: nodes whose core services run, preferring nodes without data
+  // and metadata services, then the one with the most spare capacity.
+  void placeSingleton(ServiceType service,
+                      const std::string& service_id,
+                      uint16_t rpcPort,
+                      uint16_t httpPort,
+                      quobyte::ServiceState* service_state,
+                      std::vector<OfferPlacement>* placements);
+
+  // Records what became of the offers of a node, or a decision about one
+  // of its services.
+  void traceDecision(NodeRegistry::Index index,
+                     DecisionTrace::Decision decision,
+                     size_t offers = 0);
+  void traceDecision(NodeRegistry::Index index,
+                     DecisionTrace::Decision decision,
+                     ServiceType service);
+
+  // When the node next needs an offer, now if it has pending work.
+  int64_t nextOfferDue(const quobyte::NodeState& node) const;
+  void updateOfferDemand(mesos::SchedulerDriver* driver,
+                         NodeRegistry::Index index);
+
+  int64_t now() const;
 
   SchedulerStateProxy* state_;
+  NodeStateStore* node_store_;
   mesos::FrameworkInfo* framework_;
+  const Clock* clock_;
 
   std::map<std::string, mesos::Resources> resources_;
+  // The same demands for offer fit checks.
+  ResourceLayout resource_layout_;
+  ResourceVector demands_[SERVICE_TYPE_COUNT];
 
   quobyte::ServiceState api_state_;
   quobyte::ServiceState console_state_;
   quobyte::ServiceState s3_state_;
-  std::map<std::string, quobyte::NodeState> nodes_;
+  NodeRegistry nodes_;
+  TaskIdTable task_ids_;
+  OfferDemand demand_;
+  std::vector<NodeRegistry::Index> dirty_nodes_;
+  std::vector<bool> node_dirty_;
+  bool services_dirty_ = false;
+  // Only accessed through std::atomic_load and std::atomic_store.
+  std::shared_ptr<const ClusterSnapshot> snapshot_;
+  StatusPage status_page_;
+  // Of the published nodes, for the JSON API.
+  NodeIndex node_index_;
+  // State changes for /v1/events.
+  EventLog events_;
+  // Off while the restored nodes are published, they did not change.
+  bool log_events_ = false;
+  // Launch and state change times of the tasks, for /v1/task_latency.
+  TaskLatencies task_latencies_;
+  // Why offers were declined or taken, for /v1/decisions.
+  DecisionTrace decisions_;
+  // When the pending probe request of a node was sent.
+  std::unordered_map<NodeRegistry::Index, int64_t> probe_sent_micros_;
+  Counter* launches_[SERVICE_TYPE_COUNT];
+
+  // Built on first use, invalidated when the target version changes.
+  TaskTemplate templates_[SERVICE_TYPE_COUNT];
+  std::string templates_version_;
+  std::string templates_framework_id_;
 };
 
@@ -0,0 +1,429 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <mesos/scheduler.hpp>
+#include <mesos/state/in_memory.hpp>
+#include <mesos/state/state.hpp>
+
+#include "async_log.hpp"
+#include "benchmarks.hpp"
+#include "leader_election.hpp"
+#include "offer_simulator.hpp"
+#include "scheduler.hpp"
+
+DEFINE_string(benchmark, "offers",
+              "Benchmark to run: offers, registry, resources, state, "
+              "storage, http, archive, status_page, api");
+DEFINE_int32(hosts, 2000, "Number of simulated agents");
+DEFINE_int32(rounds, 30, "Number of allocation rounds");
+DEFINE_double(simulated_hours, 0,
+              "Run for this much simulated time instead of --rounds");
+DEFINE_double(task_failures_per_hour, 0,
+              "Fraction of running service tasks failing per simulated hour");
+DEFINE_int32(offers_per_callback, 0,
+             "Offers per resourceOffers callback, 0 for all in one");
+DEFINE_int32(offers_per_agent, 1,
+             "Offers each agent's resources are split into");
+DEFINE_string(agent_resources,
+              "cpus:32;mem:262144;disk:4000000;"
+              "ports:[80-80,8000-9000,21000-22000]",
+              "Resources of each simulated agent");
+DEFINE_int32(data_every, 1,
+             "Every n-th simulated agent carries a data device, 0 for none");
+DEFINE_int32(metadata_every, 10,
+             "Every n-th simulated agent carries a metadata device, "
+             "0 for none");
+DEFINE_int32(offer_interval_s, 1,
+             "Simulated seconds between allocation rounds");
+DEFINE_string(target_version, "bench",
+              "Quobyte version to roll out in the simulation");
+DEFINE_bool(persist_node_state, true,
+            "Persist the node states, as the scheduler does by default");
+DEFINE_int32(restart_after_rounds, 0,
+             "Restart the scheduler after this many rounds and run until it "
+             "converges again, at most --rounds more rounds");
+DEFINE_bool(standby, false,
+            "With --restart_after_rounds, a standby scheduler follows the "
+            "node state journal and takes over the lease from the first");
+DEFINE_int32(restart_clock_offset_s, 0,
+             "With --restart_after_rounds, the restarted scheduler's clock "
+             "is off by this much, like after a reboot or on another host. "
+             "Fails unless it probes all nodes again within the probe and "
+             "prober keepalive intervals");
+DEFINE_bool(standby_release, false,
+            "With --standby, the first scheduler compacts the journal and "
+            "releases the lease instead of letting it expire");
+DEFINE_int32(leader_lease_ms, 5000, "Leader lease for --standby");
+DEFINE_int32(scrape_threads, 0,
+             "Threads requesting /v1/health and the status page while the "
+             "offers are simulated");
+DECLARE_int32(http_event_batch_ms);
+DECLARE_int32(node_journal_batches);
+DECLARE_int32(probe_interval_s);
+DECLARE_int32(probe_executor_keepalive_interval_s);
+DEFINE_int32(event_watchers, 0,
+             "Threads following the scheduler's event log like /v1/events "
+             "watchers while the offers are simulated");
+DEFINE_int32(async_log_queue_size, 0,
+             "Write the log files from a background thread with a queue of "
+             "this many messages, like quobyte-mesos does; 0 logs "
+             "synchronously");
+DEFINE_int32(log_stall_ms, 0,
+             "Stall every 1000th write to the log files this long, like a "
+             "busy log disk");
+DEFINE_bool(print_metrics, false,
+            "Print the scheduler's /metrics page after the offers run");
+DEFINE_int32(max_offer_p99_us, 0,
+             "Fail if the resourceOffers p99 latency exceeds this, 0 disables");
+DEFINE_int32(max_status_p99_us, 0,
+             "Fail if the statusUpdate p99 latency exceeds this, 0 disables");
+
+static int64_t MicrosNow() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A log file on a busy disk: every 1000th write blocks.
+// Another epoch of the same clock.
+class OffsetClock : public Clock {
+ public:
+  OffsetClock(const Clock* clock, int64_t offset_micros)
+      : clock_(clock), offset_micros_(offset_micros) {}
+
+  virtual int64_t nowMicros() const override {
+    return clock_->nowMicros() + offset_micros_;
+  }
+
+ private:
+  const Clock* clock_;
+  const int64_t offset_micros_;
+};
+
+class StallingLogFile : public google::base::Logger {
+ public:
+  explicit StallingLogFile(google::LogSeverity severity)
+      : severity_(severity), file_(google::base::GetLogger(severity)) {
+    google::base::SetLogger(severity_, this);
+  }
+  virtual ~StallingLogFile() {
+    google::base::SetLogger(severity_, file_);
+  }
+
+  virtual void Write(bool force_flush,
+                     time_t timestamp,
+                     const char* message,
+                     int length) override {
+    if (++writes_ % 1000 == 0) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(FLAGS_log_stall_ms));
+    }
+    file_->Write(force_flush, timestamp, message, length);
+  }
+
+  virtual void Flush() override {
+    file_->Flush();
+  }
+
+  virtual uint32_t LogSize() override {
+    return file_->LogSize();
+  }
+
+ private:
+  const google::LogSeverity severity_;
+  google::base::Logger* file_;
+  uint64_t writes_ = 0;
+};
+
+static int RunOfferBenchmark() {
+  std::vector<std::unique_ptr<StallingLogFile>> stalling_files;
+  if (FLAGS_log_stall_ms > 0) {
+    for (int severity = 0; severity < google::NUM_SEVERITIES; ++severity) {
+      stalling_files.emplace_back(new StallingLogFile(severity));
+    }
+  }
+  std::unique_ptr<AsyncLogWriter> log_writer;
+  if (FLAGS_async_log_queue_size > 0) {
+    log_writer.reset(new AsyncLogWriter(FLAGS_async_log_queue_size));
+  }
+  mesos::state::InMemoryStorage storage;
+  mesos::state::State state_storage(&storage);
+  SchedulerStateProxy state_proxy(&state_storage, "scheduler-bench");
+  state_proxy.set_target_version(FLAGS_target_version);
+
+  mesos::FrameworkInfo framework;
+  framework.set_user("");
+  framework.set_name("quobyte-bench");
+  framework.set_webui_url("http://localhost:7888");
+  SimulatedClock clock;
+  OffsetClock restart_clock(&clock, FLAGS_restart_clock_offset_s * 1000000LL);
+  const std::string node_path = "scheduler-bench-nodes";
+  std::unique_ptr<NodeStateStore> node_store;
+  if (FLAGS_persist_node_state) {
+    node_store.reset(new NodeStateStore(&state_storage, node_path));
+  }
+  std::unique_ptr<QuobyteScheduler> scheduler(
+      new QuobyteScheduler(&state_proxy, node_store.get(), &framework, &clock));
+
+  SimulatorConfig config;
+  config.hosts = FLAGS_hosts;
+  config.offers_per_callback = FLAGS_offers_per_callback;
+  config.offer_interval_s = FLAGS_offer_interval_s;
+  config.task_failures_per_hour = FLAGS_task_failures_per_hour;
+  config.offers_per_agent = FLAGS_offers_per_agent;
+  config.agent_resources = FLAGS_agent_resources;
+  config.data_every = FLAGS_data_every;
+  config.metadata_every = FLAGS_metadata_every;
+
+  int rounds = FLAGS_rounds;
+  if (FLAGS_simulated_hours > 0) {
+    rounds = static_cast<int>(
+        FLAGS_simulated_hours * 3600 / FLAGS_offer_interval_s);
+  }
+
+  OfferSimulator simulator(scheduler.get(), &clock, config);
+  bool restart_failed = false;
+  simulator.registerFramework();
+  if (FLAGS_restart_after_rounds <= 0) {
+    // Nine health checks per status page, like monitoring and a dashboard.
+    std::atomic<bool> scraping(true);
+    std::atomic<uint64_t> scrapes(0);
+    std::vector<std::thread> scrapers;
+    for (int i = 0; i < FLAGS_scrape_threads; ++i) {
+      scrapers.emplace_back([&]() {
+        uint64_t requests = 0;
+        while (scraping.load()) {
+          scheduler->handleHTTP(
+              "GET", requests % 10 == 9 ? "/" : "/v1/health", "");
+          ++requests;
+        }
+        scrapes += requests;
+      });
+    }
+    // Woken up by the log in batches, like the HTTP server's event streams.
+    std::mutex events_lock;
+    std::condition_variable events_changed;
+    EventLog* events = scheduler->eventLog();
+    events->setListener([&]() {
+      std::lock_guard<std::mutex> lock(events_lock);
+      events_changed.notify_all();
+    });
+    std::atomic<uint64_t> watcher_bytes(0);
+    std::atomic<uint64_t> watcher_reads(0);
+    const uint64_t first_event = events->next();
+    for (int i = 0; i < FLAGS_event_watchers; ++i) {
+      scrapers.emplace_back([&]() {
+        uint64_t next = first_event;
+        std::string out;
+        while (scraping.load()) {
+          out.clear();
+          events->read(&next, &out);
+          watcher_bytes += out.size();
+          ++watcher_reads;
+          {
+            std::unique_lock<std::mutex> lock(events_lock);
+            events_changed.wait_for(lock, std::chrono::seconds(1));
+          }
+          std::this_thread::sleep_for(
+              std::chrono::milliseconds(FLAGS_http_event_batch_ms));
+        }
+      });
+    }
+    simulator.run(rounds);
+    scraping.store(false);
+    for (std::thread& scraper : scrapers) {
+      scraper.join();
+    }
+    events->setListener(nullptr);
+    if (FLAGS_event_watchers > 0) {
+      std::cout << "events: " << events->next() - first_event << " logged, "
+          << FLAGS_event_watchers << " watchers read "
+          << watcher_bytes.load() / FLAGS_event_watchers / 1024
+          << "kB each in " << watcher_reads.load() / FLAGS_event_watchers
+          << " reads\n";
+    }
+    if (FLAGS_scrape_threads > 0) {
+      std::cout << "scrapes: " << scrapes.load() << " by "
+          << FLAGS_scrape_threads << " threads, snapshot generation "
+          << scheduler->snapshot()->generation << "\n";
+    }
+  } else {
+    // Both schedulers share the in-memory state store.
+    const int64_t lease_micros = FLAGS_leader_lease_ms * 1000LL;
+    LeaderElection leader(&state_storage, "scheduler-bench-leader",
+                          "leader", &clock, lease_micros);
+    LeaderElection standby(&state_storage, "scheduler-bench-leader",
+                           "standby", &clock, lease_micros);
+    std::unique_ptr<NodeStateStore> standby_store;
+    if (FLAGS_standby) {
+      CHECK(leader.poll());
+      standby_store.reset(new NodeStateStore(&state_storage, node_path));
+    }
+    for (int round = 0; round < FLAGS_restart_after_rounds; ++round) {
+      simulator.run(1);
+      if (FLAGS_standby) {
+        CHECK(leader.poll());
+        CHECK(!standby.poll());
+        standby_store->follow();
+      }
+    }
+    const int running = scheduler->countRunningServices();
+    const size_t probed = scheduler->countProbedNodes();
+
+    // The store writes what is pending before it goes away.
+    scheduler.reset();
+    if (FLAGS_standby && FLAGS_standby_release) {
+      // Hands over like quobyte-mesos on shutdown. The last batch compacts
+      // and expunges journal batches the standby has not followed yet.
+      const int32_t journal_batches = FLAGS_node_journal_batches;
+      FLAGS_node_journal_batches = 1;
+      node_store.reset();
+      FLAGS_node_journal_batches = journal_batches;
+      leader.release();
+      CHECK(standby.poll());
+      std::cout << "takeover: lease released, "
+          << standby_store->stats().batches_followed
+          << " journal batches followed\n";
+      standby_store->setTerm(standby.term());
+      state_proxy.setTerm(standby.term());
+      node_store = std::move(standby_store);
+    } else if (FLAGS_standby) {
+      // The leader stops renewing, the standby waits out the lease.
+      node_store.reset();
+      const int64_t wait_start = clock.nowMicros();
+      const int64_t poll_micros = std::max<int64_t>(lease_micros / 10, 1);
+      while (!standby.poll()) {
+        clock.advanceMicros(poll_micros);
+        standby_store->follow();
+      }
+      std::cout << "takeover: lease acquired after "
+          << (clock.nowMicros() - wait_start) / 1000 << "ms simulated, "
+          << standby_store->stats().batches_followed
+          << " journal batches followed\n";
+      standby_store->setTerm(standby.term());
+      state_proxy.setTerm(standby.term());
+      node_store = std::move(standby_store);
+    } else if (node_store) {
+      node_store.reset(new NodeStateStore(&state_storage, node_path));
+    }
+    const RecordingSchedulerDriver::Counters before =
+        simulator.driver().counters();
+    const int64_t start = MicrosNow();
+    const int64_t start_s = simulator.sim_time_s();
+    scheduler.reset(new QuobyteScheduler(
+        &state_proxy, node_store.get(), &framework, &restart_clock));
+    simulator.failover(scheduler.get());
+    int restart_rounds = 0;
+    bool converged = false;
+    while (restart_rounds < rounds) {
+      converged = scheduler->countRunningServices() >= running &&
+          scheduler->countProbedNodes() >= probed;
+      if (converged) {
+        break;
+      }
+      simulator.run(1);
+      ++restart_rounds;
+    }
+    const RecordingSchedulerDriver::Counters& after =
+        simulator.driver().counters();
+    std::cout << "restart: " << (converged ? "converged" : "NOT converged")
+        << " after " << restart_rounds << " rounds ("
+        << simulator.sim_time_s() - start_s << "s simulated, "
+        << (MicrosNow() - start) / 1000 << "ms wall)"
+        << ", launched " << after.tasks_launched - before.tasks_launched
+        << ", probes " << after.messages - before.messages
+        << ", reconciled " << after.tasks_reconciled - before.tasks_reconciled
+        << ", " << running << " services on " << probed << " probed nodes\n";
+    if (FLAGS_restart_clock_offset_s != 0) {
+      // Restored times of the old clock must not hold off the probes.
+      const uint64_t messages = after.messages;
+      // A prober that was not running is relaunched after its keepalive.
+      simulator.run((FLAGS_probe_interval_s +
+                     FLAGS_probe_executor_keepalive_interval_s) /
+                        FLAGS_offer_interval_s + 2);
+      const uint64_t probes = simulator.driver().counters().messages - messages;
+      std::cout << "clock offset: " << probes << " probes after the "
+          << "restart\n";
+      if (probes < probed) {
+        std::cout << "FAIL: " << probed - probes << " nodes not probed\n";
+        restart_failed = true;
+      }
+    }
+  }
+  simulator.report(std::cout);
+  if (log_writer) {
+    std::cout << "log writer: " << log_writer->dropped()
+        << " messages dropped\n";
+  }
+  if (node_store) {
+    node_store->flush();
+    const NodeStateStore::Stats stats = node_store->stats();
+    std::cout << "node store: " << stats.batches << " batches, "
+        << stats.compactions << " compactions, "
+        << stats.shards_written << " shards written, "
+        << stats.bytes_written / 1024 << "kB written, largest variable "
+        << stats.max_variable_bytes / 1024 << "kB, max write "
+        << stats.max_write_micros / 1000 << "ms\n";
+  }
+  if (FLAGS_print_metrics) {
+    std::cout << scheduler->renderMetrics();
+  }
+
+  int status = restart_failed ? 1 : 0;
+  if (FLAGS_max_offer_p99_us > 0 &&
+      simulator.offer_latency().percentile(0.99) > FLAGS_max_offer_p99_us) {
+    std::cout << "FAIL: resourceOffers p99 above "
+        << FLAGS_max_offer_p99_us << "us\n";
+    status = 1;
+  }
+  if (FLAGS_max_status_p99_us > 0 &&
+      simulator.status_latency().percentile(0.99) > FLAGS_max_status_p99_us) {
+    std::cout << "FAIL: statusUpdate p99 above "
+        << FLAGS_max_status_p99_us << "us\n";
+    status = 1;
+  }
+  return status;
+}
+
+int main(int argc, char* argv[]) {
+  gflags::SetUsageMessage("Quobyte Mesos framework benchmarks");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  if (FLAGS_benchmark == "offers") {
+    return RunOfferBenchmark();
+  } else if (FLAGS_benchmark == "registry") {
+    return RunRegistryBenchmark();
+  } else if (FLAGS_benchmark == "resources") {
+    return RunResourceBenchmark();
+  } else if (FLAGS_benchmark == "state") {
+    return RunStateBenchmark();
+  } else if (FLAGS_benchmark == "storage") {
+    return RunStorageBenchmark();
+  } else if (FLAGS_benchmark == "http") {
+    return RunHttpBenchmark();
+  } else if (FLAGS_benchmark == "archive") {
+    return RunArchiveBenchmark();
+  } else if (FLAGS_benchmark == "status_page") {
+    return RunStatusPageBenchmark();
+  } else if (FLAGS_benchmark == "api") {
+    return RunApiBenchmark();
+  }
+  std::cerr << "Unknown benchmark " << FLAGS_benchmark << std::endl;
+  return 1;
+}
@@ -0,0 +1,222 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "scheduler_state.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "metrics.hpp"
+#include "state_encoding.hpp"
+
+DEFINE_int32(state_retry_backoff_ms, 100,
+             "Initial backoff before retrying a failed state store");
+
+static const int kMaxRetryBackoffMs = 10000;
+
+static Histogram* const write_latency = MetricsRegistry::instance()->histogram(
+    "quobyte_state_write_seconds", "Successful state store writes",
+    "store=\"scheduler\"");
+
+static int64_t MicrosNow() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SchedulerStateProxy::SchedulerStateProxy(
+    mesos::state::State* state,
+    const std::string& path)
+    : state_(state), path_(path), variable_(state->fetch(path).get()) {
+  bool legacy;
+  if (!DecodeState(variable_.value(), &data_, &legacy)) {
+    LOG(FATAL) << "Could not parse framework state " << path_;
+  }
+  LOG(INFO) << "Initial framework state: " << data_.ShortDebugString();
+  term_ = data_.term();
+  writer_ = std::thread(&SchedulerStateProxy::writeLoop, this);
+  if (legacy) {
+    LOG(INFO) << "Converting framework state from text format";
+    std::lock_guard<std::mutex> lock(lock_);
+    mutated();
+  }
+}
+
+SchedulerStateProxy::~SchedulerStateProxy() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stopping_ = true;
+  }
+  changed_.notify_all();
+  writer_.join();
+}
+
+void SchedulerStateProxy::setTerm(uint64_t term) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (term_ > term) {
+    LOG(FATAL) << "Framework state " << path_ << " was written in term "
+        << term_ << ", after ours " << term;
+  }
+  term_ = term;
+  fencing_ = true;
+  // Stores the term, a leader of an earlier term then conflicts with it.
+  mutated();
+}
+
+std::string SchedulerStateProxy::framework_id() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return data_.framework_id_value();
+}
+
+void SchedulerStateProxy::set_framework_id(const std::string& id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  data_.set_framework_id_value(id);
+  mutated();
+}
+
+std::string SchedulerStateProxy::target_version() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return data_.target_version();
+}
+
+void SchedulerStateProxy::set_target_version(const std::string& version) {
+  std::lock_guard<std::mutex> lock(lock_);
+  data_.set_target_version(version);
+  mutated();
+}
+
+quobyte::SchedulerState SchedulerStateProxy::state() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return data_;
+}
+
+void SchedulerStateProxy::erase() {
+  std::lock_guard<std::mutex> lock(lock_);
+  data_.Clear();
+  mutated();
+}
+
+void SchedulerStateProxy::flush() {
+  std::unique_lock<std::mutex> lock(lock_);
+  const uint64_t version = version_;
+  stored_.wait(lock, [this, version] {
+    return stored_version_ >= version || stopping_ || fenced_;
+  });
+}
+
+SchedulerStateProxy::Stats SchedulerStateProxy::stats() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  Stats stats = stats_;
+  stats.pending = version_ - stored_version_;
+  return stats;
+}
+
+void SchedulerStateProxy::mutated() {
+  ++version_;
+  changed_.notify_one();
+}
+
+void SchedulerStateProxy::writeLoop() {
+  int backoff_ms = 0;
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    changed_.wait(lock, [this] {
+      return stopping_ || version_ != stored_version_;
+    });
+    if (version_ == stored_version_) {
+      return;
+    }
+    const uint64_t version = version_;
+    quobyte::SchedulerState data = data_;
+    data.set_term(term_);
+    lock.unlock();
+
+    const int64_t start = MicrosNow();
+    const bool stored = store(data);
+    const int64_t micros = MicrosNow() - start;
+
+    lock.lock();
+    if (stored) {
+      backoff_ms = 0;
+      stored_version_ = version;
+      ++stats_.stores;
+      stats_.last_store_micros = micros;
+      write_latency->observe(micros);
+      stats_.max_store_micros = std::max(stats_.max_store_micros, micros);
+      stored_.notify_all();
+      continue;
+    }
+    if (stopping_ || fenced_) {
+      LOG(ERROR) << "Dropping unsaved framework state "
+          << data_.ShortDebugString();
+      stored_.notify_all();
+      return;
+    }
+    backoff_ms = std::min(
+        std::max(2 * backoff_ms, FLAGS_state_retry_backoff_ms),
+        kMaxRetryBackoffMs);
+    changed_.wait_for(lock, std::chrono::milliseconds(backoff_ms),
+                      [this] { return stopping_; });
+  }
+}
+
+bool SchedulerStateProxy::store(const quobyte::SchedulerState& data) {
+  const std::string serialized = EncodeState(data);
+  process::Future<Option<mesos::state::Variable>> stored =
+      state_->store(variable_.mutate(serialized));
+  stored.await();
+  if (!stored.isReady()) {
+    LOG(ERROR) << "Could not store " << path_ << ": "
+        << (stored.isFailed() ? stored.failure() : "discarded");
+    std::lock_guard<std::mutex> lock(lock_);
+    ++stats_.failures;
+    return false;
+  }
+  if (stored.get().isSome()) {
+    variable_ = stored.get().get();
+    return true;
+  }
+
+  // Someone else stored a newer version. Our state wins, as before, so
+  // fetch the current version and store again. Unless it was stored in a
+  // later term, by the leader that replaced us.
+  LOG(WARNING) << "Version conflict storing " << path_ << ", retrying";
+  bool fencing;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    ++stats_.conflicts;
+    fencing = fencing_;
+  }
+  process::Future<mesos::state::Variable> fetched = state_->fetch(path_);
+  fetched.await();
+  if (!fetched.isReady()) {
+    LOG(ERROR) << "Could not fetch " << path_ << ": "
+        << (fetched.isFailed() ? fetched.failure() : "discarded");
+    return false;
+  }
+  variable_ = fetched.get();
+  quobyte::SchedulerState current;
+  bool legacy;
+  if (fencing && DecodeState(variable_.value(), &current, &legacy) &&
+      current.term() > data.term()) {
+    LOG(ERROR) << path_ << " was written in term " << current.term()
+        << ", after ours " << data.term()
+        << ". Another scheduler leads, not writing the framework state";
+    std::lock_guard<std::mutex> lock(lock_);
+    fenced_ = true;
+    stored_.notify_all();
+    return false;
+  }
+  stored = state_->store(variable_.mutate(serialized));
+  stored.await();
+  if (stored.isReady() && stored.get().isSome()) {
+    variable_ = stored.get().get();
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,83 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <mesos/state/state.hpp>
+
+#include "quobyte.pb.h"
+
+// The framework state, kept in memory and written behind to the Mesos state
+// abstraction (ZooKeeper) by a background thread. Mutations return at once,
+// mutations made while a store is in flight are coalesced into the next one.
+class SchedulerStateProxy {
+ public:
+  struct Stats {
+    uint64_t stores = 0;
+    // Stores that found the variable changed by someone else.
+    uint64_t conflicts = 0;
+    uint64_t failures = 0;
+    // Mutations not stored yet.
+    uint64_t pending = 0;
+    int64_t last_store_micros = 0;
+    int64_t max_store_micros = 0;
+  };
+
+  SchedulerStateProxy(mesos::state::State* state,
+                      const std::string& path);
+  // Stores pending mutations.
+  ~SchedulerStateProxy();
+
+  // The lease term to write in, and stores it. A store that finds the
+  // state written in a later term stops the writer, the state of the new
+  // leader wins. Without it, the term of the stored state is kept.
+  void setTerm(uint64_t term);
+
+  void erase();
+  std::string framework_id();
+  void set_framework_id(const std::string& id);
+
+  std::string target_version();
+  void set_target_version(const std::string& version);
+
+  quobyte::SchedulerState state();
+
+  // Blocks until all mutations made so far are stored.
+  void flush();
+
+  Stats stats() const;
+
+ private:
+  void mutated();
+  void writeLoop();
+  bool store(const quobyte::SchedulerState& data);
+
+  mesos::state::State* state_;
+  const std::string path_;
+  // Last fetched or stored version, only used by the writer thread.
+  mesos::state::Variable variable_;
+
+  mutable std::mutex lock_;
+  std::condition_variable changed_;
+  std::condition_variable stored_;
+  quobyte::SchedulerState data_;
+  uint64_t version_ = 0;
+  uint64_t stored_version_ = 0;
+  bool stopping_ = false;
+  // Set once another leader wrote the state, nothing is stored after.
+  bool fenced_ = false;
+  bool fencing_ = false;
+  uint64_t term_ = 0;
+  Stats stats_;
+
+  std::thread writer_;
+};
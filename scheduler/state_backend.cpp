@@ -0,0 +1,27 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "state_backend.hpp"
+
+#include <glog/logging.h>
+#include <mesos/state/in_memory.hpp>
+#include <mesos/state/leveldb.hpp>
+#include <mesos/state/zookeeper.hpp>
+
+std::unique_ptr<mesos::state::Storage> CreateStateStorage(
+    const StateBackendConfig& config) {
+  std::unique_ptr<mesos::state::Storage> storage;
+  if (config.backend == "zookeeper") {
+    storage.reset(new mesos::state::ZooKeeperStorage(
+        config.zk_servers, Seconds(120), config.zk_path));
+  } else if (config.backend == "leveldb") {
+    storage.reset(new mesos::state::LevelDBStorage(config.leveldb_path));
+  } else if (config.backend == "in_memory") {
+    LOG(WARNING) << "State is kept in memory only and lost on restart";
+    storage.reset(new mesos::state::InMemoryStorage());
+  }
+  return storage;
+}
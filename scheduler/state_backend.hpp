@@ -0,0 +1,28 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <mesos/state/storage.hpp>
+
+// Where the framework and node states are kept, see --state_backend.
+struct StateBackendConfig {
+  // zookeeper, leveldb or in_memory.
+  std::string backend = "zookeeper";
+  std::string zk_servers;
+  std::string zk_path;
+  // LevelDB directory on the local disk.
+  std::string leveldb_path;
+};
+
+// Creates the storage behind mesos::state::State. The in_memory backend
+// keeps nothing across restarts and is meant for tests. Returns NULL
+// for an unknown backend.
+std::unique_ptr<mesos::state::Storage> CreateStateStorage(
+    const StateBackendConfig& config);
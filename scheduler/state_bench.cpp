@@ -0,0 +1,101 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+#include <glog/logging.h>
+#include <google/protobuf/text_format.h>
+
+#include "benchmarks.hpp"
+#include "quobyte.pb.h"
+#include "state_encoding.hpp"
+
+DEFINE_int32(state_iterations, 20,
+             "Encodes and decodes per case in the state benchmark");
+
+static int64_t NanosNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void FillService(const std::string& hostname, const char* type,
+                        quobyte::ServiceState* service) {
+  service->set_state(quobyte::ServiceState::RUNNING);
+  service->set_last_update_s(1450000000);
+  service->set_last_seen_s(1450000120);
+  service->set_last_message("TASK_RUNNING");
+  service->set_incarnation(3);
+  service->set_task_id(std::string(type) + "." + hostname + ".3");
+}
+
+// Runs fn for --state_iterations iterations and prints us per iteration.
+static void Measure(const char* name, size_t bytes,
+                    const std::function<void()>& fn) {
+  const int64_t start = NanosNow();
+  for (int i = 0; i < FLAGS_state_iterations; ++i) {
+    fn();
+  }
+  const int64_t elapsed = NanosNow() - start;
+  printf("%-40s %10.1f us (%zu bytes)\n", name,
+         static_cast<double>(elapsed) / 1000 / FLAGS_state_iterations, bytes);
+}
+
+// Text format against the binary envelope, for the node states of
+// --hosts agents running all services.
+int RunStateBenchmark() {
+  quobyte::NodeStateSnapshot snapshot;
+  for (int i = 0; i < FLAGS_hosts; ++i) {
+    quobyte::NodeState* node = snapshot.add_node();
+    const std::string hostname =
+        "agent" + std::to_string(i) + ".dc1.example.com";
+    node->set_hostname(hostname);
+    node->set_slave_id_value(
+        "2f3c4b1a-9d8e-4c7b-a6f5-e4d3c2b1a098-S" + std::to_string(i));
+    FillService(hostname, "prober", node->mutable_prober());
+    FillService(hostname, "registry", node->mutable_registry());
+    FillService(hostname, "metadata", node->mutable_metadata());
+    FillService(hostname, "data", node->mutable_data());
+    FillService(hostname, "client", node->mutable_client());
+    node->add_device_type(quobyte::DATA);
+    if (i % 10 == 0) {
+      node->add_device_type(quobyte::METADATA);
+    }
+    node->set_client_mount_point(true);
+    node->set_device_types_valid(true);
+    node->set_last_probe_s(1450000100);
+    node->set_last_offer_s(1450000121);
+  }
+
+  std::string text;
+  google::protobuf::TextFormat::PrintToString(snapshot, &text);
+  const std::string binary = EncodeState(snapshot);
+
+  Measure("text serialize", text.size(), [&snapshot] {
+    std::string out;
+    google::protobuf::TextFormat::PrintToString(snapshot, &out);
+  });
+  Measure("text parse", text.size(), [&text] {
+    quobyte::NodeStateSnapshot parsed;
+    CHECK(google::protobuf::TextFormat::ParseFromString(text, &parsed));
+  });
+  Measure("binary envelope serialize", binary.size(), [&snapshot] {
+    EncodeState(snapshot);
+  });
+  Measure("binary envelope parse", binary.size(), [&binary] {
+    quobyte::NodeStateSnapshot parsed;
+    bool legacy;
+    CHECK(DecodeState(binary, &parsed, &legacy) && !legacy);
+  });
+  Measure("legacy text through DecodeState", text.size(), [&text] {
+    quobyte::NodeStateSnapshot parsed;
+    bool legacy;
+    CHECK(DecodeState(text, &parsed, &legacy) && legacy);
+  });
+  return 0;
+}
@@ -0,0 +1,47 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "state_encoding.hpp"
+
+#include <glog/logging.h>
+#include <google/protobuf/text_format.h>
+
+#include "quobyte.pb.h"
+
+const uint32_t kStateFormatVersion = 1;
+
+std::string EncodeState(const google::protobuf::Message& message) {
+  quobyte::StateEnvelope envelope;
+  envelope.set_format_version(kStateFormatVersion);
+  envelope.set_payload_type(message.GetTypeName());
+  message.SerializePartialToString(envelope.mutable_payload());
+  return envelope.SerializeAsString();
+}
+
+bool DecodeState(const std::string& data,
+                 google::protobuf::Message* message,
+                 bool* legacy) {
+  message->Clear();
+  *legacy = false;
+  if (data.empty()) {
+    return true;
+  }
+  // Text format starts with a field name, which does not parse as an
+  // envelope of the right type.
+  quobyte::StateEnvelope envelope;
+  if (envelope.ParseFromString(data) &&
+      envelope.payload_type() == message->GetTypeName()) {
+    if (envelope.format_version() > kStateFormatVersion) {
+      LOG(ERROR) << message->GetTypeName() << " has format version "
+          << envelope.format_version() << ", this scheduler reads up to "
+          << kStateFormatVersion;
+      return false;
+    }
+    return message->ParsePartialFromString(envelope.payload());
+  }
+  *legacy = true;
+  return google::protobuf::TextFormat::ParseFromString(data, message);
+}
@@ -0,0 +1,27 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <google/protobuf/message.h>
+
+// Encoding of the state variables: a binary StateEnvelope carrying the
+// format version and the message type. Records in text format, as
+// written by earlier versions, are still read.
+
+extern const uint32_t kStateFormatVersion;
+
+std::string EncodeState(const google::protobuf::Message& message);
+
+// Parses data into message, an empty variable gives an empty message.
+// Sets *legacy if data was in text format. Returns false if data is
+// neither, or from a newer format version.
+bool DecodeState(const std::string& data,
+                 google::protobuf::Message* message,
+                 bool* legacy);
@@ -0,0 +1,98 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "status_page.hpp"
+
+#include <algorithm>
+#include <set>
+
+static std::string renderService(
+    const std::string& name,
+    bool has_device,
+    const quobyte::NodeState& node,
+    const quobyte::ServiceState& service) {
+  std::string device_msg = "no device";
+  if (!node.device_types_valid()) {
+    device_msg = "waiting for prober";
+  }
+
+  std::string extra;
+  if (has_device && service.state() != quobyte::ServiceState::RUNNING) {
+    extra = "style='background-color: yellow'";
+  }
+
+  return std::string("<tr><td>") + name + ": </td><td>"
+      + (has_device ? "found" : device_msg)
+      + " <span title=\"" +  service.last_message() + "\" " + extra + ">\n"
+      + ServiceState_TaskState_Name(service.state()) + "</span>"
+      + "</td></tr>\n";
+}
+
+static std::string renderNode(const quobyte::NodeState& node) {
+  const std::set<int> device_types(
+      node.device_type().begin(),
+      node.device_type().end());
+
+  std::string result = "<div class='hostbox' style=\"display: inline-block; border: 1px solid lightgray; padding: 3px; margin: 3px\"><h3>" +
+      node.hostname() +
+      "<div class=\"details\"><pre>" + node.DebugString() + "</pre></div>" +
+      "</h3>";
+  result += "<table><tbody>";
+  result += renderService("Registry", device_types.count(quobyte::DeviceType::REGISTRY) > 0, node, node.registry());
+  result += renderService("Data", device_types.count(quobyte::DeviceType::DATA) > 0, node, node.data());
+  result += renderService("Metadata", device_types.count(quobyte::DeviceType::METADATA) > 0, node, node.metadata());
+  result += "</table></tbody>";
+  result += "</div>\n";
+  return result;
+}
+
+void StatusPage::renderNodes(const ClusterSnapshot& cluster,
+                             quobyte::PageFragments* page) {
+  std::lock_guard<std::mutex> lock(lock_);
+  ++stats_.pages;
+  if (nodes_.size() < cluster.node_count) {
+    // Nodes are only ever added, and keep their hostname.
+    for (size_t index = nodes_.size(); index < cluster.node_count;
+         ++index) {
+      order_.push_back(index);
+    }
+    nodes_.resize(cluster.node_count);
+    std::sort(order_.begin(), order_.end(),
+              [&cluster](size_t a, size_t b) {
+                return cluster.node(a).hostname() <
+                    cluster.node(b).hostname();
+              });
+  }
+
+  page->reserve(page->size() + cluster.node_count);
+  for (size_t index : order_) {
+    if (index >= cluster.node_count) {
+      // Added by a newer snapshot than this one.
+      continue;
+    }
+    Node& node = nodes_[index];
+    const uint64_t generation = cluster.node_generation(index);
+    if (!node.html || node.generation != generation) {
+      std::shared_ptr<const std::string> html =
+          std::make_shared<const std::string>(renderNode(cluster.node(index)));
+      ++stats_.nodes_rendered;
+      // An older snapshot of a concurrent request does not replace a newer
+      // rendering.
+      if (!node.html || node.generation < generation) {
+        node.generation = generation;
+        node.html = html;
+      }
+      page->push_back(html);
+    } else {
+      page->push_back(node.html);
+    }
+  }
+}
+
+StatusPage::Stats StatusPage::stats() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return stats_;
+}
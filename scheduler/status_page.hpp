@@ -0,0 +1,47 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cluster_snapshot.hpp"
+#include "http_server.hpp"
+
+// Renders the nodes of the status page. Keeps the HTML of every node and
+// renders it again only when its generation in the snapshot changed, so
+// a page view mostly costs the nodes that changed since the last one.
+// Thread-safe.
+class StatusPage {
+ public:
+  struct Stats {
+    uint64_t pages = 0;
+    uint64_t nodes_rendered = 0;
+  };
+
+  // Appends one fragment per node, sorted by hostname.
+  void renderNodes(const ClusterSnapshot& cluster,
+                   quobyte::PageFragments* page);
+
+  Stats stats() const;
+
+ private:
+  struct Node {
+    uint64_t generation = 0;
+    std::shared_ptr<const std::string> html;
+  };
+
+  mutable std::mutex lock_;
+  // By NodeRegistry index.
+  std::vector<Node> nodes_;
+  // Indexes sorted by hostname.
+  std::vector<size_t> order_;
+  Stats stats_;
+};
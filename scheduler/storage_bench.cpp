@@ -0,0 +1,117 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <glog/logging.h>
+#include <mesos/state/state.hpp>
+
+#include "benchmarks.hpp"
+#include "node_state_store.hpp"
+#include "offer_simulator.hpp"
+#include "quobyte.pb.h"
+#include "scheduler_state.hpp"
+#include "state_backend.hpp"
+#include "state_encoding.hpp"
+
+DEFINE_string(storage_backends, "in_memory,leveldb",
+              "Comma separated state backends in the storage benchmark");
+DEFINE_int32(storage_writes, 1000,
+             "Framework state writes per backend in the storage benchmark");
+DEFINE_string(storage_zk, "",
+              "Zookeeper host:port for the zookeeper backend");
+DEFINE_string(storage_leveldb_path, "/tmp/quobyte-mesos-bench-state",
+              "LevelDB directory prefix, the process id is appended");
+
+DECLARE_int32(node_journal_interval_ms);
+
+static int64_t MicrosNow() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void BenchmarkBackend(const StateBackendConfig& config) {
+  std::unique_ptr<mesos::state::Storage> storage = CreateStateStorage(config);
+  LOG_IF(FATAL, !storage) << "Unknown state backend " << config.backend;
+  mesos::state::State state(storage.get());
+
+  // Synchronous writes of the framework state, as the writer thread of
+  // SchedulerStateProxy does them.
+  quobyte::SchedulerState data;
+  data.set_framework_id_value("2f3c4b1a-9d8e-4c7b-a6f5-e4d3c2b1a098-0000");
+  data.set_target_version("1.2.3");
+  const std::string value = EncodeState(data);
+  LatencySamples writes;
+  mesos::state::Variable variable = state.fetch("bench-state").get();
+  for (int i = 0; i < FLAGS_storage_writes; ++i) {
+    const int64_t start = MicrosNow();
+    Option<mesos::state::Variable> stored =
+        state.store(variable.mutate(value)).get();
+    writes.add(MicrosNow() - start);
+    CHECK(stored.isSome());
+    variable = stored.get();
+  }
+
+  // Node states of --hosts agents, written and loaded as on a restart.
+  {
+    NodeStateStore node_store(&state, "bench-nodes");
+    quobyte::NodeStateSnapshot ignored;
+    node_store.load(&ignored);
+    for (int i = 0; i < FLAGS_hosts; ++i) {
+      quobyte::NodeState node;
+      node.set_hostname("agent" + std::to_string(i) + ".dc1.example.com");
+      node.set_slave_id_value("S" + std::to_string(i));
+      node.mutable_prober()->set_state(quobyte::ServiceState::RUNNING);
+      node.mutable_registry()->set_state(quobyte::ServiceState::NOT_RUNNING);
+      node.mutable_metadata()->set_state(quobyte::ServiceState::NOT_RUNNING);
+      node.mutable_data()->set_state(quobyte::ServiceState::RUNNING);
+      node.mutable_client()->set_state(quobyte::ServiceState::NOT_RUNNING);
+      node.add_device_type(quobyte::DATA);
+      node_store.updateNode(node);
+    }
+    node_store.flush();
+  }
+  int64_t start = MicrosNow();
+  SchedulerStateProxy proxy(&state, "bench-state");
+  const int64_t state_load_micros = MicrosNow() - start;
+  start = MicrosNow();
+  NodeStateStore node_store(&state, "bench-nodes");
+  quobyte::NodeStateSnapshot snapshot;
+  node_store.load(&snapshot);
+  const int64_t nodes_load_micros = MicrosNow() - start;
+  CHECK_EQ(snapshot.node_size(), FLAGS_hosts);
+
+  printf("%-12s write p50 %6ldus p99 %6ldus, load state %6ldus, "
+         "%d nodes %8ldus\n",
+         config.backend.c_str(),
+         static_cast<long>(writes.percentile(0.5)),
+         static_cast<long>(writes.percentile(0.99)),
+         static_cast<long>(state_load_micros), FLAGS_hosts,
+         static_cast<long>(nodes_load_micros));
+}
+
+// Write latency and startup load time of the state backends.
+int RunStorageBenchmark() {
+  FLAGS_node_journal_interval_ms = 0;
+  std::istringstream backends(FLAGS_storage_backends);
+  std::string backend;
+  while (std::getline(backends, backend, ',')) {
+    StateBackendConfig config;
+    config.backend = backend;
+    config.zk_servers = FLAGS_storage_zk;
+    config.zk_path = "/quobyte-mesos-bench";
+    config.leveldb_path =
+        FLAGS_storage_leveldb_path + "-" + std::to_string(getpid());
+    BenchmarkBackend(config);
+  }
+  return 0;
+}
@@ -0,0 +1,111 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "task_id.hpp"
+
+#include <cstdlib>
+
+static const std::string kTaskNames[SERVICE_TYPE_COUNT] = {
+  "quobyte-device-prober",
+  "quobyte-registry",
+  "quobyte-metadata",
+  "quobyte-data",
+  "quobyte-api",
+  "quobyte-s3",
+  "quobyte-webconsole",
+  "quobyte-client",
+};
+
+static const std::string kServiceNames[SERVICE_TYPE_COUNT] = {
+  "prober",
+  "registry",
+  "metadata",
+  "data",
+  "api",
+  "s3",
+  "webconsole",
+  "client",
+};
+
+const std::string& ServiceTaskName(ServiceType service) {
+  return kTaskNames[service];
+}
+
+const std::string& ServiceName(ServiceType service) {
+  return kServiceNames[service];
+}
+
+std::string TaskIdTable::encode(ServiceType service,
+                                const std::string& hostname,
+                                uint32_t incarnation) {
+  std::string task_id = kTaskNames[service] + "-" + hostname;
+  if (incarnation != 0) {
+    task_id += "_" + std::to_string(incarnation);
+  }
+  return task_id;
+}
+
+bool TaskIdTable::parse(const std::string& task_id,
+                        ServiceType* service,
+                        std::string* hostname,
+                        uint32_t* incarnation) {
+  for (int i = 0; i < SERVICE_TYPE_COUNT; ++i) {
+    const std::string& name = kTaskNames[i];
+    if (task_id.size() <= name.size() + 1 ||
+        task_id.compare(0, name.size(), name) != 0 ||
+        task_id[name.size()] != '-') {
+      continue;
+    }
+    const size_t host_start = name.size() + 1;
+    size_t host_end = task_id.size();
+    *incarnation = 0;
+
+    // Hostnames do not contain '_', anything after it is the incarnation.
+    const size_t separator = task_id.rfind('_');
+    if (separator != std::string::npos && separator > host_start &&
+        separator + 1 < task_id.size()) {
+      char* end = NULL;
+      const unsigned long value =
+          strtoul(task_id.c_str() + separator + 1, &end, 10);
+      if (*end == '\0') {
+        *incarnation = static_cast<uint32_t>(value);
+        host_end = separator;
+      }
+    }
+    *service = static_cast<ServiceType>(i);
+    hostname->assign(task_id, host_start, host_end - host_start);
+    return true;
+  }
+  return false;
+}
+
+const std::string& TaskIdTable::add(ServiceType service,
+                                    NodeRegistry::Index node,
+                                    const std::string& hostname,
+                                    uint32_t incarnation) {
+  TaskKey key;
+  key.service = service;
+  key.node = node;
+  key.incarnation = incarnation;
+  std::pair<std::unordered_map<std::string, TaskKey>::iterator, bool> entry =
+      keys_.insert(std::make_pair(encode(service, hostname, incarnation), key));
+  entry.first->second = key;
+  return entry.first->first;
+}
+
+void TaskIdTable::add(const std::string& task_id, const TaskKey& key) {
+  keys_[task_id] = key;
+}
+
+void TaskIdTable::remove(const std::string& task_id) {
+  keys_.erase(task_id);
+}
+
+const TaskKey* TaskIdTable::find(const std::string& task_id) const {
+  std::unordered_map<std::string, TaskKey>::const_iterator entry =
+      keys_.find(task_id);
+  return entry == keys_.end() ? NULL : &entry->second;
+}
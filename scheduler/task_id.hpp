@@ -0,0 +1,72 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "node_registry.hpp"
+
+enum ServiceType {
+  PROBER_SERVICE = 0,
+  REGISTRY_SERVICE,
+  METADATA_SERVICE,
+  DATA_SERVICE,
+  API_SERVICE,
+  S3_SERVICE,
+  WEBCONSOLE_SERVICE,
+  CLIENT_SERVICE,
+  SERVICE_TYPE_COUNT
+};
+
+// Task name of a service, e.g. "quobyte-registry".
+const std::string& ServiceTaskName(ServiceType service);
+// Short name of a service, e.g. "registry".
+const std::string& ServiceName(ServiceType service);
+
+struct TaskKey {
+  ServiceType service;
+  NodeRegistry::Index node;
+  // Incremented on every launch of a service on a node. 0 for task ids
+  // without incarnation, as issued by earlier framework versions.
+  uint32_t incarnation;
+};
+
+// Task ids have the form <task name>-<hostname>_<incarnation>. Every id
+// this scheduler issues or reconciles is registered here, so decoding a
+// status update is a single hash lookup without substring copies. Ids from
+// before a failover are parsed by their service prefix, hostnames may
+// contain dashes.
+class TaskIdTable {
+ public:
+  static std::string encode(ServiceType service,
+                            const std::string& hostname,
+                            uint32_t incarnation);
+
+  // Parses ids that were not registered, returns false for foreign ids.
+  static bool parse(const std::string& task_id,
+                    ServiceType* service,
+                    std::string* hostname,
+                    uint32_t* incarnation);
+
+  // Returns the registered id.
+  const std::string& add(ServiceType service,
+                         NodeRegistry::Index node,
+                         const std::string& hostname,
+                         uint32_t incarnation);
+  void add(const std::string& task_id, const TaskKey& key);
+  void remove(const std::string& task_id);
+
+  // NULL if the id is not registered.
+  const TaskKey* find(const std::string& task_id) const;
+
+  size_t size() const { return keys_.size(); }
+
+ private:
+  std::unordered_map<std::string, TaskKey> keys_;
+};
@@ -0,0 +1,186 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#include "task_latency.hpp"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+static uint64_t HostKey(uint32_t node, ServiceType service) {
+  return static_cast<uint64_t>(node) * SERVICE_TYPE_COUNT + service;
+}
+
+TaskLatencies::TaskLatencies() {
+  for (int s = 0; s < SERVICE_TYPE_COUNT; ++s) {
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+      histograms_[s][p] = MetricsRegistry::instance()->histogram(
+          "quobyte_task_phase_seconds",
+          "Task state transitions, timed from the launch or from RUNNING",
+          "service=\"" + ServiceName(static_cast<ServiceType>(s)) +
+              "\",phase=\"" + phaseName(static_cast<Phase>(p)) + "\"");
+    }
+  }
+}
+
+const char* TaskLatencies::phaseName(Phase phase) {
+  static const char* kNames[PHASE_COUNT] = {
+    "launch_to_staging",
+    "launch_to_starting",
+    "launch_to_running",
+    "launch_to_failure",
+    "running_to_end",
+  };
+  return kNames[phase];
+}
+
+void TaskLatencies::launched(ServiceType service,
+                             uint32_t node,
+                             uint32_t incarnation,
+                             int64_t now_us) {
+  std::lock_guard<std::mutex> lock(lock_);
+  Timeline& timeline = hosts_[HostKey(node, service)].timeline;
+  timeline = Timeline();
+  timeline.incarnation = incarnation;
+  timeline.launched_us = now_us;
+}
+
+void TaskLatencies::update(ServiceType service,
+                           uint32_t node,
+                           uint32_t incarnation,
+                           mesos::TaskState state,
+                           int64_t now_us) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto host = hosts_.find(HostKey(node, service));
+  if (host == hosts_.end() ||
+      host->second.timeline.incarnation != incarnation) {
+    return;
+  }
+  Timeline& timeline = host->second.timeline;
+  const int64_t since_launch =
+      std::max<int64_t>(0, now_us - timeline.launched_us);
+  switch (state) {
+    case mesos::TASK_STAGING:
+      if (timeline.staging_us == 0) {
+        timeline.staging_us = now_us;
+        observe(service, LAUNCH_TO_STAGING, since_launch);
+      }
+      break;
+    case mesos::TASK_STARTING:
+      if (timeline.starting_us == 0) {
+        timeline.starting_us = now_us;
+        observe(service, LAUNCH_TO_STARTING, since_launch);
+      }
+      break;
+    case mesos::TASK_RUNNING:
+      if (timeline.running_us == 0 && timeline.ended_us == 0) {
+        running(service, &host->second, now_us, since_launch);
+      }
+      break;
+    case mesos::TASK_FINISHED:
+      // The prober task finishes as soon as its executor runs.
+      if (timeline.running_us == 0 && timeline.ended_us == 0) {
+        running(service, &host->second, now_us, since_launch);
+      }
+      // Fall through.
+    case mesos::TASK_FAILED:
+    case mesos::TASK_KILLED:
+    case mesos::TASK_LOST:
+    case mesos::TASK_ERROR:
+      if (timeline.ended_us == 0) {
+        timeline.ended_us = now_us;
+        timeline.end_state = state;
+        if (timeline.running_us != 0) {
+          observe(service, RUNNING_TO_END,
+                  std::max<int64_t>(0, now_us - timeline.running_us));
+        } else {
+          observe(service, LAUNCH_TO_FAILURE, since_launch);
+          ++host->second.startups.failed;
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void TaskLatencies::running(ServiceType service,
+                            Host* host,
+                            int64_t now_us,
+                            int64_t since_launch) {
+  host->timeline.running_us = now_us;
+  observe(service, LAUNCH_TO_RUNNING, since_launch);
+  Startups& startups = host->startups;
+  ++startups.count;
+  startups.sum_us += since_launch;
+  startups.max_us = std::max(startups.max_us, since_launch);
+  startups.last_us = since_launch;
+  ++startups.buckets[Histogram::bucket(since_launch)];
+}
+
+void TaskLatencies::observe(ServiceType service,
+                            Phase phase,
+                            int64_t micros) {
+  histograms_[service][phase]->observe(micros);
+}
+
+bool TaskLatencies::host(uint32_t node,
+                         ServiceType service,
+                         Host* host) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto entry = hosts_.find(HostKey(node, service));
+  if (entry == hosts_.end()) {
+    return false;
+  }
+  *host = entry->second;
+  return true;
+}
+
+const Histogram& TaskLatencies::histogram(ServiceType service,
+                                          Phase phase) const {
+  return *histograms_[service][phase];
+}
+
+std::vector<TaskLatencies::Outlier> TaskLatencies::outliers(
+    double factor, int64_t min_us) const {
+  // Mean startup time and key of the nodes that started a service.
+  std::vector<std::pair<int64_t, uint64_t>> means[SERVICE_TYPE_COUNT];
+  std::vector<Outlier> result;
+  std::lock_guard<std::mutex> lock(lock_);
+  for (const auto& host : hosts_) {
+    const Startups& startups = host.second.startups;
+    if (startups.count > 0) {
+      means[host.first % SERVICE_TYPE_COUNT].emplace_back(
+          startups.sum_us / startups.count, host.first);
+    }
+  }
+  for (int s = 0; s < SERVICE_TYPE_COUNT; ++s) {
+    std::vector<std::pair<int64_t, uint64_t>>& nodes = means[s];
+    if (nodes.size() < 2) {
+      continue;
+    }
+    std::nth_element(nodes.begin(), nodes.begin() + nodes.size() / 2,
+                     nodes.end());
+    const int64_t median_us = nodes[nodes.size() / 2].first;
+    for (const auto& node : nodes) {
+      if (node.first > factor * median_us &&
+          node.first - median_us >= min_us) {
+        Outlier outlier;
+        outlier.node = node.second / SERVICE_TYPE_COUNT;
+        outlier.service = static_cast<ServiceType>(s);
+        outlier.startups = hosts_.at(node.second).startups;
+        outlier.median_us = median_us;
+        result.push_back(outlier);
+      }
+    }
+  }
+  std::sort(result.begin(), result.end(),
+            [](const Outlier& a, const Outlier& b) {
+              return a.startups.sum_us / a.startups.count >
+                  b.startups.sum_us / b.startups.count;
+            });
+  return result;
+}
@@ -0,0 +1,109 @@
+/**
+ * Copyright 2015 Quobyte Inc. All rights reserved.
+ *
+ * See LICENSE file for license details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <mesos/mesos.hpp>
+
+#include "metrics.hpp"
+#include "task_id.hpp"
+
+// Times the tasks of every service from their launch until the agent
+// stages, starts and runs them, and until they end. The durations go into
+// histograms per service, exported on /metrics, and into startup summaries
+// per node and service that show the hosts slow to start tasks, e.g. from
+// image pulls or overloaded disks. Thread-safe.
+class TaskLatencies {
+ public:
+  enum Phase {
+    LAUNCH_TO_STAGING = 0,
+    LAUNCH_TO_STARTING,
+    LAUNCH_TO_RUNNING,
+    // Tasks that ended before running.
+    LAUNCH_TO_FAILURE,
+    RUNNING_TO_END,
+    PHASE_COUNT
+  };
+
+  // When the latest task of a service on a node went through its states,
+  // in microseconds, 0 for not yet.
+  struct Timeline {
+    uint32_t incarnation = 0;
+    int64_t launched_us = 0;
+    int64_t staging_us = 0;
+    int64_t starting_us = 0;
+    int64_t running_us = 0;
+    int64_t ended_us = 0;
+    mesos::TaskState end_state = mesos::TASK_FINISHED;
+  };
+
+  // Launch to RUNNING of the tasks of a service on a node.
+  struct Startups {
+    uint32_t count = 0;
+    // Ended before running.
+    uint32_t failed = 0;
+    int64_t sum_us = 0;
+    int64_t max_us = 0;
+    int64_t last_us = 0;
+    // Not cumulative, by Histogram::bucket().
+    uint32_t buckets[Histogram::kBuckets] = {};
+  };
+
+  struct Host {
+    Timeline timeline;
+    Startups startups;
+  };
+
+  // A node whose mean startup time of a service is far above the median
+  // of all nodes that started the service.
+  struct Outlier {
+    uint32_t node;
+    ServiceType service;
+    Startups startups;
+    int64_t median_us;
+  };
+
+  TaskLatencies();
+
+  static const char* phaseName(Phase phase);
+
+  // The launch of a new incarnation of the service on the node.
+  void launched(ServiceType service,
+                uint32_t node,
+                uint32_t incarnation,
+                int64_t now_us);
+  // A status update of a task. Tasks launched before the scheduler started
+  // are not timed.
+  void update(ServiceType service,
+              uint32_t node,
+              uint32_t incarnation,
+              mesos::TaskState state,
+              int64_t now_us);
+
+  // False if the service was never launched on the node.
+  bool host(uint32_t node, ServiceType service, Host* host) const;
+  const Histogram& histogram(ServiceType service, Phase phase) const;
+  // Nodes whose mean startup time is more than factor times the median,
+  // and at least min_us above it. Slowest first.
+  std::vector<Outlier> outliers(double factor, int64_t min_us) const;
+
+ private:
+  void running(ServiceType service,
+               Host* host,
+               int64_t now_us,
+               int64_t since_launch);
+  void observe(ServiceType service, Phase phase, int64_t micros);
+
+  mutable std::mutex lock_;
+  // By node * SERVICE_TYPE_COUNT + service.
+  std::unordered_map<uint64_t, Host> hosts_;
+  Histogram* histograms_[SERVICE_TYPE_COUNT][PHASE_COUNT];
+};